@@ -0,0 +1,683 @@
+/*
+ * bench.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Pruebas de rendimiento de la ruta de datos de la librería.
+ * Se liga directamente con los objetos de la librería usando --wrap,
+ * para contar las reservas de memoria y las llamadas al sistema */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpstamp.h"
+#include "blend.h"
+
+/* Cuántas operaciones individuales medir como máximo por prueba */
+#define MAX_OPS 1000
+
+/* Cuántas veces mezclar el panel por cada kernel */
+#define BLEND_OPS 2000
+
+static unsigned long bench_allocs = 0;
+static unsigned long bench_syscalls = 0;
+
+/* Envolturas, ver cpstamp_bench_LDFLAGS en Makefile.am */
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t n, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+char *__real_strdup (const char *s);
+ssize_t __real_read (int fd, void *buf, size_t count);
+ssize_t __real_write (int fd, const void *buf, size_t count);
+int __real_open (const char *path, int flags, ...);
+int __real_close (int fd);
+off_t __real_lseek (int fd, off_t offset, int whence);
+int __real_ftruncate (int fd, off_t length);
+int __real_mkdir (const char *path, mode_t mode);
+int __real_stat (const char *path, struct stat *buf);
+int __real_fstat (int fd, struct stat *buf);
+int __real_fcntl (int fd, int cmd, ...);
+int __real_openat (int dirfd, const char *path, int flags, ...);
+int __real_fstatat (int dirfd, const char *path, struct stat *buf, int flags);
+int __real_renameat (int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
+int __real_unlinkat (int dirfd, const char *path, int flags);
+int __real_fsync (int fd);
+ssize_t __real_pread (int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pwrite (int fd, const void *buf, size_t count, off_t offset);
+
+void *__wrap_malloc (size_t size) {
+	bench_allocs++;
+	return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t n, size_t size) {
+	bench_allocs++;
+	return __real_calloc (n, size);
+}
+
+void *__wrap_realloc (void *ptr, size_t size) {
+	bench_allocs++;
+	return __real_realloc (ptr, size);
+}
+
+char *__wrap_strdup (const char *s) {
+	bench_allocs++;
+	return __real_strdup (s);
+}
+
+ssize_t __wrap_read (int fd, void *buf, size_t count) {
+	bench_syscalls++;
+	return __real_read (fd, buf, count);
+}
+
+ssize_t __wrap_write (int fd, const void *buf, size_t count) {
+	bench_syscalls++;
+	return __real_write (fd, buf, count);
+}
+
+int __wrap_open (const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode = 0;
+	
+	if (flags & O_CREAT) {
+		va_start (ap, flags);
+		mode = va_arg (ap, int);
+		va_end (ap);
+	}
+	
+	bench_syscalls++;
+	return __real_open (path, flags, mode);
+}
+
+int __wrap_close (int fd) {
+	bench_syscalls++;
+	return __real_close (fd);
+}
+
+off_t __wrap_lseek (int fd, off_t offset, int whence) {
+	bench_syscalls++;
+	return __real_lseek (fd, offset, whence);
+}
+
+int __wrap_ftruncate (int fd, off_t length) {
+	bench_syscalls++;
+	return __real_ftruncate (fd, length);
+}
+
+int __wrap_mkdir (const char *path, mode_t mode) {
+	bench_syscalls++;
+	return __real_mkdir (path, mode);
+}
+
+int __wrap_stat (const char *path, struct stat *buf) {
+	bench_syscalls++;
+	return __real_stat (path, buf);
+}
+
+int __wrap_fstat (int fd, struct stat *buf) {
+	bench_syscalls++;
+	return __real_fstat (fd, buf);
+}
+
+int __wrap_fcntl (int fd, int cmd, ...) {
+	va_list ap;
+	void *arg;
+	
+	/* Los comandos que usa la librería reciben un apuntador o nada */
+	va_start (ap, cmd);
+	arg = va_arg (ap, void *);
+	va_end (ap);
+	
+	bench_syscalls++;
+	return __real_fcntl (fd, cmd, arg);
+}
+
+int __wrap_openat (int dirfd, const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode = 0;
+	
+	if (flags & O_CREAT) {
+		va_start (ap, flags);
+		mode = va_arg (ap, int);
+		va_end (ap);
+	}
+	
+	bench_syscalls++;
+	return __real_openat (dirfd, path, flags, mode);
+}
+
+int __wrap_fstatat (int dirfd, const char *path, struct stat *buf, int flags) {
+	bench_syscalls++;
+	return __real_fstatat (dirfd, path, buf, flags);
+}
+
+int __wrap_renameat (int olddirfd, const char *oldpath, int newdirfd, const char *newpath) {
+	bench_syscalls++;
+	return __real_renameat (olddirfd, oldpath, newdirfd, newpath);
+}
+
+int __wrap_unlinkat (int dirfd, const char *path, int flags) {
+	bench_syscalls++;
+	return __real_unlinkat (dirfd, path, flags);
+}
+
+int __wrap_fsync (int fd) {
+	bench_syscalls++;
+	return __real_fsync (fd);
+}
+
+ssize_t __wrap_pread (int fd, void *buf, size_t count, off_t offset) {
+	bench_syscalls++;
+	return __real_pread (fd, buf, count, offset);
+}
+
+ssize_t __wrap_pwrite (int fd, const void *buf, size_t count, off_t offset) {
+	bench_syscalls++;
+	return __real_pwrite (fd, buf, count, offset);
+}
+
+typedef struct {
+	struct timespec start;
+	unsigned long allocs, syscalls;
+} BenchMark;
+
+static void bench_begin (BenchMark *m) {
+	m->allocs = bench_allocs;
+	m->syscalls = bench_syscalls;
+	clock_gettime (CLOCK_MONOTONIC, &m->start);
+}
+
+static void bench_end (BenchMark *m, const char *op, int n_stamps, int version, int ops) {
+	struct timespec end;
+	double ns;
+	
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	
+	ns = (end.tv_sec - m->start.tv_sec) * 1e9 + (end.tv_nsec - m->start.tv_nsec);
+	if (ops <= 0) ops = 1;
+	
+	printf ("%-16s %8d   v%d %8d %14.1f %14.0f %12.2f %12.2f\n", op, n_stamps, version, ops,
+	        ns / ops, (ns > 0) ? ops * 1e9 / ns : 0.0,
+	        (double) (bench_allocs - m->allocs) / ops,
+	        (double) (bench_syscalls - m->syscalls) / ops);
+}
+
+/* Generador de números para las pruebas, siempre la misma secuencia */
+static uint32_t bench_seed = 12345;
+
+static int bench_random (int max) {
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return (bench_seed >> 8) % max;
+}
+
+static void bench_put_u32 (FILE *f, uint32_t val) {
+	fwrite (&val, sizeof (uint32_t), 1, f);
+}
+
+static void bench_put_string (FILE *f, const char *str) {
+	uint32_t len = strlen (str) + 1;
+	
+	fwrite (&len, sizeof (uint32_t), 1, f);
+	fwrite (str, sizeof (char), len, f);
+}
+
+/* Crear un archivo sintético de estampas en la versión dada */
+static int bench_generate (const char *dir, const char *clave, int version, int n_stamps) {
+	char path[4096], buf[64];
+	FILE *f;
+	int g;
+	
+	snprintf (path, sizeof (path), "%s/.cpstamps/%s", dir, clave);
+	f = fopen (path, "wb");
+	
+	if (f == NULL) return -1;
+	
+	bench_put_u32 (f, version);
+	bench_put_u32 (f, n_stamps);
+	
+	if (version >= 1) {
+		bench_put_u32 (f, STAMP_TYPE_GAME);
+		bench_put_string (f, "Benchmark");
+		bench_put_string (f, "");
+		bench_put_string (f, "");
+		bench_put_string (f, "");
+	}
+	
+	for (g = 0; g < n_stamps; g++) {
+		bench_put_u32 (f, g);
+		
+		sprintf (buf, "Stamp number %d", g);
+		bench_put_string (f, buf);
+		
+		if (version >= 1) {
+			sprintf (buf, "Description of the stamp number %d", g);
+			bench_put_string (f, buf);
+		}
+		
+		bench_put_u32 (f, g % NUM_STAMP_TYPE);
+		bench_put_u32 (f, g % (STAMP_EXTREME + 1));
+		bench_put_u32 (f, (g % 3) == 0);
+	}
+	
+	fclose (f);
+	
+	return 0;
+}
+
+static void bench_category (CPStampHandle *handle, const char *dir, int version, int n_stamps) {
+	CPStampCategory *cat;
+	BenchMark m;
+	char clave[64], titulo[64], path[4096];
+	int g, ops, found;
+	
+	sprintf (clave, "bench-v%d-%d", version, n_stamps);
+	
+	if (bench_generate (dir, clave, version, n_stamps) < 0) {
+		perror ("bench_generate");
+		return;
+	}
+	
+	ops = (n_stamps < MAX_OPS) ? n_stamps : MAX_OPS;
+	
+	bench_begin (&m);
+	cat = CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", clave);
+	bench_end (&m, "Open", n_stamps, version, 1);
+	
+	if (cat == NULL) {
+		fprintf (stderr, "Failed to open %s\n", clave);
+		return;
+	}
+	
+	found = 0;
+	bench_begin (&m);
+	for (g = 0; g < ops; g++) {
+		found += CPStamp_IsRegistered (cat, bench_random (n_stamps * 2));
+	}
+	bench_end (&m, "IsRegistered", n_stamps, version, ops);
+	
+	bench_begin (&m);
+	for (g = 0; g < ops; g++) {
+		sprintf (titulo, "New stamp %d", g);
+		CPStamp_Register (cat, n_stamps + g, titulo, "Registered by the benchmark", NULL, STAMP_TYPE_GAME, STAMP_NORMAL);
+	}
+	bench_end (&m, "Register", n_stamps, version, ops);
+	
+	bench_begin (&m);
+	for (g = 0; g < ops; g++) {
+		CPStamp_Earn (handle, cat, bench_random (n_stamps + ops));
+	}
+	bench_end (&m, "Earn", n_stamps, version, ops);
+	
+	/* Lo que cuesta al hilo que llama, la escritura sigue en el hilo de guardado.
+	 * Las llamadas al sistema del hilo se cuentan donde alcancen a ocurrir */
+	bench_begin (&m);
+	CPStamp_SaveAsync (cat);
+	bench_end (&m, "SaveAsync", n_stamps, version, 1);
+	
+	bench_begin (&m);
+	CPStamp_WaitSaves (handle);
+	bench_end (&m, "WaitSaves", n_stamps, version, 1);
+	
+	bench_begin (&m);
+	CPStamp_ClearStamps (cat);
+	bench_end (&m, "ClearStamps", n_stamps, version, 1);
+	
+	/* Lo que cuesta ganar cuando otro proceso puede estar mirando */
+	bench_begin (&m);
+	CPStamp_ShareCategory (cat);
+	bench_end (&m, "ShareCategory", n_stamps, version, 1);
+	
+	bench_begin (&m);
+	for (g = 0; g < ops; g++) {
+		CPStamp_Earn (handle, cat, bench_random (n_stamps + ops));
+	}
+	bench_end (&m, "Earn shared", n_stamps, version, ops);
+	
+	bench_begin (&m);
+	CPStamp_Close (cat);
+	bench_end (&m, "Close", n_stamps, version, 1);
+	
+	/* Evitar que el compilador descarte las búsquedas */
+	if (found < 0) printf ("%d\n", found);
+	
+	snprintf (path, sizeof (path), "%s/.cpstamps/%s", dir, clave);
+	unlink (path);
+}
+
+/* Memoria de la categoría abierta según CPStamp_GetStats, y las reservas
+ * que hizo CPStamp_Open para leer el archivo */
+static void bench_memory (CPStampHandle *handle, const char *dir, int n_stamps) {
+	CPStampCategory *cat;
+	CPStampStats stats;
+	unsigned long allocs;
+	char clave[64], path[4096];
+	
+	sprintf (clave, "bench-memory-%d", n_stamps);
+	
+	if (bench_generate (dir, clave, 1, n_stamps) < 0) {
+		perror ("bench_generate");
+		return;
+	}
+	
+	allocs = bench_allocs;
+	cat = CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", clave);
+	allocs = bench_allocs - allocs;
+	
+	if (cat == NULL) {
+		fprintf (stderr, "Failed to open %s\n", clave);
+		return;
+	}
+	
+	CPStamp_GetStats (handle, &stats);
+	printf ("%-16s %8d   v1 %14lu %14.1f %12lu\n", "category", n_stamps,
+	        (unsigned long) stats.category_memory, (double) stats.category_memory / n_stamps, allocs);
+	
+	CPStamp_Close (cat);
+	
+	snprintf (path, sizeof (path), "%s/.cpstamps/%s", dir, clave);
+	unlink (path);
+}
+
+/* Memoria de las imágenes, la tipografía y el sonido, y lo que cuesta
+ * ganar una estampa cuando hay que volver a cargarlos. Debe correr con la
+ * cola vacía, las notificaciones se dibujan hasta terminar */
+static void bench_assets (CPStampHandle *handle) {
+	CPStampCategory *cat;
+	CPStampStats stats;
+	SDL_Surface *screen;
+	BenchMark m;
+	int g;
+	
+	screen = SDL_CreateRGBSurface (SDL_SWSURFACE, 640, 480, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	cat = CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", "bench-assets");
+	
+	if (screen == NULL || cat == NULL) {
+		fprintf (stderr, "Failed to prepare the asset benchmark\n");
+		if (screen != NULL) SDL_FreeSurface (screen);
+		if (cat != NULL) CPStamp_Close (cat);
+		return;
+	}
+	
+	for (g = 0; g < 2; g++) {
+		CPStamp_Register (cat, g, "Stamp", "Registered by the benchmark", NULL, STAMP_TYPE_GAME, g);
+	}
+	
+	CPStamp_GetStats (handle, &stats);
+	printf ("%-16s %14lu\n", "resident bytes", (unsigned long) stats.asset_memory);
+	
+	bench_begin (&m);
+	CPStamp_Earn (handle, cat, 0);
+	bench_end (&m, "Earn/resident", 1, 2, 1);
+	
+	while (CPStamp_IsActive (handle)) CPStamp_Draw (handle, screen, 0);
+	
+	/* Dejar que se liberen por inactividad */
+	CPStamp_SetIdleUnload (handle, 1);
+	SDL_Delay (5);
+	CPStamp_Draw (handle, screen, 0);
+	
+	bench_begin (&m);
+	CPStamp_Earn (handle, cat, 1);
+	bench_end (&m, "Earn/reload", 1, 2, 1);
+	
+	while (CPStamp_IsActive (handle)) CPStamp_Draw (handle, screen, 0);
+	CPStamp_SetIdleUnload (handle, 0);
+	
+	CPStamp_Close (cat);
+	SDL_FreeSurface (screen);
+}
+
+enum {
+	BENCH_FILES,
+	BENCH_MEMORY,
+	BENCH_DATABASE
+};
+
+/* Guardar y volver a abrir una categoría en los archivos, en memoria o en
+ * la base de datos. Contra memoria, la diferencia es lo que cuesta el disco */
+static void bench_storage (CPStampHandle *handle, const char *dir, int n_stamps, int modo) {
+	static const char *nombres[] = {"file", "memory", "database"};
+	CPStampCategory *cat;
+	BenchMark m;
+	char clave[64], titulo[64], path[4096], op[32];
+	const char *backend;
+	int g, res;
+	
+	backend = nombres[modo];
+	res = 0;
+	if (modo == BENCH_MEMORY) res = CPStamp_UseMemoryStorage (handle);
+	if (modo == BENCH_DATABASE) res = CPStamp_UseDatabaseStorage (handle);
+	
+	if (res < 0) {
+		perror (backend);
+		return;
+	}
+	
+	sprintf (clave, "bench-storage-%d", n_stamps);
+	cat = CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", clave);
+	
+	if (cat != NULL) {
+		for (g = 0; g < n_stamps; g++) {
+			sprintf (titulo, "Stamp %d", g);
+			CPStamp_Register (cat, g, titulo, "Registered by the benchmark", NULL, STAMP_TYPE_GAME, g % 4);
+		}
+		
+		sprintf (op, "Save/%s", backend);
+		bench_begin (&m);
+		CPStamp_SaveAsync (cat);
+		CPStamp_WaitSaves (handle);
+		bench_end (&m, op, n_stamps, 2, 1);
+		
+		CPStamp_Close (cat);
+		
+		sprintf (op, "Open/%s", backend);
+		bench_begin (&m);
+		cat = CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", clave);
+		bench_end (&m, op, n_stamps, 2, 1);
+		
+		CPStamp_Close (cat);
+	} else {
+		fprintf (stderr, "Failed to open %s\n", clave);
+	}
+	
+	/* Regresar a los archivos también libera la memoria */
+	if (modo != BENCH_FILES) CPStamp_UseFileStorage (handle);
+	
+	snprintf (path, sizeof (path), "%s/.cpstamps/%s", dir, (modo == BENCH_DATABASE) ? ".database" : clave);
+	if (modo != BENCH_MEMORY) unlink (path);
+}
+
+/* Superficie del tamaño del panel, con bordes transparentes, orillas
+ * semitransparentes e interior opaco, como las imágenes reales */
+static SDL_Surface *bench_panel (void) {
+	SDL_Surface *panel;
+	Uint32 *p, a;
+	int x, y, borde;
+	
+	panel = SDL_CreateRGBSurface (SDL_SWSURFACE, 300, 80, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	
+	if (panel == NULL) return NULL;
+	
+	for (y = 0; y < panel->h; y++) {
+		p = (Uint32 *) ((Uint8 *) panel->pixels + y * panel->pitch);
+		for (x = 0; x < panel->w; x++) {
+			borde = x;
+			if (panel->w - 1 - x < borde) borde = panel->w - 1 - x;
+			if (y < borde) borde = y;
+			if (panel->h - 1 - y < borde) borde = panel->h - 1 - y;
+			
+			if (borde < 4) {
+				a = 0;
+			} else if (borde < 12) {
+				a = (borde - 4) * 32;
+			} else {
+				a = 255;
+			}
+			
+			p[x] = (a << 24) | (bench_random (0x1000000));
+		}
+	}
+	
+	return panel;
+}
+
+static void bench_blend (void) {
+	static const int depths[] = {32, 16};
+	SDL_Surface *panel, *dst;
+	SDL_Rect rect;
+	BenchMark m;
+	struct timespec end;
+	double ns;
+	int g, k, op, best;
+	
+	panel = bench_panel ();
+	
+	if (panel == NULL) return;
+	
+	printf ("\n%-16s %8s %8s %14s %14s\n", "blend", "target", "ops", "ns/op", "Mpixels/s");
+	
+	best = CPSTAMP_BLEND_SCALAR;
+	for (g = 0; g < (int) (sizeof (depths) / sizeof (depths[0])); g++) {
+		if (depths[g] == 32) {
+			dst = SDL_CreateRGBSurface (SDL_SWSURFACE, 640, 480, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+		} else {
+			dst = SDL_CreateRGBSurface (SDL_SWSURFACE, 640, 480, 16, 0xF800, 0x07E0, 0x001F, 0);
+		}
+		
+		if (dst == NULL) continue;
+		
+		/* -1 es la mezcla genérica de SDL */
+		for (k = -1; k < NUM_CPSTAMP_BLEND; k++) {
+			if (k >= 0) {
+				if (!cpstamp_blend_select (k)) continue;
+				best = k;
+			}
+			
+			bench_begin (&m);
+			for (op = 0; op < BLEND_OPS; op++) {
+				rect.x = 392; rect.y = 0;
+				if (k < 0) {
+					SDL_BlitSurface (panel, NULL, dst, &rect);
+				} else {
+					cpstamp_blend (panel, NULL, dst, &rect);
+				}
+			}
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			
+			ns = (end.tv_sec - m.start.tv_sec) * 1e9 + (end.tv_nsec - m.start.tv_nsec);
+			printf ("%-16s %6s%2d %8d %14.1f %14.1f\n", (k < 0) ? "SDL_BlitSurface" : cpstamp_blend_name (k),
+			        (depths[g] == 32) ? "xrgb" : "rgb", depths[g], BLEND_OPS,
+			        ns / BLEND_OPS, (ns > 0) ? (double) panel->w * panel->h * BLEND_OPS * 1e3 / ns : 0.0);
+		}
+		
+		SDL_FreeSurface (dst);
+	}
+	
+	/* Dejar la mejor implementación, como la elige la librería */
+	cpstamp_blend_select (best);
+	SDL_FreeSurface (panel);
+}
+
+int main (int argc, char **argv) {
+	static const int sizes[] = {100, 1000, 10000, 100000};
+	CPStampHandle *handle;
+	char dir[] = "/tmp/cpstamp-bench-XXXXXX";
+	char path[4096];
+	int g, version, max_stamps;
+	
+	max_stamps = 100000;
+	if (argc > 1) {
+		max_stamps = atoi (argv[1]);
+	}
+	
+	/* Usar una carpeta de usuario temporal */
+	if (mkdtemp (dir) == NULL) {
+		perror ("mkdtemp");
+		return 1;
+	}
+	setenv ("HOME", dir, 1);
+	
+	handle = CPStamp_Init (argc, argv);
+	
+	if (handle == NULL) {
+		fprintf (stderr, "CPStamp_Init failed, check the data directory\n");
+		rmdir (dir);
+		return 1;
+	}
+	
+	/* La primera apertura crea la carpeta .cpstamps */
+	CPStamp_Close (CPStamp_Open (handle, STAMP_TYPE_GAME, "Benchmark", "bench-warmup"));
+	
+	printf ("%-16s %8s %4s %8s %14s %14s %12s %12s\n", "assets", "stamps", "file", "ops", "ns/op", "ops/s", "allocs/op", "syscalls/op");
+	
+	bench_assets (handle);
+	
+	printf ("\n%-16s %8s %4s %8s %14s %14s %12s %12s\n", "operation", "stamps", "file", "ops", "ns/op", "ops/s", "allocs/op", "syscalls/op");
+	
+	for (g = 0; g < (int) (sizeof (sizes) / sizeof (sizes[0])); g++) {
+		if (sizes[g] > max_stamps) break;
+		
+		for (version = 0; version <= 1; version++) {
+			bench_category (handle, dir, version, sizes[g]);
+		}
+	}
+	
+	printf ("\n%-16s %8s %4s %14s %14s %12s\n", "memory", "stamps", "file", "bytes", "bytes/stamp", "allocs");
+	
+	for (g = 0; g < (int) (sizeof (sizes) / sizeof (sizes[0])); g++) {
+		if (sizes[g] > max_stamps) break;
+		
+		bench_memory (handle, dir, sizes[g]);
+	}
+	
+	printf ("\n%-16s %8s %4s %8s %14s %14s %12s %12s\n", "storage", "stamps", "file", "ops", "ns/op", "ops/s", "allocs/op", "syscalls/op");
+	
+	for (g = 0; g < (int) (sizeof (sizes) / sizeof (sizes[0])); g++) {
+		if (sizes[g] > max_stamps) break;
+		
+		bench_storage (handle, dir, sizes[g], BENCH_FILES);
+		bench_storage (handle, dir, sizes[g], BENCH_MEMORY);
+		bench_storage (handle, dir, sizes[g], BENCH_DATABASE);
+	}
+	
+	bench_blend ();
+	
+	sprintf (path, "%s/.cpstamps/bench-warmup", dir);
+	unlink (path);
+	sprintf (path, "%s/.cpstamps/bench-assets", dir);
+	unlink (path);
+	sprintf (path, "%s/.cpstamps/.index", dir);
+	unlink (path);
+	sprintf (path, "%s/.cpstamps/.lock", dir);
+	unlink (path);
+	sprintf (path, "%s/.cpstamps", dir);
+	rmdir (path);
+	rmdir (dir);
+	
+	return 0;
+}
+
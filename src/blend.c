@@ -0,0 +1,674 @@
+/*
+ * blend.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Mezcla alpha de superficies ARGB8888 sobre pantallas XRGB8888 o RGB565.
+ * Todas las implementaciones calculan (s * a + d * (255 - a)) / 255 con
+ * redondeo exacto, así que dan los mismos pixeles.
+ *
+ * El byte alto de un destino XRGB8888 recibe el alpha de la composición
+ * "over" (a + d * (255 - a) / 255), así un buffer ARGB8888 con alpha
+ * premultiplicado se puede mezclar como si fuera XRGB8888 */
+
+#include <stdlib.h>
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "blend.h"
+#include "compat.h"
+
+#if (defined (__i386__) || defined (__x86_64__)) && (defined (__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CPSTAMP_BLEND_X86 1
+#include <immintrin.h>
+
+#define CPSTAMP_TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define CPSTAMP_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+
+typedef void (*CPStampBlendRow8888) (const Uint32 *src, Uint32 *dst, int n);
+typedef void (*CPStampBlendRow565) (const Uint32 *src, Uint16 *dst, int n);
+
+static CPStampBlendRow8888 cpstamp_blend_row_8888 = NULL;
+static CPStampBlendRow565 cpstamp_blend_row_565 = NULL;
+
+static const char *cpstamp_blend_names [NUM_CPSTAMP_BLEND] = {
+	"scalar",
+	"sse2",
+	"avx2"
+};
+
+static inline Uint32 cpstamp_blend_channel (Uint32 s, Uint32 d, Uint32 a) {
+	Uint32 t = s * a + d * (255 - a) + 128;
+	
+	return (t + (t >> 8)) >> 8;
+}
+
+static void cpstamp_blend_row_8888_scalar (const Uint32 *src, Uint32 *dst, int n) {
+	Uint32 s, d, a;
+	int g;
+	
+	for (g = 0; g < n; g++) {
+		s = src[g];
+		a = s >> 24;
+		
+		if (a == 0) continue;
+		if (a == 255) {
+			dst[g] = s;
+			continue;
+		}
+		
+		d = dst[g];
+		dst[g] = (cpstamp_blend_channel (255, d >> 24, a) << 24) |
+		         (cpstamp_blend_channel ((s >> 16) & 0xFF, (d >> 16) & 0xFF, a) << 16) |
+		         (cpstamp_blend_channel ((s >> 8) & 0xFF, (d >> 8) & 0xFF, a) << 8) |
+		         cpstamp_blend_channel (s & 0xFF, d & 0xFF, a);
+	}
+}
+
+static void cpstamp_blend_row_565_scalar (const Uint32 *src, Uint16 *dst, int n) {
+	Uint32 s, a, r, gr, b;
+	Uint16 d;
+	int g;
+	
+	for (g = 0; g < n; g++) {
+		s = src[g];
+		a = s >> 24;
+		
+		if (a == 0) continue;
+		
+		/* Expandir el destino a 8 bits por canal */
+		d = dst[g];
+		r = (d >> 11) & 0x1F;
+		gr = (d >> 5) & 0x3F;
+		b = d & 0x1F;
+		r = (r << 3) | (r >> 2);
+		gr = (gr << 2) | (gr >> 4);
+		b = (b << 3) | (b >> 2);
+		
+		r = cpstamp_blend_channel ((s >> 16) & 0xFF, r, a);
+		gr = cpstamp_blend_channel ((s >> 8) & 0xFF, gr, a);
+		b = cpstamp_blend_channel (s & 0xFF, b, a);
+		
+		dst[g] = ((r >> 3) << 11) | ((gr >> 2) << 5) | (b >> 3);
+	}
+}
+
+#ifdef CPSTAMP_BLEND_X86
+/* Mezcla de canales de 16 bits: (s * a + d * (255 - a) + 128) / 255 */
+static inline __m128i CPSTAMP_TARGET_SSE2 cpstamp_blend_epi16_sse2 (__m128i s, __m128i d, __m128i a) {
+	__m128i t;
+	
+	t = _mm_add_epi16 (_mm_mullo_epi16 (s, a), _mm_mullo_epi16 (d, _mm_sub_epi16 (_mm_set1_epi16 (255), a)));
+	t = _mm_add_epi16 (t, _mm_set1_epi16 (128));
+	
+	return _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+}
+
+/* Repetir el alpha de cada pixel en sus 4 canales */
+static inline __m128i CPSTAMP_TARGET_SSE2 cpstamp_blend_alpha_sse2 (__m128i x) {
+	return _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (x, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3));
+}
+
+static inline __m256i CPSTAMP_TARGET_AVX2 cpstamp_blend_epi16_avx2 (__m256i s, __m256i d, __m256i a) {
+	__m256i t;
+	
+	t = _mm256_add_epi16 (_mm256_mullo_epi16 (s, a), _mm256_mullo_epi16 (d, _mm256_sub_epi16 (_mm256_set1_epi16 (255), a)));
+	t = _mm256_add_epi16 (t, _mm256_set1_epi16 (128));
+	
+	return _mm256_srli_epi16 (_mm256_add_epi16 (t, _mm256_srli_epi16 (t, 8)), 8);
+}
+
+static inline __m256i CPSTAMP_TARGET_AVX2 cpstamp_blend_alpha_avx2 (__m256i x) {
+	return _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (x, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3));
+}
+
+static void CPSTAMP_TARGET_SSE2 cpstamp_blend_row_8888_sse2 (const Uint32 *src, Uint32 *dst, int n) {
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i amask = _mm_set1_epi32 ((int) 0xFF000000);
+	__m128i s, d, a, slo, shi, dlo, dhi, alo, ahi, lo, hi;
+	int g;
+	
+	for (g = 0; g + 4 <= n; g += 4) {
+		s = _mm_loadu_si128 ((const __m128i *) &src[g]);
+		a = _mm_and_si128 (s, amask);
+		
+		/* Saltar los bloques transparentes y copiar los opacos */
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (a, zero)) == 0xFFFF) continue;
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (a, amask)) == 0xFFFF) {
+			_mm_storeu_si128 ((__m128i *) &dst[g], s);
+			continue;
+		}
+		
+		d = _mm_loadu_si128 ((const __m128i *) &dst[g]);
+		
+		alo = cpstamp_blend_alpha_sse2 (_mm_unpacklo_epi8 (s, zero));
+		ahi = cpstamp_blend_alpha_sse2 (_mm_unpackhi_epi8 (s, zero));
+		
+		/* El canal alpha se mezcla como si la fuente fuera opaca */
+		s = _mm_or_si128 (s, amask);
+		slo = _mm_unpacklo_epi8 (s, zero);
+		shi = _mm_unpackhi_epi8 (s, zero);
+		dlo = _mm_unpacklo_epi8 (d, zero);
+		dhi = _mm_unpackhi_epi8 (d, zero);
+		
+		lo = cpstamp_blend_epi16_sse2 (slo, dlo, alo);
+		hi = cpstamp_blend_epi16_sse2 (shi, dhi, ahi);
+		
+		_mm_storeu_si128 ((__m128i *) &dst[g], _mm_packus_epi16 (lo, hi));
+	}
+	
+	cpstamp_blend_row_8888_scalar (&src[g], &dst[g], n - g);
+}
+
+static void CPSTAMP_TARGET_SSE2 cpstamp_blend_row_565_sse2 (const Uint32 *src, Uint16 *dst, int n) {
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i m8 = _mm_set1_epi32 (0xFF);
+	__m128i m5 = _mm_set1_epi16 (0x1F);
+	__m128i m6 = _mm_set1_epi16 (0x3F);
+	__m128i s0, s1, sr, sg, sb, sa, d, dr, dg, db;
+	int g;
+	
+	for (g = 0; g + 8 <= n; g += 8) {
+		s0 = _mm_loadu_si128 ((const __m128i *) &src[g]);
+		s1 = _mm_loadu_si128 ((const __m128i *) &src[g + 4]);
+		
+		/* Separar los canales de la fuente, un pixel por cada entero de 16 bits */
+		sa = _mm_packs_epi32 (_mm_srli_epi32 (s0, 24), _mm_srli_epi32 (s1, 24));
+		
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (sa, zero)) == 0xFFFF) continue;
+		
+		sr = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (s0, 16), m8), _mm_and_si128 (_mm_srli_epi32 (s1, 16), m8));
+		sg = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (s0, 8), m8), _mm_and_si128 (_mm_srli_epi32 (s1, 8), m8));
+		sb = _mm_packs_epi32 (_mm_and_si128 (s0, m8), _mm_and_si128 (s1, m8));
+		
+		/* Expandir el destino a 8 bits por canal */
+		d = _mm_loadu_si128 ((const __m128i *) &dst[g]);
+		dr = _mm_and_si128 (_mm_srli_epi16 (d, 11), m5);
+		dg = _mm_and_si128 (_mm_srli_epi16 (d, 5), m6);
+		db = _mm_and_si128 (d, m5);
+		dr = _mm_or_si128 (_mm_slli_epi16 (dr, 3), _mm_srli_epi16 (dr, 2));
+		dg = _mm_or_si128 (_mm_slli_epi16 (dg, 2), _mm_srli_epi16 (dg, 4));
+		db = _mm_or_si128 (_mm_slli_epi16 (db, 3), _mm_srli_epi16 (db, 2));
+		
+		dr = cpstamp_blend_epi16_sse2 (sr, dr, sa);
+		dg = cpstamp_blend_epi16_sse2 (sg, dg, sa);
+		db = cpstamp_blend_epi16_sse2 (sb, db, sa);
+		
+		d = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi16 (_mm_srli_epi16 (dr, 3), 11), _mm_slli_epi16 (_mm_srli_epi16 (dg, 2), 5)), _mm_srli_epi16 (db, 3));
+		_mm_storeu_si128 ((__m128i *) &dst[g], d);
+	}
+	
+	cpstamp_blend_row_565_scalar (&src[g], &dst[g], n - g);
+}
+
+static void CPSTAMP_TARGET_AVX2 cpstamp_blend_row_8888_avx2 (const Uint32 *src, Uint32 *dst, int n) {
+	__m256i zero = _mm256_setzero_si256 ();
+	__m256i amask = _mm256_set1_epi32 ((int) 0xFF000000);
+	__m256i s, d, a, slo, shi, dlo, dhi, alo, ahi, lo, hi;
+	int g;
+	
+	for (g = 0; g + 8 <= n; g += 8) {
+		s = _mm256_loadu_si256 ((const __m256i *) &src[g]);
+		a = _mm256_and_si256 (s, amask);
+		
+		if (_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (a, zero)) == -1) continue;
+		if (_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (a, amask)) == -1) {
+			_mm256_storeu_si256 ((__m256i *) &dst[g], s);
+			continue;
+		}
+		
+		d = _mm256_loadu_si256 ((const __m256i *) &dst[g]);
+		
+		/* Los unpack y pack trabajan dentro de cada mitad, el orden se conserva */
+		alo = cpstamp_blend_alpha_avx2 (_mm256_unpacklo_epi8 (s, zero));
+		ahi = cpstamp_blend_alpha_avx2 (_mm256_unpackhi_epi8 (s, zero));
+		
+		s = _mm256_or_si256 (s, amask);
+		slo = _mm256_unpacklo_epi8 (s, zero);
+		shi = _mm256_unpackhi_epi8 (s, zero);
+		dlo = _mm256_unpacklo_epi8 (d, zero);
+		dhi = _mm256_unpackhi_epi8 (d, zero);
+		
+		lo = cpstamp_blend_epi16_avx2 (slo, dlo, alo);
+		hi = cpstamp_blend_epi16_avx2 (shi, dhi, ahi);
+		
+		_mm256_storeu_si256 ((__m256i *) &dst[g], _mm256_packus_epi16 (lo, hi));
+	}
+	
+	cpstamp_blend_row_8888_sse2 (&src[g], &dst[g], n - g);
+}
+
+static void CPSTAMP_TARGET_AVX2 cpstamp_blend_row_565_avx2 (const Uint32 *src, Uint16 *dst, int n) {
+	__m256i zero = _mm256_setzero_si256 ();
+	__m256i m8 = _mm256_set1_epi32 (0xFF);
+	__m256i m5 = _mm256_set1_epi16 (0x1F);
+	__m256i m6 = _mm256_set1_epi16 (0x3F);
+	__m256i s0, s1, sr, sg, sb, sa, d, dr, dg, db;
+	int g;
+	
+	/* El pack intercala las mitades de s0 y s1, el permute las pone en orden */
+#define PACK_AVX2(x, y) _mm256_permute4x64_epi64 (_mm256_packs_epi32 ((x), (y)), 0xD8)
+
+	for (g = 0; g + 16 <= n; g += 16) {
+		s0 = _mm256_loadu_si256 ((const __m256i *) &src[g]);
+		s1 = _mm256_loadu_si256 ((const __m256i *) &src[g + 8]);
+		
+		sa = PACK_AVX2 (_mm256_srli_epi32 (s0, 24), _mm256_srli_epi32 (s1, 24));
+		
+		if (_mm256_movemask_epi8 (_mm256_cmpeq_epi16 (sa, zero)) == -1) continue;
+		
+		sr = PACK_AVX2 (_mm256_and_si256 (_mm256_srli_epi32 (s0, 16), m8), _mm256_and_si256 (_mm256_srli_epi32 (s1, 16), m8));
+		sg = PACK_AVX2 (_mm256_and_si256 (_mm256_srli_epi32 (s0, 8), m8), _mm256_and_si256 (_mm256_srli_epi32 (s1, 8), m8));
+		sb = PACK_AVX2 (_mm256_and_si256 (s0, m8), _mm256_and_si256 (s1, m8));
+		
+		d = _mm256_loadu_si256 ((const __m256i *) &dst[g]);
+		dr = _mm256_and_si256 (_mm256_srli_epi16 (d, 11), m5);
+		dg = _mm256_and_si256 (_mm256_srli_epi16 (d, 5), m6);
+		db = _mm256_and_si256 (d, m5);
+		dr = _mm256_or_si256 (_mm256_slli_epi16 (dr, 3), _mm256_srli_epi16 (dr, 2));
+		dg = _mm256_or_si256 (_mm256_slli_epi16 (dg, 2), _mm256_srli_epi16 (dg, 4));
+		db = _mm256_or_si256 (_mm256_slli_epi16 (db, 3), _mm256_srli_epi16 (db, 2));
+		
+		dr = cpstamp_blend_epi16_avx2 (sr, dr, sa);
+		dg = cpstamp_blend_epi16_avx2 (sg, dg, sa);
+		db = cpstamp_blend_epi16_avx2 (sb, db, sa);
+		
+		d = _mm256_or_si256 (_mm256_or_si256 (_mm256_slli_epi16 (_mm256_srli_epi16 (dr, 3), 11), _mm256_slli_epi16 (_mm256_srli_epi16 (dg, 2), 5)), _mm256_srli_epi16 (db, 3));
+		_mm256_storeu_si256 ((__m256i *) &dst[g], d);
+	}
+#undef PACK_AVX2
+
+	cpstamp_blend_row_565_sse2 (&src[g], &dst[g], n - g);
+}
+#endif /* CPSTAMP_BLEND_X86 */
+
+int cpstamp_blend_available (int kernel) {
+	switch (kernel) {
+		case CPSTAMP_BLEND_SCALAR:
+			return TRUE;
+#ifdef CPSTAMP_BLEND_X86
+		case CPSTAMP_BLEND_SSE2:
+			__builtin_cpu_init ();
+			return __builtin_cpu_supports ("sse2");
+		case CPSTAMP_BLEND_AVX2:
+			__builtin_cpu_init ();
+			return __builtin_cpu_supports ("avx2");
+#endif
+	}
+	
+	return FALSE;
+}
+
+/* Elige la implementación, regresa FALSE si el procesador no la soporta */
+int cpstamp_blend_select (int kernel) {
+	if (!cpstamp_blend_available (kernel)) return FALSE;
+	
+	switch (kernel) {
+#ifdef CPSTAMP_BLEND_X86
+		case CPSTAMP_BLEND_AVX2:
+			cpstamp_blend_row_8888 = cpstamp_blend_row_8888_avx2;
+			cpstamp_blend_row_565 = cpstamp_blend_row_565_avx2;
+			break;
+		case CPSTAMP_BLEND_SSE2:
+			cpstamp_blend_row_8888 = cpstamp_blend_row_8888_sse2;
+			cpstamp_blend_row_565 = cpstamp_blend_row_565_sse2;
+			break;
+#endif
+		default:
+			cpstamp_blend_row_8888 = cpstamp_blend_row_8888_scalar;
+			cpstamp_blend_row_565 = cpstamp_blend_row_565_scalar;
+	}
+	
+	return TRUE;
+}
+
+const char *cpstamp_blend_name (int kernel) {
+	if (kernel < 0 || kernel >= NUM_CPSTAMP_BLEND) return NULL;
+	
+	return cpstamp_blend_names[kernel];
+}
+
+static void cpstamp_blend_init (void) {
+	int g;
+	
+	/* La mejor implementación que soporte el procesador */
+	for (g = NUM_CPSTAMP_BLEND - 1; g >= 0; g--) {
+		if (cpstamp_blend_select (g)) break;
+	}
+}
+
+static int cpstamp_blend_is_argb (SDL_PixelFormat *f) {
+	return f->BytesPerPixel == 4 && f->Rmask == 0x00FF0000 && f->Gmask == 0x0000FF00 && f->Bmask == 0x000000FF && f->Amask == 0xFF000000;
+}
+
+/* TRUE si los kernels pueden mezclar "src", si no lo copia SDL */
+int cpstamp_blend_supported (SDL_Surface *src) {
+	if (!cpstamp_blend_is_argb (src->format) || !cpstamp_surface_blends (src)) return FALSE;
+	if (cpstamp_surface_has_colorkey (src) || (src->flags & SDL_RLEACCEL)) return FALSE;
+	
+	return TRUE;
+}
+
+/* Igual que SDL_BlitSurface, pero sólo para fuentes ARGB8888 con alpha por pixel
+ * sobre destinos XRGB8888 o RGB565. Con otros formatos regresa CPSTAMP_BLEND_UNSUPPORTED */
+int cpstamp_blend (SDL_Surface *src, SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect) {
+	SDL_PixelFormat *f = dst->format;
+	SDL_Rect full, *clip;
+	int sx, sy, w, h, d, g, is_565;
+	Uint8 *s_row, *d_row;
+	
+	if (!cpstamp_blend_supported (src)) return CPSTAMP_BLEND_UNSUPPORTED;
+	
+	if (f->Amask != 0) return CPSTAMP_BLEND_UNSUPPORTED;
+	if (f->BytesPerPixel == 4 && f->Rmask == 0x00FF0000 && f->Gmask == 0x0000FF00 && f->Bmask == 0x000000FF) {
+		is_565 = FALSE;
+	} else if (f->BytesPerPixel == 2 && f->Rmask == 0xF800 && f->Gmask == 0x07E0 && f->Bmask == 0x001F) {
+		is_565 = TRUE;
+	} else {
+		return CPSTAMP_BLEND_UNSUPPORTED;
+	}
+	
+	if (cpstamp_blend_row_8888 == NULL) cpstamp_blend_init ();
+	
+	if (dstrect == NULL) {
+		full.x = full.y = 0;
+		dstrect = &full;
+	}
+	
+	/* Recortar contra la fuente y contra el clip del destino, igual que SDL */
+	if (srcrect != NULL) {
+		sx = srcrect->x;
+		w = srcrect->w;
+		if (sx < 0) {
+			w += sx;
+			dstrect->x -= sx;
+			sx = 0;
+		}
+		if (src->w - sx < w) w = src->w - sx;
+		
+		sy = srcrect->y;
+		h = srcrect->h;
+		if (sy < 0) {
+			h += sy;
+			dstrect->y -= sy;
+			sy = 0;
+		}
+		if (src->h - sy < h) h = src->h - sy;
+	} else {
+		sx = sy = 0;
+		w = src->w;
+		h = src->h;
+	}
+	
+	clip = &dst->clip_rect;
+	d = clip->x - dstrect->x;
+	if (d > 0) {
+		w -= d;
+		dstrect->x += d;
+		sx += d;
+	}
+	d = dstrect->x + w - clip->x - clip->w;
+	if (d > 0) w -= d;
+	
+	d = clip->y - dstrect->y;
+	if (d > 0) {
+		h -= d;
+		dstrect->y += d;
+		sy += d;
+	}
+	d = dstrect->y + h - clip->y - clip->h;
+	if (d > 0) h -= d;
+	
+	if (w <= 0 || h <= 0) {
+		dstrect->w = dstrect->h = 0;
+		return 0;
+	}
+	
+	dstrect->w = w;
+	dstrect->h = h;
+	
+	if (SDL_MUSTLOCK (dst) && SDL_LockSurface (dst) < 0) return -1;
+	
+	s_row = (Uint8 *) src->pixels + sy * src->pitch + sx * 4;
+	d_row = (Uint8 *) dst->pixels + dstrect->y * dst->pitch + dstrect->x * f->BytesPerPixel;
+	
+	for (g = 0; g < h; g++) {
+		if (is_565) {
+			cpstamp_blend_row_565 ((const Uint32 *) s_row, (Uint16 *) d_row, w);
+		} else {
+			cpstamp_blend_row_8888 ((const Uint32 *) s_row, (Uint32 *) d_row, w);
+		}
+		
+		s_row += src->pitch;
+		d_row += dst->pitch;
+	}
+	
+	if (SDL_MUSTLOCK (dst)) SDL_UnlockSurface (dst);
+	
+	return 0;
+}
+
+/* Convierte una imagen a ARGB8888, para que la puedan mezclar los kernels.
+ * Las imágenes sin alpha quedan opacas, y las que tienen color clave (como los
+ * PNG con paleta y tRNS) quedan transparentes en ese color. La superficie
+ * original se libera si se hizo la conversión */
+SDL_Surface *cpstamp_blend_convert (SDL_Surface *surface) {
+	SDL_Surface *format, *converted;
+	
+	if (surface == NULL) return NULL;
+	if (cpstamp_blend_is_argb (surface->format) && !cpstamp_surface_has_colorkey (surface)) return surface;
+	
+	format = SDL_CreateRGBSurface (SDL_SWSURFACE, 1, 1, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	
+	if (format == NULL) return surface;
+
+#ifdef CPSTAMP_SDL2
+	converted = SDL_ConvertSurface (surface, format->format, 0);
+#else
+	converted = SDL_ConvertSurface (surface, format->format, SDL_SWSURFACE | SDL_SRCALPHA);
+#endif
+	SDL_FreeSurface (format);
+	
+	if (converted == NULL) return surface;
+	
+	/* El color clave ya es alpha 0, SDL 2 lo deja puesto en la copia */
+	cpstamp_surface_disable_colorkey (converted);
+	
+	SDL_FreeSurface (surface);
+	
+	return converted;
+}
+
+/* Pone opaco el byte alto de "rect" en un destino de 32 bits. Lo que SDL
+ * copia sobre la capa de CPStamp_DrawBuffer deja ahí un 0 */
+void cpstamp_blend_set_opaque (SDL_Surface *dst, SDL_Rect *rect) {
+	SDL_Rect *clip = &dst->clip_rect;
+	Uint32 *row;
+	int x, y, x1, y1, x2, y2;
+	
+	if (dst->format->BytesPerPixel != 4) return;
+	
+	x1 = (rect->x > clip->x) ? rect->x : clip->x;
+	y1 = (rect->y > clip->y) ? rect->y : clip->y;
+	x2 = (rect->x + rect->w < clip->x + clip->w) ? rect->x + rect->w : clip->x + clip->w;
+	y2 = (rect->y + rect->h < clip->y + clip->h) ? rect->y + rect->h : clip->y + clip->h;
+	
+	if (x2 <= x1 || y2 <= y1) return;
+	
+	if (SDL_MUSTLOCK (dst) && SDL_LockSurface (dst) < 0) return;
+	
+	for (y = y1; y < y2; y++) {
+		row = (Uint32 *) ((Uint8 *) dst->pixels + y * dst->pitch);
+		for (x = x1; x < x2; x++) row[x] |= 0xFF000000;
+	}
+	
+	if (SDL_MUSTLOCK (dst)) SDL_UnlockSurface (dst);
+}
+
+/* Pesos del filtro triangular para un eje, de "src" pixeles a "dst". Al
+ * reducir el triángulo se ensancha para cubrir toda el área de origen.
+ * Regresa "taps" pesos por pixel de destino, empezando en "first" */
+static float *cpstamp_scale_weights (int src, int dst, int *first, int *taps) {
+	float *pesos, radio, centro, d, suma;
+	int g, k, j, n;
+	
+	radio = (src > dst) ? (float) src / dst : 1.0f;
+	n = 2 * ((int) radio + 1);
+	
+	pesos = (float *) malloc (sizeof (float) * dst * n);
+	if (pesos == NULL) return NULL;
+	
+	for (g = 0; g < dst; g++) {
+		centro = (g + 0.5f) * src / dst - 0.5f;
+		
+		/* floor sin libm, sumando "src" el valor siempre es positivo */
+		first[g] = (int) (centro - radio + src) - src + 1;
+		suma = 0;
+		
+		for (k = 0; k < n; k++) {
+			j = first[g] + k;
+			d = (j > centro) ? j - centro : centro - j;
+			
+			/* Las orillas sólo promedian lo que está dentro de la imagen */
+			if (j < 0 || j >= src || d >= radio) {
+				pesos[g * n + k] = 0;
+			} else {
+				pesos[g * n + k] = 1.0f - d / radio;
+			}
+			suma += pesos[g * n + k];
+		}
+		
+		for (k = 0; k < n && suma > 0; k++) {
+			pesos[g * n + k] /= suma;
+		}
+	}
+	
+	*taps = n;
+	return pesos;
+}
+
+/* Copia de una superficie ARGB8888 escalada a "w" x "h". Se filtra sobre el
+ * alpha premultiplicado para que las orillas transparentes no oscurezcan.
+ * Es lento, pensado para escalar una sola vez. Regresa NULL con otros formatos */
+SDL_Surface *cpstamp_blend_scale (SDL_Surface *src, int w, int h) {
+	SDL_Surface *dst;
+	float *pesos_x, *pesos_y, *temp, *t, *p, acc[4], peso, a;
+	int *first_x, *first_y;
+	int taps_x, taps_y, x, y, k, j, c;
+	Uint32 pixel, *d_row;
+	const Uint32 *s_row;
+	
+	if (src == NULL || w <= 0 || h <= 0) return NULL;
+	if (!cpstamp_blend_is_argb (src->format) || cpstamp_surface_has_colorkey (src)) return NULL;
+	
+	dst = SDL_CreateRGBSurface (SDL_SWSURFACE, w, h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	first_x = (int *) malloc (sizeof (int) * w);
+	first_y = (int *) malloc (sizeof (int) * h);
+	temp = (float *) malloc (sizeof (float) * 4 * w * src->h);
+	pesos_x = pesos_y = NULL;
+	
+	if (first_x != NULL && first_y != NULL) {
+		pesos_x = cpstamp_scale_weights (src->w, w, first_x, &taps_x);
+		pesos_y = cpstamp_scale_weights (src->h, h, first_y, &taps_y);
+	}
+	
+	if (dst == NULL || temp == NULL || pesos_x == NULL || pesos_y == NULL) {
+		if (dst != NULL) SDL_FreeSurface (dst);
+		free (first_x);
+		free (first_y);
+		free (temp);
+		free (pesos_x);
+		free (pesos_y);
+		return NULL;
+	}
+	
+	if (SDL_MUSTLOCK (src)) SDL_LockSurface (src);
+	
+	/* Primero a lo ancho, a un buffer premultiplicado */
+	for (y = 0; y < src->h; y++) {
+		s_row = (const Uint32 *) ((const Uint8 *) src->pixels + y * src->pitch);
+		t = temp + 4 * w * y;
+		
+		for (x = 0; x < w; x++) {
+			acc[0] = acc[1] = acc[2] = acc[3] = 0;
+			
+			for (k = 0; k < taps_x; k++) {
+				peso = pesos_x[x * taps_x + k];
+				if (peso == 0) continue;
+				
+				pixel = s_row[first_x[x] + k];
+				a = peso * (pixel >> 24);
+				acc[0] += a;
+				acc[1] += a * ((pixel >> 16) & 0xFF);
+				acc[2] += a * ((pixel >> 8) & 0xFF);
+				acc[3] += a * (pixel & 0xFF);
+			}
+			
+			for (c = 0; c < 4; c++) t[4 * x + c] = acc[c];
+		}
+	}
+	
+	if (SDL_MUSTLOCK (src)) SDL_UnlockSurface (src);
+	
+	/* Luego a lo alto, regresando a alpha normal */
+	for (y = 0; y < h; y++) {
+		d_row = (Uint32 *) ((Uint8 *) dst->pixels + y * dst->pitch);
+		
+		for (x = 0; x < w; x++) {
+			acc[0] = acc[1] = acc[2] = acc[3] = 0;
+			
+			for (k = 0; k < taps_y; k++) {
+				peso = pesos_y[y * taps_y + k];
+				if (peso == 0) continue;
+				
+				j = first_y[y] + k;
+				p = temp + 4 * (w * j + x);
+				for (c = 0; c < 4; c++) acc[c] += peso * p[c];
+			}
+			
+			if (acc[0] < 0.5f) {
+				d_row[x] = 0;
+				continue;
+			}
+			
+			pixel = (Uint32) (acc[0] + 0.5f);
+			if (pixel > 255) pixel = 255;
+			pixel <<= 24;
+			
+			for (c = 1; c < 4; c++) {
+				a = acc[c] / acc[0] + 0.5f;
+				if (a > 255) a = 255;
+				if (a < 0) a = 0;
+				pixel |= ((Uint32) a) << (8 * (3 - c));
+			}
+			
+			d_row[x] = pixel;
+		}
+	}
+	
+	free (first_x);
+	free (first_y);
+	free (temp);
+	free (pesos_x);
+	free (pesos_y);
+	
+	return dst;
+}
+
@@ -0,0 +1,49 @@
+/*
+ * blend.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_BLEND_H__
+#define __CPSTAMP_BLEND_H__
+
+#include <SDL.h>
+
+/* Implementaciones de la mezcla alpha */
+enum {
+	CPSTAMP_BLEND_SCALAR = 0,
+	CPSTAMP_BLEND_SSE2,
+	CPSTAMP_BLEND_AVX2,
+	
+	NUM_CPSTAMP_BLEND
+};
+
+/* Regresado por cpstamp_blend cuando los formatos no están soportados */
+#define CPSTAMP_BLEND_UNSUPPORTED -2
+
+int cpstamp_blend_available (int kernel);
+int cpstamp_blend_select (int kernel);
+const char *cpstamp_blend_name (int kernel);
+
+int cpstamp_blend_supported (SDL_Surface *src);
+int cpstamp_blend (SDL_Surface *src, SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect);
+SDL_Surface *cpstamp_blend_convert (SDL_Surface *surface);
+void cpstamp_blend_set_opaque (SDL_Surface *dst, SDL_Rect *rect);
+SDL_Surface *cpstamp_blend_scale (SDL_Surface *src, int w, int h);
+
+#endif /* __CPSTAMP_BLEND_H__ */
+
@@ -0,0 +1,63 @@
+/*
+ * catalog.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Catálogos de estampas fijos, generados por cpstamp-catalog.
+ *
+ * El hash es de dos niveles: el id elige una cubeta, y la cubeta guarda
+ * cómo llegar a su lugar. Un valor negativo es el lugar mismo (-lugar - 1),
+ * uno positivo es el desplazamiento con el que se vuelve a mezclar el id.
+ * El generador busca los desplazamientos para que no haya choques, así
+ * que buscar es mezclar dos veces y comparar un id */
+
+#include <stdlib.h>
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "catalog.h"
+
+/* Revisa un catálogo que viene de fuera de la librería */
+int cpstamp_catalog_valid (const CPStampCatalog *catalog) {
+	if (catalog == NULL || catalog->version != CPSTAMP_CATALOG_VERSION || catalog->count < 0) return FALSE;
+	
+	if (catalog->count == 0) return TRUE;
+	
+	return catalog->entries != NULL && catalog->hash != NULL && catalog->hash_size > 0;
+}
+
+/* El lugar del id en el catálogo, o -1 si no está */
+int cpstamp_catalog_find (const CPStampCatalog *catalog, int id) {
+	Sint32 d;
+	Uint32 lugar;
+	
+	if (catalog->count == 0) return -1;
+	
+	d = catalog->hash[cpstamp_catalog_hash (id, 0) % (Uint32) catalog->hash_size];
+	if (d < 0) {
+		lugar = (Uint32) (-(d + 1));
+	} else {
+		lugar = cpstamp_catalog_hash (id, d) % (Uint32) catalog->count;
+	}
+	
+	if (lugar >= (Uint32) catalog->count || catalog->entries[lugar].id != id) return -1;
+	
+	return lugar;
+}
+
@@ -0,0 +1,47 @@
+/*
+ * catalog.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_CATALOG_H__
+#define __CPSTAMP_CATALOG_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+
+/* Mezcla del id para el hash perfecto. Con d = 0 elige la cubeta, con el
+ * desplazamiento de la cubeta elige el lugar. cpstamp-catalog usa la misma */
+static inline Uint32 cpstamp_catalog_hash (int id, Uint32 d) {
+	Uint32 h;
+	
+	h = (Uint32) id ^ (d * 0x9E3779B9U);
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	
+	return h;
+}
+
+int cpstamp_catalog_valid (const CPStampCatalog *catalog);
+int cpstamp_catalog_find (const CPStampCatalog *catalog, int id);
+
+#endif /* __CPSTAMP_CATALOG_H__ */
+
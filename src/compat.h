@@ -0,0 +1,83 @@
+/*
+ * compat.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Diferencias entre SDL 1.2 y SDL 2 en el manejo de superficies */
+
+#ifndef __CPSTAMP_COMPAT_H__
+#define __CPSTAMP_COMPAT_H__
+
+#include <SDL.h>
+
+#if SDL_VERSION_ATLEAST (2, 0, 0)
+#define CPSTAMP_SDL2 1
+#endif
+
+/* ¿La superficie se mezcla usando su canal alpha? */
+static inline int cpstamp_surface_blends (SDL_Surface *surface) {
+#ifdef CPSTAMP_SDL2
+	SDL_BlendMode mode;
+	
+	if (SDL_GetSurfaceBlendMode (surface, &mode) < 0) return 0;
+	
+	return mode == SDL_BLENDMODE_BLEND;
+#else
+	return (surface->flags & SDL_SRCALPHA) != 0;
+#endif
+}
+
+static inline int cpstamp_surface_has_colorkey (SDL_Surface *surface) {
+#ifdef CPSTAMP_SDL2
+	Uint32 key;
+	
+	return SDL_GetColorKey (surface, &key) == 0;
+#else
+	return (surface->flags & SDL_SRCCOLORKEY) != 0;
+#endif
+}
+
+/* Quitar el color transparente de la superficie */
+static inline void cpstamp_surface_disable_colorkey (SDL_Surface *surface) {
+#ifdef CPSTAMP_SDL2
+	SDL_SetColorKey (surface, SDL_FALSE, 0);
+#else
+	SDL_SetColorKey (surface, 0, 0);
+#endif
+}
+
+/* Copiar la superficie tal cual, incluyendo su canal alpha */
+static inline void cpstamp_surface_disable_blend (SDL_Surface *surface) {
+#ifdef CPSTAMP_SDL2
+	SDL_SetSurfaceBlendMode (surface, SDL_BLENDMODE_NONE);
+#else
+	SDL_SetAlpha (surface, 0, 255);
+#endif
+}
+
+/* SDL 2 le pone nombre a los hilos */
+static inline SDL_Thread *cpstamp_create_thread (int (*fn) (void *), const char *name, void *data) {
+#ifdef CPSTAMP_SDL2
+	return SDL_CreateThread (fn, name, data);
+#else
+	return SDL_CreateThread (fn, data);
+#endif
+}
+
+#endif /* __CPSTAMP_COMPAT_H__ */
+
@@ -30,165 +30,427 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <dirent.h>
 
 #include <SDL.h>
-#include <SDL_image.h>
-#include <SDL_mixer.h>
-#include <SDL_ttf.h>
 
 #ifdef __MINGW32__
 #include <windows.h>
 #include <shellapi.h>
+#include <io.h>
 #endif
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#ifdef HAVE_SDL_IMAGE
+#include <SDL_image.h>
+#endif
+#ifdef HAVE_SDL_MIXER
+#include <SDL_mixer.h>
+#endif
+#ifdef HAVE_SDL_TTF
+#include <SDL_ttf.h>
+#endif
+
 #include <locale.h>
 #include "gettext.h"
 #define _(string) dgettext (PACKAGE, string)
 
 #include "cpstamp.h"
+#include "cpstamp_private.h"
 #include "path.h"
+#include "stats.h"
+#include "blend.h"
+#include "index.h"
+#include "storage.h"
+#include "db.h"
+#include "live.h"
+#include "watch.h"
+#include "catalog.h"
 
-#ifndef FALSE
-#define FALSE 0
+#ifdef HAVE_SDL_IMAGE
+/* Nombres de los archivos */
+static const char * cpstamp_images_names [NUM_IMGS] = {
+	"images/panel_stamp.png",
+	
+	"images/game_easy.png",
+	"images/game_normal.png",
+	"images/game_hard.png",
+	"images/game_extreme.png"
+};
+#else
+/* Color de las estampas genéricas, por dificultad */
+static const Uint8 cpstamp_builtin_colors [NUM_IMGS - IMG_STAMP_GAME_EASY][3] = {
+	{22, 127, 59},
+	{255, 169, 10},
+	{29, 29, 133},
+	{169, 0, 33}
+};
 #endif
 
-#ifndef TRUE
-#define TRUE !FALSE
-#endif
+/* Globales de la librería */
+static CPStampHandle *cpstamp_handle = NULL;
+
+/* Funciones locales auxiliares */
+static int cpstamp_file_exists (const char *fname) {
+	struct stat s;
+	return (stat(fname, &s) == 0 && S_ISREG(s.st_mode));
+}
 
-/* Lista de imágenes para cargar */
-enum {
-	IMG_STAMP_PANEL,
+/* Conseguir la ruta completa de la imagen de la estampa, liberar con free */
+static char *cpstamp_stamp_image_path (CPStamp *s) {
+	const char *imagen;
 	
-	IMG_STAMP_GAME_EASY,
-	IMG_STAMP_GAME_NORMAL,
-	IMG_STAMP_GAME_HARD,
-	IMG_STAMP_GAME_EXTREME,
+	imagen = cpstamp_table_image (&s->cat->estampas, s->pos);
+	if (imagen == NULL || imagen[0] == 0) return NULL;
 	
-	NUM_IMGS
-};
+	return cpstamp_resolve_path (s->cat->resource_dir, imagen);
+}
+
+/* La imagen genérica de la estampa, según su tipo y dificultad */
+static int cpstamp_stamp_image (CPStamp *s) {
+	CPStampTable *t = &s->cat->estampas;
+	
+	if (t->categorias[s->pos] == STAMP_TYPE_GAME && t->dificultades[s->pos] <= STAMP_EXTREME) {
+		return IMG_STAMP_GAME_EASY + t->dificultades[s->pos];
+	}
+	
+	return IMG_STAMP_GAME_EASY;
+}
 
-typedef struct _CPStamp {
-	int id;
-	char *titulo;
-	char *descripcion;
-	char *imagen;
+/* Conseguir el título traducido, se consulta el catálogo sólo si cambió el idioma */
+static const char *cpstamp_l10n_title (CPStamp *s) {
+	CPStampCategory *cat = s->cat;
+	CPStampTable *t = &cat->estampas;
+	const char **l10n;
+	const char *titulo, *descripcion;
 	
-	int categoria;
-	int dificultad;
+	titulo = cpstamp_table_keep_title (t, s->pos);
+	if (cat->l10n_domain == NULL || titulo == NULL) return titulo;
 	
-	int ganada;
+	l10n = cpstamp_table_l10n (t, cat->l10n_serial);
 	
-	CPStampCategory *category_struct;
+	/* Sin memoria para guardar las traducciones, consultar cada vez */
+	if (l10n == NULL) return dgettext (cat->l10n_domain, titulo);
 	
-	struct _CPStamp *sig;
-} CPStamp;
+	if (l10n[s->pos * 2] == NULL) {
+		descripcion = cpstamp_table_keep_description (t, s->pos);
+		
+		l10n[s->pos * 2] = dgettext (cat->l10n_domain, titulo);
+		l10n[s->pos * 2 + 1] = (descripcion != NULL) ? dgettext (cat->l10n_domain, descripcion) : NULL;
+	}
+	
+	return l10n[s->pos * 2];
+}
 
-struct _CPStampCategory {
-	char *nombre;
-	int categoria;
+static const char *cpstamp_l10n_description (CPStamp *s) {
+	CPStampCategory *cat = s->cat;
+	CPStampTable *t = &cat->estampas;
+	const char *descripcion;
 	
-	CPStamp *lista;
-	int read_version;
+	if (cat->l10n_domain == NULL) return cpstamp_table_keep_description (t, s->pos);
 	
-	char *l10n_domain;
-	char *l10n_dir;
+	/* Ambas traducciones se llenan juntas */
+	cpstamp_l10n_title (s);
 	
-	char *resource_dir;
+	if (t->l10n == NULL) {
+		descripcion = cpstamp_table_keep_description (t, s->pos);
+		return (descripcion != NULL) ? dgettext (cat->l10n_domain, descripcion) : NULL;
+	}
 	
-	int fd;
-};
+	return t->l10n[s->pos * 2 + 1];
+}
 
-struct _CPStampHandle {
-	/* Paquete de imágenes */
-	SDL_Surface *stamp_images [NUM_IMGS];
-	SDL_Surface *save_screen;
-	SDL_Surface *earned_text[2];
+#ifdef CPSTAMP_SDL2
+static SDL_Texture *cpstamp_texture (CPStampHandle *handle, SDL_Surface *surface) {
+	SDL_Texture *texture;
 	
-	/* Para renderizar los nombres de las estampas */
-	TTF_Font *font;
+	if (surface == NULL) return NULL;
 	
-	/* Sonido */
-	int use_sound;
-	Mix_Chunk *stamp_sound_earn;
+	texture = SDL_CreateTextureFromSurface (handle->renderer, surface);
 	
-	/* Lista privada de estampas que se deben dibujar */
-	CPStamp *stamp_queue[10];
-	int stamp_queue_start, stamp_queue_end;
-	int stamp_timer;
+	if (texture != NULL) SDL_SetTextureBlendMode (texture, SDL_BLENDMODE_BLEND);
+	
+	return texture;
+}
+
+static void cpstamp_destroy_texture (SDL_Texture **texture) {
+	if (*texture != NULL) {
+		SDL_DestroyTexture (*texture);
+		*texture = NULL;
+	}
+}
+#endif
+
+#ifndef HAVE_SDL_IMAGE
+/* Rellena un óvalo que ocupa toda la superficie menos "margen", renglón por renglón */
+static void cpstamp_builtin_oval (SDL_Surface *surface, int margen, Uint32 color) {
+	SDL_Rect rect;
+	int a, b, y, dy, x;
 	
-	/* La carpeta del usuario */
-	char *userdata_path;
+	/* Se trabaja con coordenadas al doble para no perder los medios pixeles */
+	a = surface->w - 2 * margen;
+	b = surface->h - 2 * margen;
 	
-	/* Para las aplicaciones */
-	SDL_Rect update_rect;
-	int activate;
-};
+	for (y = margen; y < surface->h - margen; y++) {
+		dy = 2 * y + 1 - surface->h;
+		
+		for (x = a; x > 0 && x * x * b * b + dy * dy * a * a > a * a * b * b; x--);
+		
+		rect.x = (surface->w - x) / 2;
+		rect.y = y;
+		rect.w = x; rect.h = 1;
+		SDL_FillRect (surface, &rect, color);
+	}
+}
 
-/* Nombres de los archivos */
-static const char * cpstamp_images_names [NUM_IMGS] = {
-	"images/panel_stamp.png",
+/* Sin SDL_image el panel y las estampas genéricas se dibujan aquí mismo,
+ * del tamaño de las imágenes originales */
+static SDL_Surface *cpstamp_builtin_image (int image) {
+	SDL_Surface *surface;
+	SDL_Rect rect;
+	const Uint8 *color;
 	
-	"images/game_easy.png",
-	"images/game_normal.png",
-	"images/game_hard.png",
-	"images/game_extreme.png"
-};
+	if (image == IMG_STAMP_PANEL) {
+		surface = SDL_CreateRGBSurface (SDL_SWSURFACE, 300, 80, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+		if (surface == NULL) return NULL;
+		
+		/* Gris semitransparente con un borde más oscuro */
+		SDL_FillRect (surface, NULL, SDL_MapRGBA (surface->format, 51, 51, 51, 165));
+		rect.x = rect.y = 1;
+		rect.w = surface->w - 2; rect.h = surface->h - 2;
+		SDL_FillRect (surface, &rect, SDL_MapRGBA (surface->format, 102, 102, 102, 165));
+		
+		return cpstamp_blend_convert (surface);
+	}
+	
+	surface = SDL_CreateRGBSurface (SDL_SWSURFACE, 70, 65, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	if (surface == NULL) return NULL;
+	
+	/* Un óvalo del color de la dificultad con borde blanco */
+	color = cpstamp_builtin_colors[image - IMG_STAMP_GAME_EASY];
+	SDL_FillRect (surface, NULL, SDL_MapRGBA (surface->format, 0, 0, 0, 0));
+	cpstamp_builtin_oval (surface, 0, SDL_MapRGBA (surface->format, 255, 255, 255, 255));
+	cpstamp_builtin_oval (surface, 3, SDL_MapRGBA (surface->format, color[0], color[1], color[2], 255));
+	
+	return cpstamp_blend_convert (surface);
+}
+#endif
 
-/* Globales de la librería */
-static CPStampHandle *cpstamp_handle = NULL;
+#ifdef HAVE_SDL_TTF
+static void cpstamp_render_earned_text (CPStampHandle *handle) {
+	SDL_Color blanco, negro;
 
-/* Funciones locales auxiliares */
-static int cpstamp_folder_exists (const char *fname) {
-	struct stat s;
-	return (stat(fname, &s) == 0 && S_ISDIR(s.st_mode));
+#ifdef CPSTAMP_SDL2
+	/* Las texturas se vuelven a subir con el nuevo texto */
+	cpstamp_destroy_texture (&handle->tex_earned[0]);
+	cpstamp_destroy_texture (&handle->tex_earned[1]);
+#endif
+
+	if (handle->earned_text[0] != NULL) {
+		SDL_FreeSurface (handle->earned_text[0]);
+		SDL_FreeSurface (handle->earned_text[1]);
+	}
+	
+	handle->earned_text[0] = handle->earned_text[1] = NULL;
+	
+	if (handle->font == NULL) return;
+	
+	blanco.r = blanco.g = blanco.b = 255;
+	negro.r = negro.g = negro.b = 0;
+	
+	handle->earned_text[0] = TTF_RenderUTF8_Blended (handle->font, _("Stamp Earned!"), negro);
+	handle->earned_text[1] = TTF_RenderUTF8_Blended (handle->font, _("Stamp Earned!"), blanco);
+	
+	if (handle->earned_text[0] == NULL || handle->earned_text[1] == NULL) {
+		/* Sin los dos textos no se puede dibujar */
+		if (handle->earned_text[0] != NULL) SDL_FreeSurface (handle->earned_text[0]);
+		if (handle->earned_text[1] != NULL) SDL_FreeSurface (handle->earned_text[1]);
+		handle->earned_text[0] = handle->earned_text[1] = NULL;
+	}
 }
+#endif
 
-static int cpstamp_file_exists (const char *fname) {
-	struct stat s;
-	return (stat(fname, &s) == 0 && S_ISREG(s.st_mode));
+static void cpstamp_emit (CPStampHandle *handle, int type, CPStampCategory *cat, const char *clave, int id, int error) {
+	CPStampEvent event;
+	
+	if (handle == NULL || handle->callbacks[type] == NULL) return;
+	
+	event.type = type;
+	event.cat = cat;
+	event.clave = clave;
+	event.id = id;
+	event.error = error;
+	
+	handle->callbacks[type] (handle, &event, handle->callbacks_data[type]);
+}
+
+/* Medidas del diseño original, pasadas a la escala actual */
+static int cpstamp_scaled (CPStampHandle *handle, int v) {
+	return (v * handle->scale + 50) / 100;
+}
+
+/* Libera las imágenes, la tipografía y el sonido. Sólo se llama sin notificaciones en la cola */
+static void cpstamp_assets_unload (CPStampHandle *handle) {
+	int g;
+	
+	if (!handle->assets_loaded) return;
+	
+	for (g = 0; g < NUM_IMGS; g++) {
+		SDL_FreeSurface (handle->stamp_images[g]);
+		handle->stamp_images[g] = NULL;
+#ifdef CPSTAMP_SDL2
+		cpstamp_destroy_texture (&handle->tex_images[g]);
+#endif
+	}
+	
+	SDL_FreeSurface (handle->save_screen);
+	handle->save_screen = NULL;
+
+#ifdef HAVE_SDL_TTF
+	if (handle->font != NULL) {
+		TTF_CloseFont (handle->font);
+		handle->font = NULL;
+	}
+	
+	/* Sin tipografía sólo se liberan los textos ya dibujados */
+	cpstamp_render_earned_text (handle);
+	
+	cpstamp_glyph_cache_free (handle->glyphs);
+	handle->glyphs = NULL;
+#endif
+
+#ifdef HAVE_SDL_MIXER
+	if (handle->stamp_sound_earn != NULL) {
+		Mix_FreeChunk (handle->stamp_sound_earn);
+		handle->stamp_sound_earn = NULL;
+	}
+#endif
+
+	/* Las imágenes propias de las estampas también se vuelven a leer */
+	cpstamp_icon_cache_clear (handle->icon_cache);
+	
+	handle->assets_loaded = FALSE;
+	handle->stats.asset_memory = 0;
+	handle->stats.asset_unloads++;
 }
 
-static int cpstamp_folder_create (const char *fname) {
-	char *parent_folder;
-	char *sub_folder;
-	int ok = TRUE;
+/* Carga las imágenes, la tipografía y el sonido si no están en memoria.
+ * Regresa FALSE si faltan las imágenes, la tipografía y el sonido son opcionales */
+static int cpstamp_assets_load (CPStampHandle *handle) {
+	SDL_Surface *scaled;
+	Uint32 bytes;
+	int g;
+#if defined (HAVE_SDL_IMAGE) || defined (HAVE_SDL_TTF) || defined (HAVE_SDL_MIXER)
+	char buffer_file[8192];
+#endif
+
+	if (handle->assets_loaded) return TRUE;
+	
+	for (g = 0; g < NUM_IMGS; g++) {
+#ifdef HAVE_SDL_IMAGE
+		sprintf (buffer_file, "%s%s", handle->systemdata_path, cpstamp_images_names [g]);
+		handle->stamp_images[g] = cpstamp_blend_convert (IMG_Load (buffer_file));
+#else
+		handle->stamp_images[g] = cpstamp_builtin_image (g);
+#endif
+
+		/* Se escalan aquí una sola vez, no al dibujar */
+		if (handle->scale != 100 && handle->stamp_images[g] != NULL) {
+			scaled = cpstamp_blend_scale (handle->stamp_images[g], cpstamp_scaled (handle, handle->stamp_images[g]->w), cpstamp_scaled (handle, handle->stamp_images[g]->h));
+			
+			if (scaled != NULL) {
+				SDL_FreeSurface (handle->stamp_images[g]);
+				handle->stamp_images[g] = scaled;
+			}
+		}
+	}
 	
-	if (cpstamp_folder_exists (fname)) return TRUE;
+	handle->save_screen = NULL;
+	if (handle->stamp_images[IMG_STAMP_PANEL] != NULL) {
+		handle->save_screen = SDL_CreateRGBSurface (SDL_SWSURFACE, handle->stamp_images[IMG_STAMP_PANEL]->w, handle->stamp_images[IMG_STAMP_PANEL]->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	}
 	
-	parent_folder = strdup (fname);
-	sub_folder = strdup (fname);
+	/* Si falla la carga de alguna de las imágenes, eliminar todo */
+	for (g = 0; g < NUM_IMGS && handle->stamp_images[g] != NULL; g++);
 	
-	if (cpstamp_split_path (fname, parent_folder, sub_folder)) {
-		if (!cpstamp_folder_exists (parent_folder)) {
-			ok = cpstamp_folder_create (parent_folder);
+	if (g < NUM_IMGS || handle->save_screen == NULL) {
+		for (g = 0; g < NUM_IMGS; g++) {
+			if (handle->stamp_images[g] != NULL) SDL_FreeSurface (handle->stamp_images[g]);
+			handle->stamp_images[g] = NULL;
 		}
+		
+		if (handle->save_screen != NULL) SDL_FreeSurface (handle->save_screen);
+		handle->save_screen = NULL;
+		
+		return FALSE;
+	}
+
+#ifdef HAVE_SDL_MIXER
+	/* Si no se puede cargar el sonido, la notificación es muda */
+	sprintf (buffer_file, "%ssounds/earn.wav", handle->systemdata_path);
+	handle->stamp_sound_earn = Mix_LoadWAV (buffer_file);
+#endif
+
+#ifdef HAVE_SDL_TTF
+	if (!TTF_WasInit ()) {
+		TTF_Init ();
+	}
+	
+	if (TTF_WasInit ()) {
+		/* Los textos se dibujan directo al tamaño de la escala */
+		sprintf (buffer_file, "%sburbanksb.ttf", handle->systemdata_path);
+		handle->font = TTF_OpenFont (buffer_file, cpstamp_scaled (handle, 11));
+		
+		cpstamp_render_earned_text (handle);
 	}
 	
-	if (ok) {
-		#ifdef __MINGW32__
-		ok = mkdir(fname) == 0;
-		#else
-		ok = mkdir(fname, 0775) == 0;
-		#endif
+	/* Los títulos de las estampas se dibujan desde un atlas de caracteres */
+	handle->glyphs = cpstamp_glyph_cache_new (handle->font, &handle->stats);
+#endif
+
+	/* Lo que ocupa en memoria, para las estadísticas */
+	bytes = handle->save_screen->h * handle->save_screen->pitch;
+	for (g = 0; g < NUM_IMGS; g++) {
+		bytes += handle->stamp_images[g]->h * handle->stamp_images[g]->pitch;
 	}
+	for (g = 0; g < 2; g++) {
+		if (handle->earned_text[g] != NULL) bytes += handle->earned_text[g]->h * handle->earned_text[g]->pitch;
+	}
+#ifdef HAVE_SDL_TTF
+	bytes += cpstamp_glyph_cache_bytes (handle->glyphs);
+#endif
+#ifdef HAVE_SDL_MIXER
+	if (handle->stamp_sound_earn != NULL) bytes += handle->stamp_sound_earn->alen;
+#endif
+
+	handle->panel_w = handle->stamp_images[IMG_STAMP_PANEL]->w;
+	handle->panel_h = handle->stamp_images[IMG_STAMP_PANEL]->h;
+	cpstamp_icon_cache_set_scale (handle->icon_cache, handle->scale);
+	
+	handle->assets_loaded = TRUE;
+	handle->stats.asset_memory = bytes;
+	handle->stats.asset_loads++;
+	
+	return TRUE;
+}
+
+/* Sin notificaciones, libera lo cargado si pasó el tiempo de espera */
+static void cpstamp_assets_idle (CPStampHandle *handle) {
+	if (!handle->assets_loaded || handle->idle_unload == 0) return;
 	
-	free (parent_folder);
-	free (sub_folder);
-	return ok;
+	if (SDL_GetTicks () - handle->idle_since >= handle->idle_unload) {
+		cpstamp_assets_unload (handle);
+	}
 }
 
 /* Funciones públicas */
 CPStampHandle *CPStamp_Init (int argc, char **argv) {
 	CPStampHandle *l_handle;
 	char *systemdata_path, *l10n_path;
-	int g, h;
-	SDL_Color blanco, negro;
-	char buffer_file[8192];
+	int g;
 	
 	/* Si ya nos inicializamos, regresar el handle */
 	if (cpstamp_handle != NULL) return cpstamp_handle;
@@ -204,62 +466,109 @@ CPStampHandle *CPStamp_Init (int argc, char **argv) {
 	/* Conseguir las urls del sistema */
 	cpstamp_init_paths (argv[0], &systemdata_path, &l10n_path, &l_handle->userdata_path);
 	
+	l_handle->dir.path = NULL;
+	l_handle->dir.fd = l_handle->dir.lock_fd = -1;
+	l_handle->dir.mutex = NULL;
+	l_handle->watch_fd = -1;
+	
+	/* Las categorías se guardan en archivos hasta que se pida otra cosa */
+	l_handle->storage = cpstamp_file_storage;
+	l_handle->storage_data = l_handle;
+	
+	/* El hilo de guardado se crea hasta que se necesita */
+	l_handle->save_thread = NULL;
+	l_handle->save_mutex = SDL_CreateMutex ();
+	l_handle->save_cond = SDL_CreateCond ();
+	l_handle->save_done_cond = SDL_CreateCond ();
+	l_handle->save_queue = l_handle->save_done = NULL;
+	l_handle->save_ran = l_handle->save_tickets = l_handle->save_collected = 0;
+	l_handle->saves_pending = 0;
+	
 	/* Inicializar nuestro dominio de i18n */
 	bindtextdomain (PACKAGE, l10n_path);
 	bind_textdomain_codeset (PACKAGE, "UTF-8");
 	
 	free (l10n_path);
 	
+	/* Se conserva para volver a cargar las imágenes tras liberarlas */
+	l_handle->systemdata_path = systemdata_path;
+	
+	l_handle->activate = l_handle->stamp_timer = l_handle->stamp_queue_start = l_handle->stamp_queue_end = 0;
+	l_handle->coalesce = CPSTAMP_COALESCE_NONE;
+	l_handle->max_latency = 0;
+	l_handle->stamp_merged = 1;
+	l_handle->merged_label[0] = 0;
+	l_handle->frames = 0;
+	
+	memset (&l_handle->stats, 0, sizeof (CPStampStats));
+	l_handle->categorias = NULL;
+
+#ifdef CPSTAMP_SDL2
+	l_handle->renderer = NULL;
 	for (g = 0; g < NUM_IMGS; g++) {
-		sprintf (buffer_file, "%s%s", systemdata_path, cpstamp_images_names [g]);
-		l_handle->stamp_images[g] = IMG_Load (buffer_file);
-		
-		/* Si falla la carga de alguna de las imágenes, eliminar todo */ 
-		if (l_handle->stamp_images[g] == NULL) {
-			for (h = 0; h < g; h++) {
-				SDL_FreeSurface (l_handle->stamp_images[h]);
-				l_handle->stamp_images[h] = NULL;
-			}
-			
-			free (l_handle);
-			return NULL;
-		}
+		l_handle->tex_images[g] = NULL;
 	}
+	l_handle->tex_earned[0] = l_handle->tex_earned[1] = NULL;
+	l_handle->tex_title[0] = l_handle->tex_title[1] = NULL;
+	l_handle->tex_merged[0] = l_handle->tex_merged[1] = NULL;
+	l_handle->tex_icon = NULL;
+#endif
+
+	for (g = 0; g < NUM_CPSTAMP_EVENTS; g++) {
+		l_handle->callbacks[g] = NULL;
+		l_handle->callbacks_data[g] = NULL;
+	}
+	l_handle->user_event = -1;
 	
-	l_handle->save_screen = SDL_AllocSurface (SDL_SWSURFACE, l_handle->stamp_images[IMG_STAMP_PANEL]->w, l_handle->stamp_images[IMG_STAMP_PANEL]->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-	
-	sprintf (buffer_file, "%ssounds/earn.wav", systemdata_path);
-	l_handle->stamp_sound_earn = Mix_LoadWAV (buffer_file);
+	l_handle->retained = FALSE;
+	l_handle->background_valid = l_handle->panel_drawn = l_handle->panel_dirty = FALSE;
+	l_handle->panel_y = 0;
+	l_handle->invalid_rect.x = l_handle->invalid_rect.y = 0;
+	l_handle->invalid_rect.w = l_handle->invalid_rect.h = 0;
+	l_handle->buffer_drawn = l_handle->buffer_dirty = FALSE;
+	l_handle->buffer_layer = NULL;
+	l_handle->buffer_y = 0;
 	
-	if (l_handle->stamp_sound_earn == NULL) {
-		/* Desactivar el audio, no pude cargar un sonido */
-		l_handle->use_sound = 0;
-	}
+	l_handle->icon_cache = cpstamp_icon_cache_new (CPSTAMP_ICON_CACHE_SIZE);
+	l_handle->stamp_icon = NULL;
 	
-	l_handle->activate = l_handle->stamp_timer = l_handle->stamp_queue_start = l_handle->stamp_queue_end = 0;
+	l_handle->stamp_title = NULL;
 	
-	if (!TTF_WasInit ()) {
-		TTF_Init ();
+	for (g = 0; g < NUM_IMGS; g++) {
+		l_handle->stamp_images[g] = NULL;
 	}
-	
-	if (TTF_WasInit ()) {
-		sprintf (buffer_file, "%sburbanksb.ttf", systemdata_path);
-		l_handle->font = TTF_OpenFont (buffer_file, 11);
-		
-		if (l_handle->font != NULL) {
-			blanco.r = blanco.g = blanco.b = 255;
-			negro.r = negro.g = negro.b = 0;
-			
-			l_handle->earned_text[0] = TTF_RenderUTF8_Blended (l_handle->font, _("Stamp Earned!"), negro);
-			l_handle->earned_text[1] = TTF_RenderUTF8_Blended (l_handle->font, _("Stamp Earned!"), blanco);
-		} else {
-			l_handle->earned_text[0] = l_handle->earned_text[1] = NULL;
-		}
-	} else {
-		l_handle->font = NULL;
-		l_handle->earned_text[0] = l_handle->earned_text[1] = NULL;
+	l_handle->save_screen = NULL;
+	l_handle->earned_text[0] = l_handle->earned_text[1] = NULL;
+#ifdef HAVE_SDL_TTF
+	l_handle->font = NULL;
+	l_handle->glyphs = NULL;
+#endif
+#ifdef HAVE_SDL_MIXER
+	l_handle->stamp_sound_earn = NULL;
+#endif
+	l_handle->use_sound = TRUE;
+	l_handle->assets_loaded = FALSE;
+	l_handle->idle_unload = 0;
+	
+	/* El diseño original, para pantallas de 640 de ancho */
+	l_handle->anchor_x = l_handle->next_anchor_x = 392;
+	l_handle->anchor_y = l_handle->next_anchor_y = 0;
+	l_handle->scale = l_handle->next_scale = 100;
+	
+	if (!cpstamp_assets_load (l_handle)) {
+		/* Sin las imágenes no se puede dibujar nada */
+		cpstamp_icon_cache_free (l_handle->icon_cache);
+		SDL_DestroyCond (l_handle->save_done_cond);
+		SDL_DestroyCond (l_handle->save_cond);
+		SDL_DestroyMutex (l_handle->save_mutex);
+		free (l_handle->userdata_path);
+		free (systemdata_path);
+		free (l_handle);
+		return NULL;
 	}
 	
+	l_handle->idle_since = SDL_GetTicks ();
+	
 	cpstamp_handle = l_handle;
 	
 	return l_handle;
@@ -267,449 +576,1584 @@ CPStampHandle *CPStamp_Init (int argc, char **argv) {
 
 void CPStamp_Earn (CPStampHandle *handle, CPStampCategory *cat, int id) {
 	CPStamp *s;
+	char *path;
+	int depth, g;
+	SDL_Event event;
 	
 	if (handle == NULL || cat == NULL) return;
-	s = cat->lista;
-	
-	while (s != NULL) {
-		if (s->id == id) {
-			if (!s->ganada) {
-				handle->activate = 1;
-				s->ganada = TRUE;
-				handle->stamp_queue [handle->stamp_queue_end] = s;
-				handle->stamp_queue_end = (handle->stamp_queue_end + 1) % 10;
-			}
-			break;
-		}
-		
-		s = s->sig;
-	}
-}
-
-void CPStamp_Draw (CPStampHandle *handle, SDL_Surface *screen, int save) {
-	SDL_Rect rect;
-	int imagen;
-	static SDL_Surface *subtext[2];
-	SDL_Color blanco, negro;
-	CPStamp *stamp;
-	char *l10n_title;
 	
-	if (handle == NULL) return;
-	if (handle->stamp_queue_start == handle->stamp_queue_end) {
-		handle->activate = 0;
-		return;
-	}
+	g = cpstamp_table_find (&cat->estampas, id);
+	if (g < 0 || cat->estampas.ganadas[g]) return;
 	
-	/* Encontrar la estampa a mostrar */
-	stamp = handle->stamp_queue[handle->stamp_queue_start];
+	cpstamp_save_unshare (cat);
+	cat->estampas.ganadas[g] = TRUE;
+	if (cat->live != NULL) cpstamp_live_earn (cat->live, g);
 	
-	if (handle->stamp_timer == 0) {
-		if (handle->font != NULL) {
-			blanco.r = blanco.g = blanco.b = 255;
-			negro.r = negro.g = negro.b = 0;
-			
-			if (stamp->category_struct->l10n_domain != NULL) {
-				l10n_title = dgettext (stamp->category_struct->l10n_domain, stamp->titulo);
-			} else {
-				l10n_title = stamp->titulo;
-			}
-			subtext[0] = TTF_RenderUTF8_Blended (handle->font, l10n_title, negro);
-			subtext[1] = TTF_RenderUTF8_Blended (handle->font, l10n_title, blanco);
-		}
-	}
+	cpstamp_emit (handle, CPSTAMP_EVENT_EARNED, cat, cat->clave, id, 0);
 	
-	if (handle->stamp_timer >= 8 && save) {
-		handle->update_rect.x = 392; handle->update_rect.y = 0;
-		handle->update_rect.w = handle->stamp_images[IMG_STAMP_PANEL]->w;
-		handle->update_rect.h = handle->stamp_images[IMG_STAMP_PANEL]->h;
-		
-		SDL_BlitSurface (screen, &handle->update_rect, handle->save_screen, NULL);
+	if ((handle->stamp_queue_end + 1) % 10 == handle->stamp_queue_start) {
+		/* Cola llena, la estampa queda ganada pero no se notifica */
+		handle->stats.dropped++;
+		return;
 	}
 	
-	if (handle->stamp_timer < 56) {
-		handle->update_rect.h = handle->stamp_images[IMG_STAMP_PANEL]->h;
-		handle->update_rect.w = handle->stamp_images[IMG_STAMP_PANEL]->w;
-		handle->update_rect.x = 392;
-		handle->update_rect.y = 0;
-		switch (handle->stamp_timer) {
-			case 8:
-				handle->update_rect.y = 20 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 9:
-				handle->update_rect.y = 40 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 10:
-				handle->update_rect.y = 53 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 11:
-				if (handle->use_sound) Mix_PlayChannel (-1, handle->stamp_sound_earn, 0);
-				handle->update_rect.y = 66 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 12:
-				handle->update_rect.y = 72 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 13:
-				handle->update_rect.y = 78 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 52:
-				handle->update_rect.y = 77 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 53:
-				handle->update_rect.y = 67 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 54:
-				handle->update_rect.y = 51 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			case 55:
-				handle->update_rect.y = 29 - handle->stamp_images[IMG_STAMP_PANEL]->h;
-				break;
-			default:
-				handle->update_rect.y = 0;
-		}
+	handle->activate = 1;
+	s = &handle->stamp_queue [handle->stamp_queue_end];
+	s->cat = cat;
+	s->pos = g;
+	handle->stamp_queue_frame [handle->stamp_queue_end] = handle->frames;
+	handle->stamp_queue_end = (handle->stamp_queue_end + 1) % 10;
+	
+	handle->stats.notifications++;
+	depth = (handle->stamp_queue_end - handle->stamp_queue_start + 10) % 10;
+	if (depth > handle->stats.queue_max_depth) handle->stats.queue_max_depth = depth;
+	
+	/* Si se liberaron las imágenes por inactividad, cargarlas antes del primer cuadro */
+	cpstamp_assets_load (handle);
+	
+	/* Cargar desde ahora la imagen, para no detener la animación */
+	path = cpstamp_stamp_image_path (s);
+	cpstamp_icon_cache_prefetch (handle->icon_cache, path);
+	free (path);
+	
+	/* Despertar al ciclo principal si está esperando en SDL_WaitEvent */
+	if (handle->user_event >= 0) {
+		event.type = SDL_USEREVENT;
+		event.user.code = handle->user_event;
+		event.user.data1 = cat;
+		event.user.data2 = (void *) (intptr_t) id;
 		
-		if (handle->stamp_timer > 13 && handle->stamp_timer < 52) {
-			handle->update_rect.y = 0;
-		}
-		
-		if (handle->stamp_timer >= 8) {
-			imagen = handle->update_rect.y;
-			
-			SDL_BlitSurface (handle->stamp_images[IMG_STAMP_PANEL], NULL, screen, &handle->update_rect);
-			handle->update_rect.y = 0; handle->update_rect.h = handle->stamp_images[IMG_STAMP_PANEL]->h;
-			
-			/* Dibujar los textos sólo si la tipografía funciona */
-			if (handle->font != NULL) {
-				/* Dibujar el texto de "Estampa ganada" */
-				rect.x = 492; rect.y = imagen + 22;
-				rect.w = handle->earned_text[0]->w; rect.h = handle->earned_text[0]->h;
-				SDL_BlitSurface (handle->earned_text[0], NULL, screen, &rect);
-			
-				rect.x = 490; rect.y = imagen + 20;
-				rect.w = handle->earned_text[1]->w; rect.h = handle->earned_text[1]->h;
-				SDL_BlitSurface (handle->earned_text[1], NULL, screen, &rect);
-			
-				/* Dibujar subtitulo */
-				rect.x = 492; rect.y = imagen + 42;
-				rect.w = subtext[0]->w; rect.h = subtext[0]->h;
-				SDL_BlitSurface (subtext[0], NULL, screen, &rect);
-			
-				rect.x = 490; rect.y = imagen + 40;
-				rect.w = subtext[1]->w; rect.h = subtext[1]->h;
-				SDL_BlitSurface (subtext[1], NULL, screen, &rect);
-			}
-			
-			rect.y = imagen + 6;
-			if (stamp->categoria == STAMP_TYPE_GAME) {
-				imagen = IMG_STAMP_GAME_EASY + stamp->dificultad;
-			} else {
-				imagen = IMG_STAMP_GAME_EASY;
-			}
-			
-			rect.x = 410 + (73 - handle->stamp_images[imagen]->w) / 2;
-			rect.w = handle->stamp_images[imagen]->w;
-			rect.h = handle->stamp_images[imagen]->h;
-			
-			SDL_BlitSurface (handle->stamp_images[imagen], NULL, screen, &rect);
-		} else {
-			handle->update_rect.x = handle->update_rect.y = 0;
-			handle->update_rect.w = handle->update_rect.h = 0;
-		}
-		
-		handle->stamp_timer++;
-	} else if (handle->stamp_timer >= 56) {
-		handle->stamp_timer = 0;
-		handle->stamp_queue_start = (handle->stamp_queue_start + 1) % 10;
-		
-		if (subtext[0] != NULL) {
-			SDL_FreeSurface (subtext[0]);
-			SDL_FreeSurface (subtext[1]);
-		}
+		SDL_PushEvent (&event);
 	}
 }
 
-void CPStamp_Restore (CPStampHandle *handle, SDL_Surface *screen) {
-	SDL_Rect rect;
-	
-	if (handle->stamp_timer > 8 && handle->stamp_timer <= 56) {
-		rect.x = 392;
-		rect.y = 0;
-		rect.h = handle->stamp_images[IMG_STAMP_PANEL]->h;
-		rect.w = handle->stamp_images[IMG_STAMP_PANEL]->w;
-		
-		SDL_BlitSurface (handle->save_screen, NULL, screen, &rect);
+/* Posición vertical del panel según el cuadro de la animación */
+static int cpstamp_panel_offset (CPStampHandle *handle, int timer) {
+	int visible;
+	
+	/* Pixeles del panel que asoman bajo el ancla, en el diseño original */
+	switch (timer) {
+		case 8:
+			visible = 20; break;
+		case 9:
+			visible = 40; break;
+		case 10:
+			visible = 53; break;
+		case 11:
+			visible = 66; break;
+		case 12:
+			visible = 72; break;
+		case 13:
+			visible = 78; break;
+		case 52:
+			visible = 77; break;
+		case 53:
+			visible = 67; break;
+		case 54:
+			visible = 51; break;
+		case 55:
+			visible = 29; break;
+		default:
+			return handle->anchor_y;
 	}
+	
+	return handle->anchor_y + cpstamp_scaled (handle, visible) - handle->panel_h;
 }
 
-CPStampCategory *CPStamp_Open (CPStampHandle *handle, int tipo, char *nombre, char *clave) {
-	char buf[4096];
-	int fd;
-	uint32_t temp;
-	int g, n_stampas, res;
-	CPStampCategory *abierta;
-	CPStamp *s, *last;
-	uint32_t version;
+static void cpstamp_panel_rect (CPStampHandle *handle, SDL_Rect *rect) {
+	rect->x = handle->anchor_x; rect->y = handle->anchor_y;
+	rect->w = handle->panel_w;
+	rect->h = handle->panel_h;
+}
+
+/* Intersección de dos rectángulos, regresa FALSE si no se tocan */
+static int cpstamp_rect_intersect (const SDL_Rect *a, const SDL_Rect *b, SDL_Rect *res) {
+	int x1, y1, x2, y2;
 	
-	if (handle == NULL) return NULL;
-	if (handle->userdata_path == NULL || handle->userdata_path[0] == 0) return NULL;
+	x1 = (a->x > b->x) ? a->x : b->x;
+	y1 = (a->y > b->y) ? a->y : b->y;
+	x2 = (a->x + a->w < b->x + b->w) ? a->x + a->w : b->x + b->w;
+	y2 = (a->y + a->h < b->y + b->h) ? a->y + a->h : b->y + b->h;
 	
-	sprintf (buf, "%s/.cpstamps/", handle->userdata_path);
+	if (x2 <= x1 || y2 <= y1) return FALSE;
 	
-	if (!cpstamp_folder_exists (buf)) {
-		if (!cpstamp_folder_create (buf)) {
-			return NULL;
-		}
+	res->x = x1;
+	res->y = y1;
+	res->w = x2 - x1;
+	res->h = y2 - y1;
+	
+	return TRUE;
+}
+
+/* Copia una imagen del panel. En la capa premultiplicada de CPStamp_DrawBuffer,
+ * lo que no mezclan nuestros kernels lo copia SDL con el alpha en 0 */
+static void cpstamp_draw_image (CPStampHandle *handle, SDL_Surface *image, SDL_Surface *screen, SDL_Rect *rect) {
+	cpstamp_blit (&handle->stats, image, NULL, screen, rect);
+	
+	if (screen == handle->buffer_layer && !cpstamp_blend_supported (image)) cpstamp_blend_set_opaque (screen, rect);
+}
+
+/* Dibuja el panel completo de la estampa, con su parte superior en "y" */
+static void cpstamp_draw_panel (CPStampHandle *handle, SDL_Surface *screen, CPStamp *stamp, int y) {
+	SDL_Rect rect, clip, panel;
+#ifdef HAVE_SDL_TTF
+	SDL_Color blanco, negro;
+	int tx, sombra;
+#endif
+	SDL_Surface *icon;
+	
+	/* El panel sólo se ve bajo el ancla, como si saliera de la orilla de la pantalla */
+	SDL_GetClipRect (screen, &clip);
+	cpstamp_panel_rect (handle, &panel);
+	if (!cpstamp_rect_intersect (&panel, &clip, &rect)) return;
+	SDL_SetClipRect (screen, &rect);
+	
+	rect.x = handle->anchor_x; rect.y = y;
+	rect.w = handle->stamp_images[IMG_STAMP_PANEL]->w;
+	rect.h = handle->stamp_images[IMG_STAMP_PANEL]->h;
+	cpstamp_draw_image (handle, handle->stamp_images[IMG_STAMP_PANEL], screen, &rect);
+
+#ifdef HAVE_SDL_TTF
+	/* Dibujar los textos sólo si la tipografía funciona */
+	if (handle->font != NULL && handle->earned_text[0] != NULL) {
+		blanco.r = blanco.g = blanco.b = 255;
+		negro.r = negro.g = negro.b = 0;
+		tx = handle->anchor_x + cpstamp_scaled (handle, 98);
+		sombra = cpstamp_scaled (handle, 2);
+		
+		if (handle->stamp_merged > 1) {
+			/* Varias estampas en el mismo panel, el texto lleva la cantidad */
+			cpstamp_glyph_cache_draw (handle->glyphs, handle->merged_label, negro, screen, tx + sombra, y + cpstamp_scaled (handle, 20) + sombra);
+			cpstamp_glyph_cache_draw (handle->glyphs, handle->merged_label, blanco, screen, tx, y + cpstamp_scaled (handle, 20));
+		} else {
+			/* Dibujar el texto de "Estampa ganada" */
+			rect.x = tx + sombra; rect.y = y + cpstamp_scaled (handle, 20) + sombra;
+			rect.w = handle->earned_text[0]->w; rect.h = handle->earned_text[0]->h;
+			cpstamp_draw_image (handle, handle->earned_text[0], screen, &rect);
+			
+			rect.x = tx; rect.y = y + cpstamp_scaled (handle, 20);
+			rect.w = handle->earned_text[1]->w; rect.h = handle->earned_text[1]->h;
+			cpstamp_draw_image (handle, handle->earned_text[1], screen, &rect);
+		}
+		
+		/* Dibujar subtitulo */
+		cpstamp_glyph_cache_draw (handle->glyphs, handle->stamp_title, negro, screen, tx + sombra, y + cpstamp_scaled (handle, 40) + sombra);
+		cpstamp_glyph_cache_draw (handle->glyphs, handle->stamp_title, blanco, screen, tx, y + cpstamp_scaled (handle, 40));
+	}
+#endif
+
+	rect.y = y + cpstamp_scaled (handle, 6);
+	if (handle->stamp_icon != NULL) {
+		icon = handle->stamp_icon;
+	} else {
+		icon = handle->stamp_images[cpstamp_stamp_image (stamp)];
 	}
 	
-	sprintf (buf, "%s/.cpstamps/%s", handle->userdata_path, clave);
+	rect.x = handle->anchor_x + cpstamp_scaled (handle, 18) + (cpstamp_scaled (handle, 73) - icon->w) / 2;
+	rect.w = icon->w;
+	rect.h = icon->h;
 	
-	fd = open (buf, O_RDWR | O_CREAT, 0644);
+	cpstamp_draw_image (handle, icon, screen, &rect);
 	
-	if (fd < 0) {
-		if (errno == ENOENT) {
-			return NULL;
+	SDL_SetClipRect (screen, &clip);
+}
+
+/* Modo retenido: el fondo se captura una vez, y sólo se actualizan las
+ * partes que la aplicación marcó con CPStamp_Invalidate. Cuando el panel
+ * está quieto y nada cambió, no se copia ni se dibuja nada */
+static void cpstamp_draw_retained (CPStampHandle *handle, SDL_Surface *screen, CPStamp *stamp) {
+	SDL_Rect panel, src, dst;
+	int y;
+	
+	cpstamp_panel_rect (handle, &panel);
+	
+	if (!handle->background_valid) {
+		/* Nada nuestro está en pantalla, capturar todo el fondo */
+		cpstamp_blit (&handle->stats, screen, &panel, handle->save_screen, NULL);
+		handle->background_valid = TRUE;
+		handle->panel_drawn = FALSE;
+	} else if (handle->invalid_rect.w > 0) {
+		/* La aplicación redibujó una parte, copiar sólo lo que cae bajo el panel */
+		if (cpstamp_rect_intersect (&handle->invalid_rect, &panel, &src)) {
+			dst.x = src.x - panel.x;
+			dst.y = src.y - panel.y;
+			
+			cpstamp_blit (&handle->stats, screen, &src, handle->save_screen, &dst);
+			handle->panel_dirty = TRUE;
 		}
-		perror (_("Failed to open Stamps File"));
 	}
 	
-	abierta = (CPStampCategory *) malloc (sizeof (CPStampCategory));
+	handle->invalid_rect.w = handle->invalid_rect.h = 0;
 	
-	if (abierta == NULL) {
-		close (fd);
-		return NULL;
-	}
+	y = cpstamp_panel_offset (handle, handle->stamp_timer);
 	
-	abierta->nombre = nombre;
-	abierta->categoria = tipo;
-	abierta->fd = fd;
-	abierta->lista = NULL;
-	abierta->l10n_domain = NULL;
-	abierta->l10n_dir = NULL;
-	abierta->resource_dir = NULL;
+	if (handle->panel_drawn && !handle->panel_dirty && y == handle->panel_y) {
+		/* Cuadro estático, la pantalla ya tiene el panel */
+		handle->update_rect.x = handle->update_rect.y = 0;
+		handle->update_rect.w = handle->update_rect.h = 0;
+		return;
+	}
 	
-	/* Leer el número de versión */
-	if (read (fd, &version, sizeof (uint32_t)) == 0) {
-		/* El archivo no existe, así que se ignora y se crea la estructura */
-		return abierta;
+	if (handle->panel_drawn) {
+		/* Borrar el panel anterior antes de dibujar encima */
+		dst = panel;
+		cpstamp_blit (&handle->stats, handle->save_screen, NULL, screen, &dst);
 	}
 	
-	/* Si la versión no es 0 o 1, no abrir el archivo */
-	if (version != 0 && version != 1) {
-		free (abierta);
-		return NULL;
+	cpstamp_draw_panel (handle, screen, stamp, y);
+	
+	handle->panel_drawn = TRUE;
+	handle->panel_dirty = FALSE;
+	handle->panel_y = y;
+	handle->update_rect = panel;
+}
+
+/* Suma a la notificación actual las estampas que esperan en la cola.
+ * Salen de la cola de inmediato, así no ocupan lugar mientras dura el panel */
+static void cpstamp_merge_pending (CPStampHandle *handle) {
+	CPStamp stamp;
+	int depth;
+	
+	depth = (handle->stamp_queue_end - handle->stamp_queue_start + 10) % 10;
+	
+	if (depth <= 1) return;
+	
+	/* La estampa en pantalla pasa al último lugar ocupado */
+	stamp = handle->stamp_queue[handle->stamp_queue_start];
+	handle->stamp_queue_start = (handle->stamp_queue_start + depth - 1) % 10;
+	handle->stamp_queue[handle->stamp_queue_start] = stamp;
+	handle->stamp_merged += depth - 1;
+	
+	snprintf (handle->merged_label, sizeof (handle->merged_label), dngettext (PACKAGE, "%d Stamp Earned!", "%d Stamps Earned!", handle->stamp_merged), handle->stamp_merged);
+
+#ifdef CPSTAMP_SDL2
+	cpstamp_destroy_texture (&handle->tex_merged[0]);
+	cpstamp_destroy_texture (&handle->tex_merged[1]);
+#endif
+}
+
+/* Revisa si hay una notificación que dibujar y que lo necesario esté cargado */
+static int cpstamp_frame_ready (CPStampHandle *handle) {
+	if (handle->stamp_queue_start == handle->stamp_queue_end) {
+		handle->activate = 0;
+		cpstamp_assets_idle (handle);
+		return FALSE;
 	}
 	
-	abierta->read_version = version;
+	/* Entre notificaciones se puede mover el panel o cambiar la escala */
+	if (handle->stamp_timer == 0) {
+		handle->anchor_x = handle->next_anchor_x;
+		handle->anchor_y = handle->next_anchor_y;
+		
+		if (handle->scale != handle->next_scale) {
+			cpstamp_assets_unload (handle);
+			handle->scale = handle->next_scale;
+		}
+	}
 	
-	/* Leer la cantidad de estampas */
-	if (read (fd, &temp, sizeof (uint32_t)) == 0) {
-		/* Se llegó al fin de archivo, ignorar y retornar la estructura */
-		return abierta;
+	if (!cpstamp_assets_load (handle)) {
+		/* No se pudieron volver a cargar las imágenes, las notificaciones se pierden */
+		handle->stats.dropped += (handle->stamp_queue_end - handle->stamp_queue_start + 10) % 10;
+		handle->stamp_queue_start = handle->stamp_queue_end;
+		handle->activate = 0;
+		return FALSE;
 	}
 	
-	n_stampas = temp;
+	return TRUE;
+}
+
+/* Prepara el cuadro actual de la animación, regresa la estampa en pantalla */
+static CPStamp *cpstamp_frame_begin (CPStampHandle *handle) {
+	CPStamp *stamp;
+	char *path;
+	int next, g;
 	
-	if (version >= 1) {
-		/* Leer la categoria general */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res < 0 || temp >= NUM_STAMP_TYPE) {
-			/* Ignorar, poner la categoría por default */
-			return abierta;
-		}
+	/* Encontrar la estampa a mostrar */
+	stamp = &handle->stamp_queue[handle->stamp_queue_start];
+	
+	if (handle->stamp_timer == 0) {
+		handle->stamp_title = cpstamp_l10n_title (stamp);
 		
-		abierta->categoria = tipo;
+		/* Conservar la imagen propia de la estampa mientras dure la animación */
+		path = cpstamp_stamp_image_path (stamp);
+		handle->stamp_icon = cpstamp_icon_cache_get (handle->icon_cache, path);
+		free (path);
 		
-		/* Leer el nombre de las estampas */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0) {
-			/* Error en la lectura del archivo, ignorar */
-			return abierta;
-		}
+		if (handle->stamp_icon != NULL) handle->stamp_icon->refcount++;
+		
+		handle->background_valid = FALSE;
+		handle->panel_drawn = FALSE;
+		handle->invalid_rect.w = handle->invalid_rect.h = 0;
+		handle->stamp_merged = 1;
+		
+		cpstamp_emit (handle, CPSTAMP_EVENT_NOTIFICATION_START, stamp->cat, stamp->cat->clave, stamp->cat->estampas.ids[stamp->pos], 0);
+	}
+	
+	/* Mientras el panel no aparece, las estampas nuevas se suman a esta notificación */
+	if (handle->coalesce == CPSTAMP_COALESCE_MERGE && handle->stamp_timer < 8) {
+		cpstamp_merge_pending (handle);
+		stamp = &handle->stamp_queue[handle->stamp_queue_start];
+	}
+	
+	/* Si alguna notificación de la cola ya no alcanza a aparecer a tiempo, empezar
+	 * a ocultar el panel. Desde el cuadro 52 faltan 5 cuadros para salir y 8 para
+	 * que aparezca la siguiente, y cada una de las que esperan detrás de ella
+	 * necesita 19 cuadros más, aunque también se oculten lo antes posible */
+	if (handle->max_latency > 0 && handle->stamp_timer >= 14 && handle->stamp_timer < 52) {
+		next = (handle->stamp_queue_start + 1) % 10;
 		
-		if (temp < sizeof (buf) && temp > 0) { /* Leer solo si tenemos espacio */
-			res = read (fd, buf, temp * sizeof (char));
+		for (g = 0; next != handle->stamp_queue_end; g++) {
+			if (handle->frames - handle->stamp_queue_frame[next] + 13 + g * 19 >= handle->max_latency) {
+				handle->stamp_timer = 52;
+				break;
+			}
 			
-			if (buf[0] != 0) {
-				abierta->nombre = strdup (buf);
+			next = (next + 1) % 10;
+		}
+	}
+
+#ifdef HAVE_SDL_MIXER
+	if (handle->stamp_timer == 11 && handle->use_sound && handle->stamp_sound_earn != NULL) {
+		Mix_PlayChannel (-1, handle->stamp_sound_earn, 0);
+	}
+#endif
+
+	return stamp;
+}
+
+/* Avanza la animación, al terminar pasa a la siguiente estampa de la cola */
+static void cpstamp_frame_end (CPStampHandle *handle, CPStamp *stamp) {
+	handle->frames++;
+	
+	if (handle->stamp_timer < 56) {
+		handle->stamp_timer++;
+		return;
+	}
+	
+	handle->stamp_timer = 0;
+	handle->stamp_queue_start = (handle->stamp_queue_start + 1) % 10;
+	handle->stamp_title = NULL;
+	handle->idle_since = SDL_GetTicks ();
+	
+	/* Soltar nuestra referencia, el caché decide si la imagen sigue en memoria */
+	if (handle->stamp_icon != NULL) {
+		SDL_FreeSurface (handle->stamp_icon);
+		handle->stamp_icon = NULL;
+	}
+
+#ifdef CPSTAMP_SDL2
+	cpstamp_destroy_texture (&handle->tex_title[0]);
+	cpstamp_destroy_texture (&handle->tex_title[1]);
+	cpstamp_destroy_texture (&handle->tex_merged[0]);
+	cpstamp_destroy_texture (&handle->tex_merged[1]);
+	cpstamp_destroy_texture (&handle->tex_icon);
+#endif
+
+	cpstamp_emit (handle, CPSTAMP_EVENT_NOTIFICATION_END, stamp->cat, stamp->cat->clave, stamp->cat->estampas.ids[stamp->pos], 0);
+}
+
+void CPStamp_Draw (CPStampHandle *handle, SDL_Surface *screen, int save) {
+	CPStamp *stamp;
+	Uint64 start;
+	
+	if (handle == NULL) return;
+	cpstamp_saves_collect (handle);
+	CPStamp_CheckChanges (handle);
+	
+	if (!cpstamp_frame_ready (handle)) return;
+	
+	start = cpstamp_now_usec ();
+	
+	stamp = cpstamp_frame_begin (handle);
+	
+	if (handle->retained && save) {
+		if (handle->stamp_timer < 56) {
+			if (handle->stamp_timer >= 8) {
+				cpstamp_draw_retained (handle, screen, stamp);
+			} else {
+				handle->update_rect.x = handle->update_rect.y = 0;
+				handle->update_rect.w = handle->update_rect.h = 0;
 			}
-		} else {
-			/* Brincar el nombre, de igual forma, no debería ser tan largo */
-			lseek (fd, temp, SEEK_CUR);
+		} else if (handle->panel_drawn) {
+			/* Quitar el panel, dejando el fondo que capturamos */
+			cpstamp_panel_rect (handle, &handle->update_rect);
+			cpstamp_blit (&handle->stats, handle->save_screen, NULL, screen, &handle->update_rect);
+			cpstamp_panel_rect (handle, &handle->update_rect);
+			handle->panel_drawn = FALSE;
 		}
-		
-		/* Leer el dominio de traducción */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0) {
-			/* Error en la lectura del archivo, ignorar */
-			return abierta;
+	} else {
+		if (handle->stamp_timer >= 8 && save) {
+			cpstamp_panel_rect (handle, &handle->update_rect);
+			
+			cpstamp_blit (&handle->stats, screen, &handle->update_rect, handle->save_screen, NULL);
 		}
 		
-		if (temp < sizeof (buf) && temp > 0) { /* Leer solo si tenemos espacio */
-			res = read (fd, buf, temp * sizeof (char));
-			
-			if (buf[0] != 0) {
-				abierta->l10n_domain = strdup (buf);
+		if (handle->stamp_timer < 56) {
+			if (handle->stamp_timer >= 8) {
+				cpstamp_draw_panel (handle, screen, stamp, cpstamp_panel_offset (handle, handle->stamp_timer));
+				cpstamp_panel_rect (handle, &handle->update_rect);
+			} else {
+				handle->update_rect.x = handle->update_rect.y = 0;
+				handle->update_rect.w = handle->update_rect.h = 0;
 			}
-		} else {
-			/* Brincar el nombre del dominio, de igual forma, no debería ser tan largo */
-			lseek (fd, temp, SEEK_CUR);
 		}
-		
-		/* Leer el nombre de directorio de l10n */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0) {
-			/* Error en la lectura del archivo, ignorar */
-			return abierta;
+	}
+	
+	cpstamp_frame_end (handle, stamp);
+	
+	cpstamp_stats_draw (&handle->stats, cpstamp_now_usec () - start);
+}
+
+#ifdef CPSTAMP_SDL2
+static void cpstamp_render_panel (CPStampHandle *handle, CPStamp *stamp, int y) {
+#ifdef HAVE_SDL_TTF
+	SDL_Color colores[2];
+	SDL_Surface *surface;
+	int tx, sombra;
+#endif
+	SDL_Surface *icon;
+	SDL_Texture *texture;
+	SDL_Rect clip, panel;
+	int g;
+	
+	/* Las imágenes se suben una sola vez */
+	for (g = 0; g < NUM_IMGS; g++) {
+		if (handle->tex_images[g] == NULL) {
+			handle->tex_images[g] = cpstamp_texture (handle, handle->stamp_images[g]);
 		}
+	}
+	
+	/* Igual que con superficies, el panel sólo se ve bajo el ancla */
+	SDL_RenderGetClipRect (handle->renderer, &clip);
+	cpstamp_panel_rect (handle, &panel);
+	if (clip.w > 0 && !cpstamp_rect_intersect (&clip, &panel, &panel)) return;
+	SDL_RenderSetClipRect (handle->renderer, &panel);
+	
+	cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_images[IMG_STAMP_PANEL], handle->anchor_x, y);
+
+#ifdef HAVE_SDL_TTF
+	/* Dibujar los textos sólo si la tipografía funciona */
+	if (handle->font != NULL && handle->earned_text[0] != NULL) {
+		colores[0].r = colores[0].g = colores[0].b = 0;
+		colores[1].r = colores[1].g = colores[1].b = 255;
+		tx = handle->anchor_x + cpstamp_scaled (handle, 98);
+		sombra = cpstamp_scaled (handle, 2);
 		
-		if (temp < sizeof (buf) && temp > 0) { /* Leer solo si tenemos espacio */
-			res = read (fd, buf, temp * sizeof (char));
-			
-			if (buf[0] != 0) {
-				abierta->l10n_dir = strdup (buf);
+		if (handle->stamp_merged > 1) {
+			/* El texto con la cantidad de estampas también es por notificación */
+			if (handle->tex_merged[0] == NULL) {
+				for (g = 0; g < 2; g++) {
+					surface = TTF_RenderUTF8_Blended (handle->font, handle->merged_label, colores[g]);
+					handle->tex_merged[g] = cpstamp_texture (handle, surface);
+					if (surface != NULL) SDL_FreeSurface (surface);
+				}
 			}
+			
+			cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_merged[0], tx + sombra, y + cpstamp_scaled (handle, 20) + sombra);
+			cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_merged[1], tx, y + cpstamp_scaled (handle, 20));
 		} else {
-			/* Brincar el nombre del l10n_dir, de igual forma, no debería ser tan largo */
-			lseek (fd, temp, SEEK_CUR);
+			for (g = 0; g < 2; g++) {
+				if (handle->tex_earned[g] == NULL) {
+					handle->tex_earned[g] = cpstamp_texture (handle, handle->earned_text[g]);
+				}
+			}
+			
+			cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_earned[0], tx + sombra, y + cpstamp_scaled (handle, 20) + sombra);
+			cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_earned[1], tx, y + cpstamp_scaled (handle, 20));
 		}
 		
-		/* Activar el directorio de la locale */
-		if (abierta->l10n_domain != NULL && abierta->l10n_dir != NULL) {
-			bindtextdomain (abierta->l10n_domain, abierta->l10n_dir);
+		/* El título se sube una vez por notificación */
+		if (handle->tex_title[0] == NULL && handle->stamp_title != NULL && handle->stamp_title[0] != 0) {
+			for (g = 0; g < 2; g++) {
+				surface = TTF_RenderUTF8_Blended (handle->font, handle->stamp_title, colores[g]);
+				handle->tex_title[g] = cpstamp_texture (handle, surface);
+				if (surface != NULL) SDL_FreeSurface (surface);
+			}
 		}
 		
-		/* Leer el nombre de directorio de recursos de estampas */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0) {
-			/* Error en la lectura del archivo, ignorar */
-			return abierta;
+		cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_title[0], tx + sombra, y + cpstamp_scaled (handle, 40) + sombra);
+		cpstamp_render_copy (&handle->stats, handle->renderer, handle->tex_title[1], tx, y + cpstamp_scaled (handle, 40));
+	}
+#endif
+
+	if (handle->stamp_icon != NULL) {
+		if (handle->tex_icon == NULL) {
+			handle->tex_icon = cpstamp_texture (handle, handle->stamp_icon);
+		}
+		icon = handle->stamp_icon;
+		texture = handle->tex_icon;
+	} else {
+		g = cpstamp_stamp_image (stamp);
+		icon = handle->stamp_images[g];
+		texture = handle->tex_images[g];
+	}
+	
+	cpstamp_render_copy (&handle->stats, handle->renderer, texture, handle->anchor_x + cpstamp_scaled (handle, 18) + (cpstamp_scaled (handle, 73) - icon->w) / 2, y + cpstamp_scaled (handle, 6));
+	
+	SDL_RenderSetClipRect (handle->renderer, (clip.w > 0) ? &clip : NULL);
+}
+
+/* Dibuja la notificación con un SDL_Renderer. Las imágenes y los textos se suben
+ * como texturas y no hace falta guardar ni restaurar el fondo, porque con SDL 2
+ * las aplicaciones redibujan todo el cuadro */
+void CPStamp_DrawRenderer (CPStampHandle *handle, SDL_Renderer *renderer) {
+	CPStamp *stamp;
+	Uint64 start;
+	
+	if (handle == NULL || renderer == NULL) return;
+	cpstamp_saves_collect (handle);
+	CPStamp_CheckChanges (handle);
+	
+	if (!cpstamp_frame_ready (handle)) return;
+	
+	start = cpstamp_now_usec ();
+	
+	if (renderer != handle->renderer) {
+		/* Las texturas pertenecen al renderer anterior */
+		CPStamp_ReleaseRenderer (handle);
+		handle->renderer = renderer;
+	}
+	
+	stamp = cpstamp_frame_begin (handle);
+	
+	if (handle->stamp_timer >= 8 && handle->stamp_timer < 56) {
+		cpstamp_render_panel (handle, stamp, cpstamp_panel_offset (handle, handle->stamp_timer));
+		cpstamp_panel_rect (handle, &handle->update_rect);
+	} else {
+		handle->update_rect.x = handle->update_rect.y = 0;
+		handle->update_rect.w = handle->update_rect.h = 0;
+	}
+	
+	cpstamp_frame_end (handle, stamp);
+	
+	cpstamp_stats_draw (&handle->stats, cpstamp_now_usec () - start);
+}
+
+/* Libera las texturas. Se debe llamar antes de destruir el renderer */
+void CPStamp_ReleaseRenderer (CPStampHandle *handle) {
+	int g;
+	
+	if (handle == NULL) return;
+	
+	for (g = 0; g < NUM_IMGS; g++) {
+		cpstamp_destroy_texture (&handle->tex_images[g]);
+	}
+	
+	for (g = 0; g < 2; g++) {
+		cpstamp_destroy_texture (&handle->tex_earned[g]);
+		cpstamp_destroy_texture (&handle->tex_title[g]);
+		cpstamp_destroy_texture (&handle->tex_merged[g]);
+	}
+	
+	cpstamp_destroy_texture (&handle->tex_icon);
+	handle->renderer = NULL;
+}
+#endif
+
+/* Dibuja la notificación directo en la memoria de otro motor, sin copias.
+ * "clip" limita la zona a dibujar, NULL para todo el buffer. En "dirty" se
+ * regresa la zona que cambió, para subir sólo esos texels.
+ * Regresa TRUE si algo cambió, FALSE si no, o -1 si los parámetros son inválidos */
+int CPStamp_DrawBuffer (CPStampHandle *handle, void *pixels, int width, int height, int pitch, int format, const SDL_Rect *clip, SDL_Rect *dirty) {
+	SDL_Surface *surface;
+	SDL_Rect panel, cambio;
+	CPStamp *stamp;
+	Uint64 start;
+	int y, visible, changed;
+	
+	if (handle == NULL || pixels == NULL || width <= 0 || height <= 0) return -1;
+	cpstamp_saves_collect (handle);
+	CPStamp_CheckChanges (handle);
+	
+	if (dirty != NULL) {
+		dirty->x = dirty->y = 0;
+		dirty->w = dirty->h = 0;
+	}
+	
+	if (!cpstamp_frame_ready (handle)) return FALSE;
+	
+	/* La capa premultiplicada se trata como XRGB8888, los kernels de mezcla
+	 * dejan en el byte alto el alpha de la composición */
+	if (format == CPSTAMP_PIXELS_XRGB8888 || format == CPSTAMP_PIXELS_ARGB8888_PREMULTIPLIED) {
+		surface = SDL_CreateRGBSurfaceFrom (pixels, width, height, 32, pitch, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	} else if (format == CPSTAMP_PIXELS_RGB565) {
+		surface = SDL_CreateRGBSurfaceFrom (pixels, width, height, 16, pitch, 0xF800, 0x07E0, 0x001F, 0);
+	} else {
+		return -1;
+	}
+	
+	if (surface == NULL) return -1;
+	
+	if (clip != NULL) SDL_SetClipRect (surface, (SDL_Rect *) clip);
+	
+	start = cpstamp_now_usec ();
+	
+	stamp = cpstamp_frame_begin (handle);
+	
+	y = cpstamp_panel_offset (handle, handle->stamp_timer);
+	visible = (handle->stamp_timer >= 8 && handle->stamp_timer < 56);
+	changed = FALSE;
+	
+	if (format == CPSTAMP_PIXELS_ARGB8888_PREMULTIPLIED) {
+		/* La capa conserva lo dibujado, sólo se toca cuando el panel cambia */
+		if (handle->buffer_drawn && (!visible || handle->buffer_dirty || y != handle->buffer_y)) {
+			cpstamp_panel_rect (handle, &panel);
+			SDL_FillRect (surface, &panel, 0);
+			handle->buffer_drawn = FALSE;
+			changed = TRUE;
 		}
 		
-		if (temp < sizeof (buf) && temp > 0) { /* Leer solo si tenemos espacio */
-			res = read (fd, buf, temp * sizeof (char));
-			
-			if (buf[0] != 0) {
-				abierta->resource_dir = strdup (buf);
-			}
+		if (visible && !handle->buffer_drawn) {
+			handle->buffer_layer = surface;
+			cpstamp_draw_panel (handle, surface, stamp, y);
+			handle->buffer_layer = NULL;
+			handle->buffer_drawn = TRUE;
+			handle->buffer_dirty = FALSE;
+			handle->buffer_y = y;
+			changed = TRUE;
+		}
+	} else if (visible) {
+		cpstamp_draw_panel (handle, surface, stamp, y);
+		changed = TRUE;
+	}
+	
+	handle->update_rect.x = handle->update_rect.y = 0;
+	handle->update_rect.w = handle->update_rect.h = 0;
+	
+	if (changed) {
+		cpstamp_panel_rect (handle, &panel);
+		if (cpstamp_rect_intersect (&panel, &surface->clip_rect, &cambio)) {
+			handle->update_rect = cambio;
 		} else {
-			/* Brincar el nombre del directorio de recursos, de igual forma, no debería ser tan largo */
-			lseek (fd, temp, SEEK_CUR);
+			changed = FALSE;
 		}
 	}
 	
-	for (g = 0; g < n_stampas; g++) {
-		s = (CPStamp *) malloc (sizeof (CPStamp));
+	if (dirty != NULL) *dirty = handle->update_rect;
+	
+	cpstamp_frame_end (handle, stamp);
+	
+	cpstamp_stats_draw (&handle->stats, cpstamp_now_usec () - start);
+	
+	SDL_FreeSurface (surface);
+	
+	return changed;
+}
+
+/* En modo retenido la aplicación no vuelve a dibujar la zona del panel en cada
+ * cuadro. El fondo se captura una sola vez y los cuadros donde el panel está
+ * quieto no cuestan nada. La aplicación debe llamar a CPStamp_Invalidate por
+ * cada rectángulo de la pantalla que redibuje por completo.
+ * Sólo aplica cuando se llama a CPStamp_Draw con "save" */
+void CPStamp_SetRetained (CPStampHandle *handle, int retained) {
+	if (handle == NULL) return;
+	
+	if (retained && !handle->retained) {
+		/* Si el panel ya está en pantalla, save_screen tiene su fondo */
+		handle->background_valid = handle->panel_drawn = (handle->stamp_timer > 8);
+		handle->panel_dirty = TRUE;
+		handle->invalid_rect.w = handle->invalid_rect.h = 0;
+	}
+	
+	handle->retained = retained;
+}
+
+void CPStamp_Invalidate (CPStampHandle *handle, SDL_Rect *rect) {
+	int x1, y1, x2, y2;
+	
+	if (handle == NULL || !handle->retained) return;
+	
+	if (rect == NULL) {
+		/* Toda la pantalla, basta con cubrir el panel */
+		cpstamp_panel_rect (handle, &handle->invalid_rect);
+		return;
+	}
+	
+	if (rect->w == 0 || rect->h == 0) return;
+	
+	if (handle->invalid_rect.w == 0) {
+		handle->invalid_rect = *rect;
+		return;
+	}
+	
+	/* Unir con lo que ya estaba invalidado */
+	x1 = (rect->x < handle->invalid_rect.x) ? rect->x : handle->invalid_rect.x;
+	y1 = (rect->y < handle->invalid_rect.y) ? rect->y : handle->invalid_rect.y;
+	x2 = (rect->x + rect->w > handle->invalid_rect.x + handle->invalid_rect.w) ? rect->x + rect->w : handle->invalid_rect.x + handle->invalid_rect.w;
+	y2 = (rect->y + rect->h > handle->invalid_rect.y + handle->invalid_rect.h) ? rect->y + rect->h : handle->invalid_rect.y + handle->invalid_rect.h;
+	
+	handle->invalid_rect.x = x1;
+	handle->invalid_rect.y = y1;
+	handle->invalid_rect.w = x2 - x1;
+	handle->invalid_rect.h = y2 - y1;
+}
+
+void CPStamp_Restore (CPStampHandle *handle, SDL_Surface *screen) {
+	SDL_Rect rect;
+	
+	/* En modo retenido el panel se borra sólo cuando hace falta, dentro de CPStamp_Draw */
+	if (handle->retained) return;
+	
+	if (handle->stamp_timer > 8 && handle->stamp_timer <= 56) {
+		cpstamp_panel_rect (handle, &rect);
+		
+		cpstamp_blit (&handle->stats, handle->save_screen, NULL, screen, &rect);
+	}
+}
+
+/* Lector del archivo de estampas, todas las lecturas se validan contra el tamaño del buffer */
+typedef struct {
+	const char *data;
+	size_t len, pos;
+} CPStampReader;
+
+static int cpstamp_reader_u32 (CPStampReader *r, uint32_t *val) {
+	if (r->len - r->pos < sizeof (uint32_t)) return FALSE;
+	
+	memcpy (val, &r->data[r->pos], sizeof (uint32_t));
+	r->pos += sizeof (uint32_t);
+	
+	return TRUE;
+}
+
+/* Regresa una copia de los siguientes "len" bytes como cadena, o NULL si el archivo está cortado */
+static char *cpstamp_reader_string (CPStampReader *r, uint32_t len) {
+	char *str;
+	
+	if (r->len - r->pos < len) return NULL;
+	
+	str = (char *) malloc (len + 1);
+	if (str == NULL) return NULL;
+	
+	memcpy (str, &r->data[r->pos], len);
+	str[len] = 0; /* Fin de cadena */
+	r->pos += len;
+	
+	return str;
+}
+
+/* Leer una cadena del encabezado, NULL si está vacía. Regresa FALSE si el archivo está cortado */
+static int cpstamp_reader_header_string (CPStampReader *r, char **dest) {
+	uint32_t len;
+	char *str;
+	
+	if (!cpstamp_reader_u32 (r, &len)) return FALSE;
+	
+	if (len == 0) {
+		/* Las cadenas nulas se escribían con longitud 0 seguidas de un \0 */
+		if (r->pos < r->len) r->pos++;
+		return TRUE;
+	}
+	
+	str = cpstamp_reader_string (r, len);
+	if (str == NULL) return FALSE;
+	
+	if (str[0] != 0) {
+		*dest = str;
+	} else {
+		free (str);
+	}
+	
+	return TRUE;
+}
+
+/* Copia los siguientes "len" bytes a los textos de la tabla, sin el \0 final.
+ * Regresa FALSE si el archivo está cortado o no hay memoria */
+static int cpstamp_reader_text (CPStampReader *r, CPStampTable *table, uint32_t len, Uint32 *pos) {
+	uint32_t copia;
+	
+	if (r->len - r->pos < len) return FALSE;
+	
+	copia = len;
+	if (copia > 0 && r->data[r->pos + copia - 1] == 0) copia--;
+	
+	if (!cpstamp_table_add_text (table, &r->data[r->pos], copia, pos)) return FALSE;
+	r->pos += len;
+	
+	return TRUE;
+}
+
+/* Candado consultivo sobre todo el archivo, para que otro proceso no lo
+ * escriba mientras lo leemos o guardamos. Se suelta al cerrar el archivo.
+ * En Windows no hay candados */
+void cpstamp_lock_file (int fd, int exclusive) {
+#ifndef __MINGW32__
+	struct flock fl;
+	
+	if (fd < 0) return;
+	
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = exclusive ? F_WRLCK : F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0; /* Hasta el final, aunque crezca */
+	
+	while (fcntl (fd, F_SETLKW, &fl) < 0 && errno == EINTR);
+#endif
+}
+
+void cpstamp_unlock_file (int fd) {
+#ifndef __MINGW32__
+	struct flock fl;
+	
+	if (fd < 0) return;
+	
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	
+	fcntl (fd, F_SETLK, &fl);
+#endif
+}
+
+/* La carpeta .cpstamps del usuario, se crea la primera vez que se necesita */
+CPStampDir *cpstamp_user_dir (CPStampHandle *handle) {
+	if (handle->dir.path == NULL && cpstamp_dir_init (&handle->dir, handle->userdata_path) < 0) return NULL;
+	
+	return &handle->dir;
+}
+
+/* Leer el archivo completo en memoria, con la menor cantidad de llamadas al sistema.
+ * En "st" queda el estado del archivo que se leyó */
+char *cpstamp_read_file (int fd, struct stat *st, size_t *len, CPStampStats *stats) {
+	char *data;
+	size_t total;
+	ssize_t res;
+	
+	*len = 0;
+	memset (st, 0, sizeof (struct stat));
+	stats->read_syscalls++;
+	if (fstat (fd, st) < 0 || st->st_size <= 0) return NULL;
+	
+	data = (char *) malloc (st->st_size);
+	if (data == NULL) return NULL;
+	
+	total = 0;
+	while (total < (size_t) st->st_size) {
+		res = read (fd, &data[total], st->st_size - total);
+		stats->read_syscalls++;
 		
-		if (s == NULL) {
-			return abierta;
+		if (res < 0 && errno == EINTR) continue;
+		if (res <= 0) break; /* Lectura parcial, el lector valida contra lo leído */
+		
+		total += res;
+	}
+	
+	*len = total;
+	stats->read_bytes += total;
+	
+	return data;
+}
+
+/* Interpretar el contenido de un archivo de estampas.
+ * Regresa FALSE sólo si la versión no es conocida, un archivo cortado conserva lo que se pudo leer */
+static int cpstamp_parse (CPStampCategory *abierta, const char *data, size_t len) {
+	CPStampReader r;
+	uint32_t temp, version;
+	int g, s, n_stampas;
+	CPStampTable *t;
+	uint32_t reservar;
+	char *nombre;
+	
+	r.data = data;
+	r.len = len;
+	r.pos = 0;
+	
+	/* Leer el número de versión */
+	if (!cpstamp_reader_u32 (&r, &version)) {
+		/* El archivo no existe, así que se ignora y se crea la estructura */
+		return TRUE;
+	}
+	
+	/* Si la versión no es conocida, no abrir el archivo */
+	if (version > CPSTAMP_FILE_VERSION_CATALOG) {
+		return FALSE;
+	}
+	
+	abierta->read_version = version;
+	
+	/* Leer la cantidad de estampas */
+	if (!cpstamp_reader_u32 (&r, &temp)) {
+		/* Se llegó al fin de archivo, ignorar y retornar la estructura */
+		return TRUE;
+	}
+	
+	n_stampas = temp;
+	
+	if (version >= 1) {
+		/* Leer la categoria general, se conserva la que pidió el juego */
+		if (!cpstamp_reader_u32 (&r, &temp) || temp >= NUM_STAMP_TYPE) {
+			/* Ignorar, poner la categoría por default */
+			return TRUE;
 		}
-		s->sig = NULL;
-		s->category_struct = abierta;
-		s->descripcion = NULL;
 		
+		if (abierta->categoria < 0) abierta->categoria = temp;
+		
+		/* Leer el nombre de las estampas */
+		nombre = NULL;
+		if (!cpstamp_reader_header_string (&r, &nombre)) return TRUE;
+		if (nombre != NULL) abierta->nombre = nombre;
+		
+		/* Leer el dominio de traducción y el directorio de l10n */
+		if (!cpstamp_reader_header_string (&r, &abierta->l10n_domain)) return TRUE;
+		if (!cpstamp_reader_header_string (&r, &abierta->l10n_dir)) return TRUE;
+		
+		/* Activar el directorio de la locale */
+		if (abierta->l10n_domain != NULL && abierta->l10n_dir != NULL) {
+			bindtextdomain (abierta->l10n_domain, abierta->l10n_dir);
+		}
+		
+		/* Leer el nombre de directorio de recursos de estampas */
+		if (!cpstamp_reader_header_string (&r, &abierta->resource_dir)) return TRUE;
+	}
+	
+	/* Cada estampa ocupa al menos 21 bytes en el archivo, no creerle al
+	 * encabezado más estampas de las que caben */
+	t = &abierta->estampas;
+	reservar = (len - r.pos) / 21;
+	if ((uint32_t) n_stampas < reservar) reservar = n_stampas;
+	cpstamp_table_reserve (t, reservar, len - r.pos);
+	
+	for (g = 0; g < n_stampas; g++) {
 		/* Leer el id de la estampa */
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0) {
+		if (!cpstamp_reader_u32 (&r, &temp)) {
 			/* Error en la lectura del archivo, ignorar la estampa y salir */
-			free (s);
-			return abierta;
+			break;
 		}
 		
-		s->id = temp;
+		s = cpstamp_table_append (t, temp);
+		if (s < 0) break;
+		
+		/* Si algo falla, la estampa se descarta */
+		t->count--;
 		
-		temp = 0;
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res <= 0 || temp > 255 || temp == 0) {
+		if (!cpstamp_reader_u32 (&r, &temp) || temp > 255 || temp == 0) {
 			/* Error en la lectura del archivo, ignorar la estampa y salir 
 			 * o Cadena de texto demasiado larga */
-			free (s);
-			return abierta;
+			break;
 		}
 		
-		res = read (fd, buf, temp * sizeof (char));
-		
-		if (res < temp) {
-			/* Hemos leído menos bytes que los esperados */
-			free (s);
-			return abierta;
+		if (!cpstamp_reader_text (&r, t, temp, &t->titulos[s])) {
+			/* Hay menos bytes que los esperados */
+			break;
 		}
 		
-		buf[temp] = 0; /* Fin de cadena */
-		
-		s->titulo = strdup (buf);
-		
 		if (version >= 1) {
-			temp = 0;
-			res = read (fd, &temp, sizeof (uint32_t));
-			
-			if (res <= 0) {
+			if (!cpstamp_reader_u32 (&r, &temp) || !cpstamp_reader_text (&r, t, temp, &t->descripciones[s])) {
+				/* Error en la lectura, ignorar la estampa y salir */
+				break;
+			}
+		}
+		
+		if (version >= 2) {
+			if (!cpstamp_reader_u32 (&r, &temp) || !cpstamp_reader_text (&r, t, temp, &t->imagenes[s])) {
 				/* Error en la lectura, ignorar la estampa y salir */
-				free (s->titulo);
-				free (s);
-				return abierta;
+				break;
 			}
 			
-			if (temp < sizeof (buf) && temp > 0) {
-				res = read (fd, buf, temp * sizeof (char));
-				
-				if (res < temp) {
-					/* Hemos leido menos bytes que los esperados */
-					free (s->titulo);
-					free (s);
-					return abierta;
-				}
-				
-				buf[temp] = 0;
-				
-				s->descripcion = strdup (buf);
-			} else {
-				/* No tengo espacio para leer la descripción, es muy larga */
-				lseek (fd, temp, SEEK_CUR);
-				s->descripcion = strdup ("");
+			if (cpstamp_table_string (t, t->imagenes[s])[0] == 0) {
+				/* La estampa no tiene imagen propia */
+				t->imagenes[s] = 0;
 			}
 		}
 		
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res < 0 || temp >= NUM_STAMP_TYPE) {
+		if (!cpstamp_reader_u32 (&r, &temp) || temp >= NUM_STAMP_TYPE) {
 			/* Error de lectura 
 			 * o dato inválido */
-			free (s->titulo);
-			free (s->descripcion);
-			free (s);
-			return abierta;
+			break;
 		}
 		
-		s->categoria = temp;
+		t->categorias[s] = temp;
 		
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res < 0 || temp > STAMP_EXTREME) {
+		if (!cpstamp_reader_u32 (&r, &temp) || temp > STAMP_EXTREME) {
 			/* Error de lectura 
 			 * o dato inválido */
-			free (s->titulo);
-			free (s->descripcion);
-			free (s);
-			return abierta;
+			break;
 		}
 		
-		s->dificultad = temp;
+		t->dificultades[s] = temp;
 		
-		res = read (fd, &temp, sizeof (uint32_t));
-		if (res < 0) {
+		if (!cpstamp_reader_u32 (&r, &temp)) {
 			/* Error de lectura */
-			free (s->titulo);
-			free (s->descripcion);
-			free (s);
-			return abierta;
+			break;
 		}
 		
-		s->ganada = (temp != FALSE) ? TRUE : FALSE;
+		t->ganadas[s] = (temp != FALSE) ? TRUE : FALSE;
+		t->count++;
+	}
+	
+	/* Las estampas del catálogo del juego sólo guardan que se ganaron.
+	 * Los ids no se repiten con los de arriba, no hace falta buscarlos */
+	if (version >= CPSTAMP_FILE_VERSION_CATALOG && g == n_stampas && cpstamp_reader_u32 (&r, &temp)) {
+		n_stampas = temp;
+		
+		for (g = 0; g < n_stampas; g++) {
+			if (!cpstamp_reader_u32 (&r, &temp)) break;
+			
+			s = cpstamp_table_append (t, temp);
+			if (s < 0) break;
+			
+			t->ganadas[s] = TRUE;
+		}
+	}
+	
+	cpstamp_table_trim (t);
+	
+	return TRUE;
+}
+
+/* Libera lo que cpstamp_parse leyó en una categoría temporal */
+static void cpstamp_free_parsed (CPStampCategory *cat) {
+	cpstamp_table_free (&cat->estampas);
+	
+	free (cat->nombre);
+	free (cat->l10n_domain);
+	free (cat->l10n_dir);
+	free (cat->resource_dir);
+}
+
+/* Cuenta las estampas de la categoría por tipo y dificultad, para el índice */
+static void cpstamp_count_stamps (CPStampCategory *cat, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2]) {
+	CPStampTable *t = &cat->estampas;
+	int g;
+	
+	memset (counts, 0, sizeof (Uint32) * NUM_STAMP_TYPE * NUM_STAMP_DIFFICULTY * 2);
+	
+	for (g = 0; g < t->count; g++) {
+		if (t->categorias[g] >= NUM_STAMP_TYPE || t->dificultades[g] >= NUM_STAMP_DIFFICULTY) continue;
 		
-		if (g == 0) {
-			abierta->lista = s;
+		counts[t->categorias[g]][t->dificultades[g]][0]++;
+		counts[t->categorias[g]][t->dificultades[g]][1] += t->ganadas[g];
+	}
+}
+
+/* Guarda en la entrada del índice el resumen de una categoría y cómo estaban sus datos */
+static void cpstamp_index_fill (CPStampIndex *index, CPStampIndexEntry *entry, const char *nombre, int categoria, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2], CPStampRevision *rev) {
+	char *copia;
+	
+	copia = strdup ((nombre != NULL) ? nombre : "");
+	if (copia != NULL) {
+		free (entry->nombre);
+		entry->nombre = copia;
+	}
+	
+	entry->categoria = (categoria >= 0 && categoria < NUM_STAMP_TYPE) ? categoria : STAMP_TYPE_ACTIVITY;
+	memcpy (entry->counts, counts, sizeof (entry->counts));
+	entry->file_size = rev->size;
+	entry->file_mtime = rev->mtime;
+	entry->file_mtime_nsec = rev->mtime_nsec;
+	
+	index->dirty = TRUE;
+}
+
+/* Actualiza la entrada de la categoría que se acaba de guardar */
+static void cpstamp_index_store (CPStampDir *dir, CPStampCategory *cat, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2], CPStampRevision *rev, CPStampStats *stats) {
+	CPStampIndex index;
+	CPStampIndexEntry *entry;
+	
+	if (cpstamp_index_open (&index, dir, stats) < 0) return;
+	
+	entry = cpstamp_index_add (&index, cat->clave);
+	if (entry != NULL) {
+		cpstamp_index_fill (&index, entry, cat->nombre, cat->categoria, counts, rev);
+	}
+	
+	cpstamp_index_close (&index, stats);
+}
+
+/* Vuelve a leer una categoría que cambió sin actualizar el índice.
+ * No hace falta el candado, los datos se reemplazan completos al guardar
+ * y nunca se leen a medias */
+static CPStampIndexEntry *cpstamp_index_rescan (CPStampIndex *index, CPStampHandle *handle, const char *clave) {
+	CPStampCategory cat;
+	CPStampIndexEntry *entry;
+	Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2];
+	CPStampRevision rev;
+	char *data;
+	size_t len;
+	
+	if (handle->storage.load (handle->storage_data, clave, &data, &len, &rev, &handle->stats) < 0) return NULL;
+	
+	memset (&cat, 0, sizeof (cat));
+	cat.categoria = -1;
+	cat.read_version = CPSTAMP_FILE_VERSION;
+	
+	entry = NULL;
+	if (cpstamp_parse (&cat, data, len)) {
+		cpstamp_count_stamps (&cat, counts);
+		
+		entry = cpstamp_index_add (index, clave);
+		if (entry != NULL) {
+			cpstamp_index_fill (index, entry, cat.nombre, cat.categoria, counts, &rev);
+		}
+	}
+	
+	free (data);
+	cpstamp_free_parsed (&cat);
+	
+	return entry;
+}
+
+typedef struct {
+	CPStampHandle *handle;
+	CPStampIndex *index;
+} CPStampListing;
+
+/* Una categoría guardada: se usa su resumen del índice si sigue vigente */
+static void cpstamp_list_one (const char *clave, void *arg) {
+	CPStampListing *listing = (CPStampListing *) arg;
+	CPStampHandle *handle = listing->handle;
+	CPStampIndexEntry *entry;
+	CPStampRevision rev;
+	
+	entry = cpstamp_index_find (listing->index, clave);
+	
+	if (handle->storage.stat == NULL) {
+		/* Sin forma de saber si cambió, siempre se lee */
+		entry = cpstamp_index_rescan (listing->index, handle, clave);
+	} else if (handle->storage.stat (handle->storage_data, clave, &rev, &handle->stats) < 0) {
+		return;
+	} else if (entry == NULL || entry->file_size != rev.size || entry->file_mtime != rev.mtime || entry->file_mtime_nsec != rev.mtime_nsec) {
+		entry = cpstamp_index_rescan (listing->index, handle, clave);
+	}
+	
+	if (entry != NULL) entry->seen = TRUE;
+}
+
+/* ¿Las categorías están en la carpeta .cpstamps, en archivos o en la base
+ * de datos? Sólo entonces hay índice en disco */
+static int cpstamp_uses_files (CPStampHandle *handle) {
+	if (handle->storage.load == cpstamp_db_storage.load) return TRUE;
+	
+	return handle->storage.load == cpstamp_file_storage.load && handle->storage_data == handle;
+}
+
+/* El almacenamiento no se puede cambiar con categorías abiertas ni guardados pendientes */
+static int cpstamp_storage_busy (CPStampHandle *handle) {
+	cpstamp_saves_collect (handle);
+	
+	return handle->categorias != NULL || handle->saves_pending > 0;
+}
+
+/* Cambia dónde se guardan las categorías. "storage" se copia, "data" se
+ * entrega a cada una de sus funciones y se libera con su "destroy" al
+ * cambiar otra vez. Con NULL se regresa a los archivos de .cpstamps.
+ * Sólo se puede cambiar sin categorías abiertas ni guardados pendientes */
+int CPStamp_SetStorage (CPStampHandle *handle, const CPStampStorage *storage, void *data) {
+	if (handle == NULL) return -1;
+	
+	if (storage != NULL && (storage->load == NULL || storage->save == NULL || (storage->lock == NULL) != (storage->unlock == NULL))) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if (cpstamp_storage_busy (handle)) {
+		errno = EBUSY;
+		return -1;
+	}
+	
+	if (handle->storage.destroy != NULL) handle->storage.destroy (handle->storage_data);
+	
+	if (storage == NULL) {
+		handle->storage = cpstamp_file_storage;
+		handle->storage_data = handle;
+	} else {
+		handle->storage = *storage;
+		handle->storage_data = data;
+	}
+	
+	return 0;
+}
+
+int CPStamp_UseFileStorage (CPStampHandle *handle) {
+	return CPStamp_SetStorage (handle, NULL, NULL);
+}
+
+/* Las categorías sólo viven mientras dure el handle, para pruebas y demos */
+int CPStamp_UseMemoryStorage (CPStampHandle *handle) {
+	void *data;
+	int err;
+	
+	if (handle == NULL) return -1;
+	
+	data = cpstamp_memory_storage_new ();
+	if (data == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	if (CPStamp_SetStorage (handle, &cpstamp_memory_storage, data) < 0) {
+		err = errno;
+		cpstamp_memory_storage.destroy (data);
+		errno = err;
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Todas las categorías en un solo archivo de páginas, .cpstamps/.database.
+ * La primera vez pasan a él las categorías guardadas en archivos */
+int CPStamp_UseDatabaseStorage (CPStampHandle *handle) {
+	CPStampDir *dir;
+	CPStampDb *db;
+	int err;
+	
+	if (handle == NULL) return -1;
+	
+	/* Antes de migrar, para no dejar a los archivos sin sus categorías */
+	if (cpstamp_storage_busy (handle)) {
+		errno = EBUSY;
+		return -1;
+	}
+	
+	dir = cpstamp_user_dir (handle);
+	if (dir == NULL) return -1;
+	
+	db = cpstamp_db_open (dir, &handle->stats);
+	if (db == NULL) return -1;
+	
+	if (CPStamp_SetStorage (handle, &cpstamp_db_storage, db) < 0) {
+		err = errno;
+		cpstamp_db_storage.destroy (db);
+		errno = err;
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Regresa en "list" el resumen de todas las categorías del usuario, sin abrirlas.
+ * Los resúmenes vienen del índice, sólo se leen los archivos que cambiaron
+ * sin pasar por la librería. Regresa la cantidad de categorías o -1 si falla,
+ * o si el almacenamiento no puede listar sus categorías.
+ * La lista se libera con CPStamp_FreeCategories */
+int CPStamp_ListCategories (CPStampHandle *handle, CPStampSummary **list) {
+	CPStampIndex index;
+	CPStampIndexEntry *entry;
+	CPStampSummary *res;
+	CPStampListing listing;
+	CPStampDir *dir;
+	int g, t, d, count;
+	
+	if (list != NULL) *list = NULL;
+	if (handle == NULL || list == NULL || handle->storage.list == NULL) return -1;
+	
+	dir = NULL;
+	if (cpstamp_uses_files (handle)) {
+		dir = cpstamp_user_dir (handle);
+		if (dir == NULL) return -1;
+	}
+	
+	/* Si el índice no se puede abrir, se trabaja sólo en memoria */
+	cpstamp_index_open (&index, dir, &handle->stats);
+	
+	listing.handle = handle;
+	listing.index = &index;
+	
+	if (handle->storage.list (handle->storage_data, cpstamp_list_one, &listing, &handle->stats) < 0) {
+		cpstamp_index_close (&index, &handle->stats);
+		return -1;
+	}
+	
+	/* Olvidar las categorías cuyo archivo se borró */
+	g = 0;
+	while (g < index.count) {
+		if (!index.entries[g].seen) {
+			cpstamp_index_remove (&index, &index.entries[g]);
 		} else {
-			last->sig = s;
+			g++;
+		}
+	}
+	
+	count = index.count;
+	res = (CPStampSummary *) calloc ((count > 0) ? count : 1, sizeof (CPStampSummary));
+	
+	for (g = 0; g < count && res != NULL; g++) {
+		entry = &index.entries[g];
+		
+		res[g].clave = strdup (entry->clave);
+		res[g].nombre = strdup ((entry->nombre != NULL) ? entry->nombre : "");
+		res[g].type = entry->categoria;
+		
+		for (t = 0; t < NUM_STAMP_TYPE; t++) {
+			for (d = 0; d < NUM_STAMP_DIFFICULTY; d++) {
+				res[g].total_by_type[t] += entry->counts[t][d][0];
+				res[g].earned_by_type[t] += entry->counts[t][d][1];
+				res[g].total_by_difficulty[d] += entry->counts[t][d][0];
+				res[g].earned_by_difficulty[d] += entry->counts[t][d][1];
+			}
+			
+			res[g].total += res[g].total_by_type[t];
+			res[g].earned += res[g].earned_by_type[t];
 		}
 		
-		last = s;
+		if (res[g].clave == NULL || res[g].nombre == NULL) {
+			CPStamp_FreeCategories (res, g + 1);
+			res = NULL;
+		}
+	}
+	
+	cpstamp_index_close (&index, &handle->stats);
+	
+	if (res == NULL) return -1;
+	
+	*list = res;
+	
+	return count;
+}
+
+void CPStamp_FreeCategories (CPStampSummary *list, int count) {
+	int g;
+	
+	if (list == NULL) return;
+	
+	for (g = 0; g < count; g++) {
+		free (list[g].clave);
+		free (list[g].nombre);
+	}
+	
+	free (list);
+}
+
+/* Mezcla en la categoría lo que otro proceso guardó desde que la leímos:
+ * las estampas que registró y las que ganó. Nada se pierde, así que el
+ * siguiente guardado ya no tiene que mezclar. Regresa TRUE si la categoría
+ * cambió */
+static int cpstamp_reload (CPStampCategory *cat) {
+	CPStampHandle *handle = cat->handle;
+	CPStampCategory disco;
+	CPStampTable *t, *d;
+	CPStampRevision rev;
+	char *data;
+	size_t len;
+	int g, pos, res, leido, changed;
+	
+	/* La categoría no se pudo leer, no se mezcla ni se guarda */
+	if (cat->save_errno == EBADF) return FALSE;
+	
+	data = NULL;
+	len = 0;
+	leido = (handle->storage.stat == NULL);
+	if (leido) {
+		res = handle->storage.load (handle->storage_data, cat->clave, &data, &len, &rev, &handle->stats);
+	} else {
+		res = handle->storage.stat (handle->storage_data, cat->clave, &rev, &handle->stats);
+	}
+	if (res < 0) return FALSE;
+	
+	/* El hilo de guardado actualiza la revisión con el mutex */
+	if (handle->save_mutex != NULL) SDL_LockMutex (handle->save_mutex);
+	changed = !cpstamp_revision_equal (&cat->file_rev, &rev);
+	if (handle->save_mutex != NULL) SDL_UnlockMutex (handle->save_mutex);
+	
+	if (changed && !leido) {
+		if (handle->storage.load (handle->storage_data, cat->clave, &data, &len, &rev, &handle->stats) < 0) return FALSE;
+	}
+	
+	memset (&disco, 0, sizeof (disco));
+	disco.read_version = CPSTAMP_FILE_VERSION;
+	
+	if (!changed || !cpstamp_parse (&disco, data, len)) {
+		free (data);
+		cpstamp_free_parsed (&disco);
+		return FALSE;
+	}
+	free (data);
+	
+	cpstamp_save_unshare (cat);
+	t = &cat->estampas;
+	d = &disco.estampas;
+	
+	for (g = 0; g < d->count; g++) {
+		pos = cpstamp_table_find (t, d->ids[g]);
+		if (pos < 0) {
+			pos = cpstamp_table_append (t, d->ids[g]);
+			if (pos < 0) continue;
+			
+			cpstamp_table_set_text (t, &t->titulos[pos], cpstamp_table_string (d, d->titulos[g]));
+			cpstamp_table_set_text (t, &t->descripciones[pos], cpstamp_table_string (d, d->descripciones[g]));
+			cpstamp_table_set_text (t, &t->imagenes[pos], cpstamp_table_string (d, d->imagenes[g]));
+			t->categorias[pos] = d->categorias[g];
+			t->dificultades[pos] = d->dificultades[g];
+		}
+		
+		if (d->ganadas[g] && !t->ganadas[pos]) {
+			t->ganadas[pos] = TRUE;
+			if (cat->live != NULL) cpstamp_live_earn (cat->live, pos);
+		}
+	}
+	
+	if (cat->live != NULL) cpstamp_live_update (cat->live, t);
+	cpstamp_free_parsed (&disco);
+	
+	if (handle->save_mutex != NULL) SDL_LockMutex (handle->save_mutex);
+	cat->file_rev = rev;
+	if (handle->save_mutex != NULL) SDL_UnlockMutex (handle->save_mutex);
+	
+	handle->stats.reloads++;
+	cpstamp_emit (handle, CPSTAMP_EVENT_RELOADED, cat, cat->clave, -1, 0);
+	
+	return TRUE;
+}
+
+/* Marca las categorías abiertas que guarda el archivo "name" */
+static void cpstamp_watch_mark (const char *name, void *arg) {
+	CPStampHandle *handle = (CPStampHandle *) arg;
+	CPStampCategory *cat;
+	
+	for (cat = handle->categorias; cat != NULL; cat = cat->sig) {
+		if (name == NULL || strcmp (name, CPSTAMP_DB_FILE) == 0 || strcmp (name, cat->clave) == 0) {
+			cat->watch_pending = TRUE;
+		}
+	}
+}
+
+/* Vigila la carpeta .cpstamps para mezclar en las categorías abiertas lo
+ * que guarden otros procesos, ver CPSTAMP_EVENT_RELOADED. Los cambios se
+ * revisan al dibujar y en CPStamp_CheckChanges. Regresa un descriptor para
+ * esperar cambios con select o poll, o -1 si falla */
+int CPStamp_WatchChanges (CPStampHandle *handle, int enable) {
+	CPStampDir *dir;
+	
+	if (handle == NULL) return -1;
+	
+	if (!enable) {
+		if (handle->watch_fd >= 0) close (handle->watch_fd);
+		handle->watch_fd = -1;
+		return 0;
+	}
+	
+	if (handle->watch_fd >= 0) return handle->watch_fd;
+	
+	/* Otros almacenamientos no tienen archivos que vigilar */
+	if (!cpstamp_uses_files (handle)) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	dir = cpstamp_user_dir (handle);
+	if (dir == NULL) return -1;
+	
+	handle->watch_fd = cpstamp_watch_open (dir->path);
+	
+	return handle->watch_fd;
+}
+
+/* Mezcla los cambios que avisó la vigilancia. Regresa cuántas categorías cambiaron */
+int CPStamp_CheckChanges (CPStampHandle *handle) {
+	CPStampCategory *cat;
+	int n;
+	
+	if (handle == NULL || handle->watch_fd < 0 || !cpstamp_uses_files (handle)) return 0;
+	
+	if (cpstamp_watch_read (handle->watch_fd, cpstamp_watch_mark, handle) == 0) return 0;
+	
+	n = 0;
+	while (TRUE) {
+		/* El aviso de cada recarga puede cerrar cualquier categoría,
+		 * así que la siguiente se busca otra vez desde el principio */
+		cat = handle->categorias;
+		while (cat != NULL && !cat->watch_pending) cat = cat->sig;
+		
+		if (cat == NULL) break;
+		
+		cat->watch_pending = FALSE;
+		n += cpstamp_reload (cat);
+	}
+	
+	return n;
+}
+
+CPStampCategory *CPStamp_Open (CPStampHandle *handle, int tipo, char *nombre, char *clave) {
+	CPStampCategory *abierta;
+	CPStampRevision rev;
+	char *data;
+	size_t len;
+	int ok, res, err;
+	Uint64 start;
+	
+	if (handle == NULL) return NULL;
+	
+	/* La clave es el nombre del archivo dentro de la carpeta .cpstamps */
+	if (!cpstamp_dir_valid_name (clave)) {
+		cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, NULL, clave, -1, EINVAL);
+		return NULL;
+	}
+	
+	start = cpstamp_now_usec ();
+	
+	if (cpstamp_uses_files (handle) && cpstamp_user_dir (handle) == NULL) {
+		cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, NULL, clave, -1, errno);
+		return NULL;
+	}
+	
+	/* Leer todos los datos de una vez e interpretarlos en memoria. No hace
+	 * falta el candado, al guardar se reemplazan completos */
+	data = NULL;
+	len = 0;
+	res = handle->storage.load (handle->storage_data, clave, &data, &len, &rev, &handle->stats);
+	err = errno;
+	
+	if (res < 0) {
+		if (err == ENOENT) {
+			cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, NULL, clave, -1, err);
+			return NULL;
+		}
+		errno = err;
+		perror (_("Failed to open Stamps File"));
+		
+		free (data);
+		data = NULL;
+		len = 0;
+		memset (&rev, 0, sizeof (rev));
+	}
+	
+	abierta = (CPStampCategory *) malloc (sizeof (CPStampCategory));
+	
+	if (abierta == NULL) {
+		free (data);
+		cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, NULL, clave, -1, ENOMEM);
+		return NULL;
+	}
+	
+	abierta->nombre = nombre;
+	abierta->clave = strdup (clave);
+	abierta->categoria = tipo;
+	abierta->save_errno = (res < 0) ? EBADF : 0; /* No se guardará */
+	abierta->pending_save = NULL;
+	cpstamp_table_init (&abierta->estampas);
+	abierta->l10n_domain = NULL;
+	abierta->l10n_dir = NULL;
+	abierta->l10n_serial = 0;
+	abierta->resource_dir = NULL;
+	abierta->handle = handle;
+	abierta->read_version = CPSTAMP_FILE_VERSION;
+	
+	abierta->file_rev = rev;
+	abierta->live = NULL;
+	abierta->watch_pending = FALSE;
+	ok = cpstamp_parse (abierta, data, len);
+	free (data);
+	
+	if (!ok) {
+		free (abierta->clave);
+		free (abierta);
+		cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, NULL, clave, -1, EINVAL);
+		return NULL;
+	}
+	
+	/* Agregar a la lista de categorías abiertas */
+	abierta->sig = handle->categorias;
+	handle->categorias = abierta;
+	
+	handle->stats.opens++;
+	handle->stats.last_load_time_us = cpstamp_now_usec () - start;
+	handle->stats.load_time_us += handle->stats.last_load_time_us;
+	
+	if (res < 0) {
+		/* La categoría funciona, pero no se guardará */
+		cpstamp_emit (handle, CPSTAMP_EVENT_LOAD_FAILED, abierta, clave, -1, EBADF);
 	}
 	
 	return abierta;
@@ -737,6 +2181,18 @@ void CPStamp_SetLocale (CPStampCategory *cat, char *domain, char *localedir) {
 	if (cat->l10n_domain != NULL && cat->l10n_dir != NULL) {
 		bindtextdomain (cat->l10n_domain, cat->l10n_dir);
 	}
+	
+	/* Invalidar las traducciones guardadas de esta categoría */
+	cat->l10n_serial++;
+	
+	/* El idioma pudo cambiar, volver a renderizar "Estampa ganada" */
+	if (cat->handle != NULL) {
+#ifdef HAVE_SDL_TTF
+		cpstamp_render_earned_text (cat->handle);
+#endif
+		cat->handle->panel_dirty = TRUE;
+		cat->handle->buffer_dirty = TRUE;
+	}
 }
 
 void CPStamp_SetResourceDir (CPStampCategory *cat, char *resource_dir) {
@@ -751,204 +2207,712 @@ void CPStamp_SetResourceDir (CPStampCategory *cat, char *resource_dir) {
 }
 
 void CPStamp_Register (CPStampCategory *cat, int id, char *titulo, char *descripcion, char *imagen, int categoria, int dificultad) {
-	CPStamp *s, **t;
+	CPStampTable *t;
+	int g;
+	
 	if (cat == NULL) return;
-	s = NULL;
-	if (cat->read_version == 0) {
-		/* Si la versión leida es 0, buscar y actualizar la estampa, porque aún no tiene descripción */
-		s = cat->lista;
-		
-		while (s != NULL) {
-			if (s->id == id) {
-				/* Encontrada */
-				free (s->titulo);
-				free (s->descripcion);
-				break;
-			}
-			
-			s = s->sig;
-		}
-	}
 	
-	if (s == NULL) {
-		s = (CPStamp *) malloc (sizeof (CPStamp));
-		if (s == NULL) return;
-		s->sig = NULL;
+	/* Las estampas del catálogo no cambian */
+	if (cat->estampas.catalogo != NULL && cpstamp_catalog_find (cat->estampas.catalogo, id) >= 0) return;
 	
-		t = &(cat->lista);
-		while (*t != NULL) t = &((*t)->sig);
+	cpstamp_save_unshare (cat);
+	t = &cat->estampas;
+	g = -1;
+	if (cat->read_version < CPSTAMP_FILE_VERSION) {
+		/* Si la versión leida es anterior, buscar y actualizar la estampa, porque aún no tiene descripción o imagen */
+		g = cpstamp_table_find (t, id);
+	}
 	
-		*t = s;
-		
-		s->ganada = FALSE;
+	if (g < 0) {
+		g = cpstamp_table_append (t, id);
+		if (g < 0) return;
 	}
 	
-	s->id = id;
-	s->titulo = strdup (titulo);
-	s->descripcion = strdup (descripcion);
-	s->categoria = categoria;
-	s->dificultad = dificultad;
+	/* Los textos iguales a los que ya tenía no se vuelven a copiar */
+	cpstamp_table_set_text (t, &t->titulos[g], titulo);
+	cpstamp_table_set_text (t, &t->descripciones[g], descripcion);
+	cpstamp_table_set_text (t, &t->imagenes[g], (imagen != NULL && imagen[0] != 0) ? imagen : NULL);
+	t->categorias[g] = categoria;
+	t->dificultades[g] = dificultad;
+	
+	if (t->l10n != NULL) t->l10n[g * 2] = t->l10n[g * 2 + 1] = NULL;
 	
-	s->category_struct = cat;
+	if (cat->live != NULL) cpstamp_live_update (cat->live, t);
 }
 
 int CPStamp_IsRegistered (CPStampCategory *cat, int id) {
-	CPStamp *local;
+	int g;
 	
 	if (cat == NULL) return FALSE;
-	local = cat->lista;
 	
-	while (local != NULL) {
-		if (local->id == id) {
-			if (cat->read_version == 0) {
-				/* Mentiré diciendo que "No está registrada" para re-leer la descripción */
-				return FALSE;
-			}
-			return TRUE;
-		}
-		
-		local = local->sig;
+	g = cpstamp_table_find (&cat->estampas, id);
+	if (g < 0) return FALSE;
+	
+	if (cat->read_version < CPSTAMP_FILE_VERSION && !cpstamp_table_fixed (&cat->estampas, g)) {
+		/* Mentiré diciendo que "No está registrada" para re-leer la descripción y la imagen */
+		return FALSE;
 	}
 	
-	return FALSE;
+	return TRUE;
 }
 
-void CPStamp_Close (CPStampCategory *cat) {
-	uint32_t temp;
-	int g;
-	CPStamp *s, *last;
-	char buf;
+/* Acumulador para armar el archivo en memoria, con data NULL sólo mide */
+typedef struct {
+	char *data;
+	size_t len;
+} CPStampBuffer;
+
+static void cpstamp_put (CPStampBuffer *b, const void *data, size_t len) {
+	if (b->data != NULL) memcpy (&b->data[b->len], data, len);
+	b->len += len;
+}
+
+static void cpstamp_put_u32 (CPStampBuffer *b, uint32_t value) {
+	cpstamp_put (b, &value, sizeof (uint32_t));
+}
+
+/* Las cadenas incluyen su \0 en la longitud, NULL se guarda como cadena vacía */
+static void cpstamp_put_string (CPStampBuffer *b, const char *str) {
+	if (str == NULL) str = "";
 	
-	if (cat == NULL) return;
+	cpstamp_put_u32 (b, strlen (str) + 1);
+	cpstamp_put (b, str, strlen (str) + 1);
+}
+
+/* Suma la estampa "g" al resumen del índice */
+static void cpstamp_count_stamp (CPStampTable *t, int g, int ganada, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2]) {
+	if (t->categorias[g] >= NUM_STAMP_TYPE || t->dificultades[g] >= NUM_STAMP_DIFFICULTY) return;
+	
+	counts[t->categorias[g]][t->dificultades[g]][0]++;
+	if (ganada) counts[t->categorias[g]][t->dificultades[g]][1]++;
+}
+
+static void cpstamp_put_stamp (CPStampBuffer *b, CPStampTable *t, int g, int ganada, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2]) {
+	cpstamp_put_u32 (b, t->ids[g]);
+	cpstamp_put_string (b, cpstamp_table_title (t, g));
+	cpstamp_put_string (b, cpstamp_table_description (t, g));
+	cpstamp_put_string (b, cpstamp_table_image (t, g));
+	cpstamp_put_u32 (b, t->categorias[g]);
+	cpstamp_put_u32 (b, t->dificultades[g]);
+	cpstamp_put_u32 (b, ganada);
+	
+	cpstamp_count_stamp (t, g, ganada, counts);
+}
+
+/* ¿La estampa "g" está ganada aquí o en lo que guardó otro proceso? */
+static int cpstamp_merged_earned (CPStampTable *estampas, CPStampTable *disco, int g) {
+	int otra;
 	
-	/* Rebobinar la posición del archivo */
-	lseek (cat->fd, 0, SEEK_SET);
-	ftruncate (cat->fd, 0);
+	if (estampas->ganadas[g]) return TRUE;
 	
-	/* Contar las estampas */
-	s = cat->lista;
+	otra = (disco->count > 0) ? cpstamp_table_find (disco, estampas->ids[g]) : -1;
 	
-	g = 0;
-	while (s != NULL) {
-		g++;
-		s = s->sig;
+	return otra >= 0 && disco->ganadas[otra];
+}
+
+/* ¿La estampa "g" se guarda completa, o sólo en la lista de ganadas? */
+static int cpstamp_stamp_defined (CPStampTable *t, int g) {
+	return !cpstamp_table_fixed (t, g) && t->titulos[g] != 0;
+}
+
+/* Con catálogo, sus estampas ya las define el juego y de ellas sólo se
+ * guarda cuáles se ganaron, en una lista al final. Las demás se guardan
+ * completas, menos las que llegaron sin textos en otra lista */
+static void cpstamp_serialize_catalog (CPStampBuffer *b, CPStampCategory *cat, CPStampTable *estampas, CPStampTable *disco, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2]) {
+	uint32_t n, ganadas;
+	int g, ganada;
+	
+	n = ganadas = 0;
+	for (g = 0; g < estampas->count; g++) {
+		if (cpstamp_stamp_defined (estampas, g)) {
+			n++;
+		} else if (cpstamp_merged_earned (estampas, disco, g)) {
+			ganadas++;
+		}
 	}
 	
-	temp = 1; /* Versión del archivo */
-	write (cat->fd, &temp, sizeof (uint32_t));
+	for (g = 0; g < disco->count; g++) {
+		if (cpstamp_table_find (estampas, disco->ids[g]) >= 0) continue;
+		
+		if (cpstamp_stamp_defined (disco, g)) {
+			n++;
+		} else if (disco->ganadas[g]) {
+			ganadas++;
+		}
+	}
 	
-	temp = g; /* Número de estampas */
-	write (cat->fd, &temp, sizeof (uint32_t));
+	cpstamp_put_u32 (b, CPSTAMP_FILE_VERSION_CATALOG);
+	cpstamp_put_u32 (b, n);
+	cpstamp_put_u32 (b, cat->categoria);
+	cpstamp_put_string (b, cat->nombre);
+	cpstamp_put_string (b, cat->l10n_domain);
+	cpstamp_put_string (b, cat->l10n_dir);
+	cpstamp_put_string (b, cat->resource_dir);
 	
-	/* Categoria general */
-	temp = cat->categoria;
-	write (cat->fd, &temp, sizeof (uint32_t));
+	for (g = 0; g < estampas->count; g++) {
+		if (cpstamp_stamp_defined (estampas, g)) cpstamp_put_stamp (b, estampas, g, cpstamp_merged_earned (estampas, disco, g), counts);
+	}
 	
-	/* Nombre */
-	if (cat->nombre != NULL) {
-		temp = strlen (cat->nombre) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
-		
-		write (cat->fd, cat->nombre, temp * sizeof (char));
-	} else {
-		temp = 0;
-		
-		write (cat->fd, &temp, sizeof (uint32_t));
-		buf = 0;
-		write (cat->fd, &buf, 1);
+	for (g = 0; g < disco->count; g++) {
+		if (cpstamp_stamp_defined (disco, g) && cpstamp_table_find (estampas, disco->ids[g]) < 0) cpstamp_put_stamp (b, disco, g, disco->ganadas[g], counts);
 	}
 	
-	/* Dominio de traducción */
-	if (cat->l10n_domain != NULL) {
-		temp = strlen (cat->l10n_domain) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
-		
-		write (cat->fd, cat->l10n_domain, temp * sizeof (char));
-	} else {
-		temp = 0;
+	cpstamp_put_u32 (b, ganadas);
+	for (g = 0; g < estampas->count; g++) {
+		if (cpstamp_stamp_defined (estampas, g)) continue;
 		
-		write (cat->fd, &temp, sizeof (uint32_t));
-		buf = 0;
-		write (cat->fd, &buf, 1);
+		ganada = cpstamp_merged_earned (estampas, disco, g);
+		if (ganada) cpstamp_put_u32 (b, estampas->ids[g]);
+		cpstamp_count_stamp (estampas, g, ganada, counts);
 	}
 	
-	/* Directorio de locale */
-	if (cat->l10n_dir != NULL) {
-		temp = strlen (cat->l10n_dir) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
+	for (g = 0; g < disco->count; g++) {
+		if (cpstamp_stamp_defined (disco, g) || !disco->ganadas[g] || cpstamp_table_find (estampas, disco->ids[g]) >= 0) continue;
 		
-		write (cat->fd, cat->l10n_dir, temp * sizeof (char));
+		cpstamp_put_u32 (b, disco->ids[g]);
+		cpstamp_count_stamp (disco, g, TRUE, counts);
+	}
+}
+
+/* Arma el archivo de la categoría con sus estampas mezcladas con las que otro
+ * proceso guardó en "disco": las ganadas allá quedan ganadas y las que registró
+ * se agregan al final. En "counts" queda el resumen para el índice */
+static void cpstamp_serialize (CPStampBuffer *b, CPStampCategory *cat, CPStampTable *estampas, CPStampTable *disco, Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2]) {
+	uint32_t n;
+	int g;
+	
+	memset (counts, 0, sizeof (Uint32) * NUM_STAMP_TYPE * NUM_STAMP_DIFFICULTY * 2);
+	
+	if (estampas->catalogo != NULL) {
+		cpstamp_serialize_catalog (b, cat, estampas, disco, counts);
+		return;
+	}
+	
+	n = estampas->count;
+	for (g = 0; g < disco->count; g++) {
+		if (cpstamp_table_find (estampas, disco->ids[g]) < 0) n++;
+	}
+	
+	cpstamp_put_u32 (b, CPSTAMP_FILE_VERSION);
+	cpstamp_put_u32 (b, n);
+	cpstamp_put_u32 (b, cat->categoria);
+	cpstamp_put_string (b, cat->nombre);
+	cpstamp_put_string (b, cat->l10n_domain);
+	cpstamp_put_string (b, cat->l10n_dir);
+	cpstamp_put_string (b, cat->resource_dir);
+	
+	for (g = 0; g < estampas->count; g++) {
+		cpstamp_put_stamp (b, estampas, g, cpstamp_merged_earned (estampas, disco, g), counts);
+	}
+	
+	for (g = 0; g < disco->count; g++) {
+		if (cpstamp_table_find (estampas, disco->ids[g]) < 0) cpstamp_put_stamp (b, disco, g, disco->ganadas[g], counts);
+	}
+}
+
+static char *cpstamp_strdup_null (const char *str) {
+	return (str != NULL) ? strdup (str) : NULL;
+}
+
+/* Prepara el guardado de la categoría. Al cerrarla, el guardado se queda
+ * con la categoría completa, si no, copia su encabezado y comparte sus estampas */
+static CPStampSave *cpstamp_save_new (CPStampCategory *cat, int closing) {
+	CPStampSave *save;
+	CPStampCategory *copia;
+	
+	save = (CPStampSave *) calloc (1, sizeof (CPStampSave));
+	if (save == NULL) return NULL;
+	
+	save->closing = closing;
+	save->owner = cat;
+	save->estampas = &cat->estampas;
+	
+	if (closing) {
+		save->cat = cat;
+		save->owns_table = TRUE;
 	} else {
-		temp = 0;
+		copia = &save->copia;
+		copia->clave = strdup (cat->clave);
+		copia->nombre = cpstamp_strdup_null (cat->nombre);
+		copia->l10n_domain = cpstamp_strdup_null (cat->l10n_domain);
+		copia->l10n_dir = cpstamp_strdup_null (cat->l10n_dir);
+		copia->resource_dir = cpstamp_strdup_null (cat->resource_dir);
+		copia->categoria = cat->categoria;
+		copia->handle = cat->handle;
+		save->cat = copia;
 		
-		write (cat->fd, &temp, sizeof (uint32_t));
-		buf = 0;
-		write (cat->fd, &buf, 1);
+		if (copia->clave == NULL || (cat->nombre != NULL && copia->nombre == NULL) ||
+		    (cat->l10n_domain != NULL && copia->l10n_domain == NULL) || (cat->l10n_dir != NULL && copia->l10n_dir == NULL) ||
+		    (cat->resource_dir != NULL && copia->resource_dir == NULL)) {
+			cpstamp_free_parsed (copia);
+			free (copia->clave);
+			free (save);
+			return NULL;
+		}
 	}
 	
-	/* Directorio de recursos */
-	if (cat->resource_dir != NULL) {
-		temp = strlen (cat->resource_dir) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
-		
-		write (cat->fd, cat->resource_dir, temp * sizeof (char));
+	/* El hilo no toca el handle, se lleva su almacenamiento */
+	save->storage = cat->handle->storage;
+	save->storage_data = cat->handle->storage_data;
+	
+	save->error = cat->save_errno;
+	if (save->error == 0 && cpstamp_uses_files (cat->handle)) {
+		save->dir = cpstamp_user_dir (cat->handle);
+		if (save->dir == NULL) save->error = errno;
+	}
+	
+	save->ticket = ++cat->handle->save_tickets;
+	
+	return save;
+}
+
+/* Escribe la categoría. Corre en el hilo de guardado, así que sólo
+ * toca el guardado y su almacenamiento, nunca el handle */
+static void cpstamp_save_run (CPStampSave *save) {
+	CPStampCategory disco;
+	CPStampBuffer b;
+	SDL_mutex *mutex;
+	Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2];
+	CPStampRevision rev;
+	char *data;
+	size_t len;
+	int res, changed, mezclado;
+	
+	mutex = save->cat->handle->save_mutex;
+	
+	/* La categoría no se pudo leer o la carpeta no existe, nada que escribir */
+	if (save->error != 0) {
+		if (mutex != NULL) SDL_LockMutex (mutex);
+		save->serialized = TRUE;
+		if (mutex != NULL) SDL_UnlockMutex (mutex);
+		return;
+	}
+	
+	memset (&disco, 0, sizeof (disco));
+	disco.read_version = CPSTAMP_FILE_VERSION;
+	
+	/* Nadie más guarda hasta que reemplacemos los datos. Si otro proceso los
+	 * guardó desde que los leímos, mezclar sus cambios */
+	if (save->storage.lock != NULL && save->storage.lock (save->storage_data, &save->stats) < 0) {
+		save->error = errno;
+		if (mutex != NULL) SDL_LockMutex (mutex);
+		save->serialized = TRUE;
+		if (mutex != NULL) SDL_UnlockMutex (mutex);
+		return;
+	}
+	
+	/* Sin "stat" hay que leer los datos para conocer su revisión */
+	data = NULL;
+	len = 0;
+	if (save->storage.stat != NULL) {
+		res = save->storage.stat (save->storage_data, save->cat->clave, &rev, &save->stats);
 	} else {
-		temp = 0;
-		
-		write (cat->fd, &temp, sizeof (uint32_t));
-		buf = 0;
-		write (cat->fd, &buf, 1);
+		res = save->storage.load (save->storage_data, save->cat->clave, &data, &len, &rev, &save->stats);
+	}
+	
+	/* Cómo quedaron los datos la última vez que los leímos o guardamos, lo
+	 * actualiza este mismo hilo al terminar cada guardado */
+	changed = FALSE;
+	if (res == 0) {
+		if (mutex != NULL) SDL_LockMutex (mutex);
+		changed = !cpstamp_revision_equal (&save->owner->file_rev, &rev);
+		if (mutex != NULL) SDL_UnlockMutex (mutex);
+	}
+	
+	if (changed && save->storage.stat != NULL) {
+		res = save->storage.load (save->storage_data, save->cat->clave, &data, &len, &rev, &save->stats);
+		if (res < 0) changed = FALSE;
+	}
+	
+	/* Si el otro proceso usa una versión más nueva, no hay nada que podamos mezclar */
+	if (changed && !cpstamp_parse (&disco, data, len)) {
+		cpstamp_free_parsed (&disco);
+		memset (&disco, 0, sizeof (disco));
+	}
+	free (data);
+	
+	/* Armar los datos completos en memoria. Mientras tanto la categoría
+	 * espera para cambiar sus estampas, ver cpstamp_save_unshare */
+	if (mutex != NULL) SDL_LockMutex (mutex);
+	
+	b.data = NULL;
+	b.len = 0;
+	cpstamp_serialize (&b, save->cat, save->estampas, &disco.estampas, counts);
+	
+	len = b.len;
+	b.data = (char *) malloc (len);
+	if (b.data != NULL) {
+		b.len = 0;
+		cpstamp_serialize (&b, save->cat, save->estampas, &disco.estampas, counts);
+	}
+	
+	save->serialized = TRUE;
+	if (mutex != NULL) SDL_UnlockMutex (mutex);
+	
+	mezclado = (disco.estampas.count > 0);
+	cpstamp_free_parsed (&disco);
+	
+	if (b.data == NULL) {
+		save->error = ENOMEM;
+	} else if (save->storage.save (save->storage_data, save->cat->clave, b.data, len, &rev, &save->stats) < 0) {
+		save->error = errno;
+	}
+	
+	free (b.data);
+	
+	/* El siguiente guardado no tiene que mezclar lo que acabamos de escribir.
+	 * Si se mezclaron estampas de otro proceso, la categoría no las tiene
+	 * y se deben volver a mezclar */
+	if (save->error == 0 && !mezclado) {
+		if (mutex != NULL) SDL_LockMutex (mutex);
+		save->owner->file_rev = rev;
+		if (mutex != NULL) SDL_UnlockMutex (mutex);
+	}
+	
+	if (save->storage.unlock != NULL) save->storage.unlock (save->storage_data, &save->stats);
+	
+	/* El índice se actualiza después de soltar el candado de la carpeta */
+	if (save->error == 0 && save->dir != NULL) {
+		cpstamp_index_store (save->dir, save->cat, counts, &rev, &save->stats);
 	}
+}
+
+/* Termina un guardado en el hilo principal: estadísticas, aviso y memoria */
+static void cpstamp_save_finish (CPStampHandle *handle, CPStampSave *save) {
+	CPStampCategory *cat;
+	
+	handle->stats.saves++;
+	handle->stats.read_syscalls += save->stats.read_syscalls;
+	handle->stats.read_bytes += save->stats.read_bytes;
+	handle->stats.write_syscalls += save->stats.write_syscalls;
+	handle->stats.written_bytes += save->stats.written_bytes;
 	
-	s = cat->lista;
-	while (s != NULL) {
-		temp = s->id;
-		write (cat->fd, &temp, sizeof (uint32_t));
+	if (save->owns_table) cpstamp_table_free (save->estampas);
+	
+	if (save->closing) {
+		cat = save->cat;
 		
-		/* Escribir el título */
-		temp = strlen (s->titulo) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
+		/* La categoría sigue siendo válida durante el aviso, pero ya sin estampas */
+		cpstamp_emit (handle, CPSTAMP_EVENT_SAVED, cat, cat->clave, -1, save->error);
 		
-		write (cat->fd, s->titulo, temp * sizeof (char));
+		free (cat->clave);
+		free (cat);
+	} else {
+		if (save->owner->pending_save == save) save->owner->pending_save = NULL;
 		
-		free (s->titulo);
+		cpstamp_emit (handle, CPSTAMP_EVENT_SAVED, save->owner, save->owner->clave, -1, save->error);
 		
-		/* Escribir la descripción */
-		temp = strlen (s->descripcion) + 1;
-		write (cat->fd, &temp, sizeof (uint32_t));
+		cpstamp_free_parsed (&save->copia);
+		free (save->copia.clave);
+	}
+	
+	free (save);
+}
+
+static void cpstamp_save_append (CPStampSave **lista, CPStampSave *save) {
+	while (*lista != NULL) lista = &(*lista)->sig;
+	
+	save->sig = NULL;
+	*lista = save;
+}
+
+/* El hilo de guardado atiende la cola en orden y nunca termina, el handle
+ * vive lo mismo que el programa. Ver CPStamp_WaitSaves */
+static int cpstamp_save_thread (void *data) {
+	CPStampHandle *handle = (CPStampHandle *) data;
+	CPStampSave *save;
+	
+	SDL_LockMutex (handle->save_mutex);
+	
+	for (;;) {
+		while (handle->save_queue == NULL) {
+			SDL_CondWait (handle->save_cond, handle->save_mutex);
+		}
 		
-		write (cat->fd, s->descripcion, temp * sizeof (char));
+		save = handle->save_queue;
+		handle->save_queue = save->sig;
 		
-		free (s->descripcion);
+		SDL_UnlockMutex (handle->save_mutex);
+		cpstamp_save_run (save);
+		SDL_LockMutex (handle->save_mutex);
 		
-		temp = s->categoria;
-		write (cat->fd, &temp, sizeof (uint32_t));
+		cpstamp_save_append (&handle->save_done, save);
+		handle->save_ran = save->ticket;
+		SDL_CondBroadcast (handle->save_done_cond);
+	}
+	
+	return 0;
+}
+
+/* Entrega el guardado al hilo, o lo hace aquí mismo si no hay hilo */
+static void cpstamp_save_submit (CPStampHandle *handle, CPStampSave *save, int background) {
+	handle->saves_pending++;
+	
+	if (background && handle->save_thread == NULL && handle->save_mutex != NULL && handle->save_cond != NULL && handle->save_done_cond != NULL) {
+		handle->save_thread = cpstamp_create_thread (cpstamp_save_thread, "cpstamp-save", handle);
+	}
+	
+	if (handle->save_thread == NULL) {
+		cpstamp_save_run (save);
 		
-		temp = s->dificultad;
-		write (cat->fd, &temp, sizeof (uint32_t));
+		cpstamp_save_append (&handle->save_done, save);
+		handle->save_ran = save->ticket;
+		return;
+	}
+	
+	/* Hasta que el hilo lea las estampas, la categoría debe copiarlas antes de cambiarlas */
+	if (!save->closing) save->owner->pending_save = save;
+	
+	SDL_LockMutex (handle->save_mutex);
+	cpstamp_save_append (&handle->save_queue, save);
+	SDL_CondSignal (handle->save_cond);
+	SDL_UnlockMutex (handle->save_mutex);
+}
+
+/* Avisa de los guardados que ya terminaron, en el orden en que se pidieron */
+void cpstamp_saves_collect (CPStampHandle *handle) {
+	CPStampSave *done, *sig;
+	
+	if (handle->saves_pending == 0) return;
+	
+	if (handle->save_mutex != NULL) SDL_LockMutex (handle->save_mutex);
+	done = handle->save_done;
+	handle->save_done = NULL;
+	if (handle->save_mutex != NULL) SDL_UnlockMutex (handle->save_mutex);
+	
+	for (; done != NULL; done = sig) {
+		sig = done->sig;
 		
-		temp = s->ganada;
-		write (cat->fd, &temp, sizeof (uint32_t));
-		last = s;
-		s = s->sig;
+		handle->saves_pending--;
+		handle->save_collected = done->ticket;
+		cpstamp_save_finish (handle, done);
+	}
+}
+
+static void cpstamp_saves_wait (CPStampHandle *handle, int ticket) {
+	if (handle->save_thread != NULL) {
+		SDL_LockMutex (handle->save_mutex);
+		while (handle->save_ran < ticket) {
+			SDL_CondWait (handle->save_done_cond, handle->save_mutex);
+		}
+		SDL_UnlockMutex (handle->save_mutex);
+	}
+	
+	cpstamp_saves_collect (handle);
+}
+
+/* Se llama antes de modificar las estampas de la categoría. Si un guardado
+ * pendiente todavía no las lee, se le entrega una copia de como estaban */
+void cpstamp_save_unshare (CPStampCategory *cat) {
+	CPStampSave *save;
+	int ok;
+	
+	save = cat->pending_save;
+	if (save == NULL) return;
+	
+	cat->pending_save = NULL;
+	
+	SDL_LockMutex (cat->handle->save_mutex);
+	ok = TRUE;
+	if (!save->serialized) {
+		ok = cpstamp_table_copy (&save->copia_estampas, save->estampas);
+		if (ok) {
+			save->estampas = &save->copia_estampas;
+			save->owns_table = TRUE;
+		}
+	}
+	SDL_UnlockMutex (cat->handle->save_mutex);
+	
+	/* Sin memoria para la copia, esperar a que el guardado termine */
+	if (!ok) cpstamp_saves_wait (cat->handle, save->ticket);
+}
+
+/* Guarda la categoría en segundo plano y la deja abierta. Lo que se escribe
+ * es la categoría como está ahora, aunque cambie mientras se guarda.
+ * Regresa el número de guardado para CPStamp_IsSaved, o -1 si falla */
+int CPStamp_SaveAsync (CPStampCategory *cat) {
+	CPStampSave *save;
+	int serialized, ticket;
+	
+	if (cat == NULL) return -1;
+	
+	/* El guardado pendiente todavía no lee las estampas, escribirá lo mismo */
+	if (cat->pending_save != NULL) {
+		SDL_LockMutex (cat->handle->save_mutex);
+		serialized = cat->pending_save->serialized;
+		SDL_UnlockMutex (cat->handle->save_mutex);
 		
-		free (last);
+		if (!serialized) return cat->pending_save->ticket;
 	}
 	
-	close (cat->fd);
-	free (cat);
+	save = cpstamp_save_new (cat, FALSE);
+	if (save == NULL) return -1;
+	
+	ticket = save->ticket;
+	cpstamp_save_submit (cat->handle, save, TRUE);
+	
+	return ticket;
 }
 
-void CPStamp_ClearStamps (CPStampCategory *cat) {
-	CPStamp *s;
+/* Cierra la categoría y la guarda en segundo plano. La categoría ya no se
+ * puede usar, pero es válida en el aviso de CPSTAMP_EVENT_SAVED.
+ * Regresa -1 si falla, y entonces la categoría sigue abierta */
+int CPStamp_CloseAsync (CPStampCategory *cat) {
+	CPStampSave *save;
+	CPStampCategory **c;
+	int ticket;
+	
+	if (cat == NULL) return -1;
+	
+	save = cpstamp_save_new (cat, TRUE);
+	if (save == NULL) return -1;
+	
+	/* Quitar de la lista de categorías abiertas */
+	for (c = &cat->handle->categorias; *c != NULL; c = &(*c)->sig) {
+		if (*c == cat) {
+			*c = cat->sig;
+			break;
+		}
+	}
+	
+	if (cat->live != NULL) {
+		cpstamp_live_destroy (cat->live);
+		cat->live = NULL;
+	}
+	
+	ticket = save->ticket;
+	cpstamp_save_submit (cat->handle, save, TRUE);
+	
+	return ticket;
+}
+
+/* ¿Ya terminó el guardado? Los avisos de los guardados en segundo plano
+ * se entregan aquí, en CPStamp_WaitSaves y al dibujar */
+int CPStamp_IsSaved (CPStampHandle *handle, int ticket) {
+	if (handle == NULL || ticket <= 0 || ticket > handle->save_tickets) return -1;
+	
+	cpstamp_saves_collect (handle);
+	
+	return ticket <= handle->save_collected;
+}
+
+/* Espera a que terminen todos los guardados, antes de salir del programa */
+void CPStamp_WaitSaves (CPStampHandle *handle) {
+	if (handle == NULL) return;
+	
+	cpstamp_saves_wait (handle, handle->save_tickets);
+}
+
+void CPStamp_Close (CPStampCategory *cat) {
+	CPStampHandle *handle;
+	CPStampSave *save;
+	CPStampCategory **c;
+	int ticket;
 	
 	if (cat == NULL) return;
-	s = cat->lista;
 	
-	while (s != NULL) {
-		s->ganada = FALSE;
-		s = s->sig;
+	save = cpstamp_save_new (cat, TRUE);
+	
+	/* Quitar de la lista de categorías abiertas */
+	for (c = &cat->handle->categorias; *c != NULL; c = &(*c)->sig) {
+		if (*c == cat) {
+			*c = cat->sig;
+			break;
+		}
+	}
+	
+	if (cat->live != NULL) {
+		cpstamp_live_destroy (cat->live);
+		cat->live = NULL;
+	}
+	
+	if (save == NULL) {
+		cpstamp_table_free (&cat->estampas);
+		
+		cpstamp_emit (cat->handle, CPSTAMP_EVENT_SAVED, cat, cat->clave, -1, ENOMEM);
+		
+		free (cat->clave);
+		free (cat);
+		return;
+	}
+	
+	/* Si el hilo de guardado existe, se espera detrás de los guardados pendientes */
+	handle = cat->handle;
+	ticket = save->ticket;
+	cpstamp_save_submit (handle, save, FALSE);
+	cpstamp_saves_wait (handle, ticket);
+}
+
+const char *CPStamp_GetTitle (CPStampCategory *cat, int id) {
+	CPStamp s;
+	
+	if (cat == NULL) return NULL;
+	
+	s.cat = cat;
+	s.pos = cpstamp_table_find (&cat->estampas, id);
+	if (s.pos < 0) return NULL;
+	
+	return cpstamp_l10n_title (&s);
+}
+
+const char *CPStamp_GetDescription (CPStampCategory *cat, int id) {
+	CPStamp s;
+	
+	if (cat == NULL) return NULL;
+	
+	s.cat = cat;
+	s.pos = cpstamp_table_find (&cat->estampas, id);
+	if (s.pos < 0) return NULL;
+	
+	return cpstamp_l10n_description (&s);
+}
+
+/* Usa un catálogo generado con cpstamp-catalog para las estampas de la
+ * categoría, en lugar de registrarlas. Sus textos no se copian, el catálogo
+ * debe existir mientras la categoría esté abierta, y el archivo sólo guarda
+ * cuáles de sus estampas se ganaron. Se llama después de CPStamp_Open, los
+ * títulos que se consultaron antes dejan de valer. Regresa -1 si falla */
+int CPStamp_AttachCatalog (CPStampCategory *cat, const CPStampCatalog *catalog) {
+	CPStampHandle *handle;
+	int g;
+	
+	if (cat == NULL) return -1;
+	
+	if (!cpstamp_catalog_valid (catalog)) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if (cat->estampas.catalogo == catalog) return 0;
+	
+	/* Las estampas cambian de lugar, no puede haber notificaciones pendientes */
+	handle = cat->handle;
+	for (g = handle->stamp_queue_start; g != handle->stamp_queue_end; g = (g + 1) % 10) {
+		if (handle->stamp_queue[g].cat == cat) break;
+	}
+	
+	if (cat->estampas.catalogo != NULL || g != handle->stamp_queue_end) {
+		errno = EBUSY;
+		return -1;
+	}
+	
+	cpstamp_save_unshare (cat);
+	if (!cpstamp_table_attach (&cat->estampas, catalog)) {
+		errno = ENOMEM;
+		return -1;
 	}
+	
+	if (cat->live != NULL) cpstamp_live_fill (cat->live, &cat->estampas);
+	
+	return 0;
+}
+
+void CPStamp_ClearStamps (CPStampCategory *cat) {
+	if (cat == NULL) return;
+	cpstamp_save_unshare (cat);
+	
+	if (cat->estampas.count > 0) memset (cat->estampas.ganadas, FALSE, cat->estampas.count * sizeof (Uint8));
+	if (cat->live != NULL) cpstamp_live_fill (cat->live, &cat->estampas);
 }
 
 SDL_Rect CPStamp_GetUpdateRect (CPStampHandle *handle) {
@@ -959,12 +2923,72 @@ int CPStamp_IsActive (CPStampHandle *handle) {
 	return handle->activate;
 }
 
-void CPStamp_WithSound (CPStampHandle *handle, int sound) {
-	if (sound && handle->stamp_sound_earn != NULL) {
-		/* Pidieron sonido, revisar si pude cargar el archivo de sonido */
-		handle->use_sound = TRUE;
-	} else {
-		/* O no pidieron sonido, o de todas formas no pude cargar el archivo de sonido */
-		handle->use_sound = FALSE;
+void CPStamp_SetIconCacheSize (CPStampHandle *handle, int bytes) {
+	if (handle == NULL) return;
+	
+	cpstamp_icon_cache_set_size (handle->icon_cache, bytes);
+}
+
+/* Libera las imágenes, la tipografía y el sonido después de "ms" milisegundos
+ * sin notificaciones, se vuelven a cargar con la siguiente estampa ganada.
+ * La revisión ocurre al dibujar. 0 los conserva siempre, es el valor por defecto */
+void CPStamp_SetIdleUnload (CPStampHandle *handle, int ms) {
+	if (handle == NULL) return;
+	
+	handle->idle_unload = (ms > 0) ? (Uint32) ms : 0;
+}
+
+/* Coloca la esquina superior izquierda del panel en "x", "y" y lo escala a
+ * "scale" por ciento, de 25 a 400. Por defecto 392, 0 y 100, el diseño para
+ * pantallas de 640 de ancho. Las imágenes y los textos se escalan una sola vez
+ * por escala, no en cada cuadro. El cambio se aplica con la siguiente notificación.
+ * Regresa 0, o -1 con errno en EINVAL si la escala está fuera de rango */
+int CPStamp_SetLayout (CPStampHandle *handle, int x, int y, int scale) {
+	if (handle == NULL || scale < 25 || scale > 400) {
+		errno = EINVAL;
+		return -1;
 	}
+	
+	handle->next_anchor_x = x;
+	handle->next_anchor_y = y;
+	handle->next_scale = scale;
+	
+	return 0;
+}
+
+/* Registra la función que se llama cuando ocurre "event". NULL la desactiva */
+void CPStamp_SetCallback (CPStampHandle *handle, int event, CPStampCallback callback, void *data) {
+	if (handle == NULL || event < 0 || event >= NUM_CPSTAMP_EVENTS) return;
+	
+	handle->callbacks[event] = callback;
+	handle->callbacks_data[event] = data;
+}
+
+/* Envía un SDL_USEREVENT con este código cada vez que se encola una notificación.
+ * data1 es la categoría y data2 el id de la estampa. Un código negativo lo desactiva */
+void CPStamp_SetUserEvent (CPStampHandle *handle, int code) {
+	if (handle == NULL) return;
+	
+	handle->user_event = code;
+}
+
+/* Con CPSTAMP_COALESCE_MERGE, las estampas que se ganan antes de que aparezca
+ * el panel se muestran juntas. "max_latency" es la cantidad máxima de llamadas
+ * a CPStamp_Draw que una notificación espera antes de aparecer, también con
+ * CPSTAMP_COALESCE_NONE. Los paneles anteriores salen antes de tiempo para que
+ * se cumpla. Una notificación necesita al menos 19 cuadros desde que aparece
+ * hasta que aparece la siguiente, así que la n-ésima en espera aparece al menos
+ * 19 * n cuadros después que el panel actual. Si "max_latency" no alcanza para
+ * eso, se muestra lo antes posible. 0 no limita la espera.
+ * Con las dos opciones la cola se vacía en un tiempo acotado */
+void CPStamp_SetCoalescing (CPStampHandle *handle, int policy, int max_latency) {
+	if (handle == NULL || policy < 0 || policy >= NUM_CPSTAMP_COALESCE) return;
+	
+	handle->coalesce = policy;
+	handle->max_latency = (max_latency > 0) ? max_latency : 0;
+}
+
+/* El sonido sólo se reproduce si además se pudo cargar el archivo */
+void CPStamp_WithSound (CPStampHandle *handle, int sound) {
+	handle->use_sound = (sound != 0);
 }
@@ -21,6 +21,8 @@
 #ifndef __CP_STAMP_H__
 #define __CP_STAMP_H__
 
+#include <stdio.h>
+
 #include <SDL.h>
 
 #ifndef FALSE
@@ -45,11 +47,185 @@ enum {
 	STAMP_EASY = 0,
 	STAMP_NORMAL,
 	STAMP_HARD,
-	STAMP_EXTREME
+	STAMP_EXTREME,
+	
+	NUM_STAMP_DIFFICULTY
 };
 
 typedef struct _CPStampCategory CPStampCategory;
 typedef struct _CPStampHandle CPStampHandle;
+typedef struct _CPStampLive CPStampLive;
+
+/* Eventos que la librería notifica a las aplicaciones */
+enum {
+	CPSTAMP_EVENT_EARNED = 0,
+	CPSTAMP_EVENT_NOTIFICATION_START,
+	CPSTAMP_EVENT_NOTIFICATION_END,
+	CPSTAMP_EVENT_SAVED,
+	CPSTAMP_EVENT_LOAD_FAILED,
+	
+	/* Otro proceso guardó la categoría y se mezcló, ver CPStamp_WatchChanges */
+	CPSTAMP_EVENT_RELOADED,
+	
+	NUM_CPSTAMP_EVENTS
+};
+
+typedef struct {
+	int type;
+	
+	/* NULL si la categoría no se pudo abrir */
+	CPStampCategory *cat;
+	const char *clave;
+	
+	/* La estampa, o -1 en los eventos de la categoría */
+	int id;
+	
+	/* El errno de la operación que falló, 0 si todo salió bien */
+	int error;
+} CPStampEvent;
+
+typedef void (*CPStampCallback) (CPStampHandle *handle, const CPStampEvent *event, void *data);
+
+/* Qué hacer con las estampas que se ganan juntas */
+enum {
+	/* Una notificación completa por estampa */
+	CPSTAMP_COALESCE_NONE = 0,
+	
+	/* Las estampas que llegan antes de que aparezca el panel
+	 * se muestran en uno solo, "N estampas ganadas" */
+	CPSTAMP_COALESCE_MERGE,
+	
+	NUM_CPSTAMP_COALESCE
+};
+
+/* Resumen de una categoría, ver CPStamp_ListCategories */
+typedef struct {
+	char *clave;
+	char *nombre;
+	int type;
+	
+	int total, earned;
+	int total_by_type[NUM_STAMP_TYPE], earned_by_type[NUM_STAMP_TYPE];
+	int total_by_difficulty[NUM_STAMP_DIFFICULTY], earned_by_difficulty[NUM_STAMP_DIFFICULTY];
+} CPStampSummary;
+
+/* Formatos de pixel para CPStamp_DrawBuffer */
+enum {
+	/* Cuadro opaco que la aplicación redibuja completo cada vez */
+	CPSTAMP_PIXELS_XRGB8888 = 0,
+	CPSTAMP_PIXELS_RGB565,
+	
+	/* Capa transparente que sólo contiene la notificación, con alpha
+	 * premultiplicado. La librería borra lo que dibujó antes */
+	CPSTAMP_PIXELS_ARGB8888_PREMULTIPLIED,
+	
+	NUM_CPSTAMP_PIXELS
+};
+
+/* Cubetas del histograma de dibujado. Los límites superiores son
+ * 50, 100, 250, 500, 1000, 2500, 5000 y 10000 microsegundos,
+ * la última cubeta cuenta los dibujados más lentos */
+#define CPSTAMP_DRAW_BUCKETS 9
+
+typedef struct {
+	/* Dibujado, sólo cuenta las llamadas con una notificación en pantalla */
+	Uint32 draw_calls;
+	Uint64 draw_time_us;
+	Uint32 draw_histogram[CPSTAMP_DRAW_BUCKETS];
+	Uint32 blits;
+	Uint64 blit_pixels;
+	
+	/* Cola de notificaciones */
+	int queue_depth;
+	int queue_max_depth;
+	Uint32 notifications;
+	Uint32 dropped;
+	
+	/* Archivos de estampas */
+	Uint32 opens;
+	Uint32 saves;
+	Uint64 read_bytes;
+	Uint64 written_bytes;
+	Uint32 read_syscalls;
+	Uint32 write_syscalls;
+	Uint64 load_time_us;
+	Uint32 last_load_time_us;
+	Uint32 reloads;
+	
+	/* Imágenes, tipografía y sonido, ver CPStamp_SetIdleUnload */
+	Uint32 asset_loads;
+	Uint32 asset_unloads;
+	Uint32 asset_memory;
+	
+	/* Memoria de las categorías abiertas */
+	int categories;
+	Uint32 category_memory;
+} CPStampStats;
+
+/* Cómo están guardados los datos de una categoría. Si cambia entre dos
+ * lecturas, otro proceso los escribió. El almacenamiento decide qué poner
+ * en cada campo, la librería sólo los compara */
+typedef struct {
+	Uint64 id;
+	Sint64 size;
+	Sint64 mtime;
+	Uint32 mtime_nsec;
+} CPStampRevision;
+
+/* Una estampa de un catálogo fijo, ver CPStamp_AttachCatalog */
+typedef struct {
+	int id;
+	const char *titulo;
+	const char *descripcion;
+	const char *imagen;
+	Uint8 categoria;
+	Uint8 dificultad;
+} CPStampCatalogEntry;
+
+#define CPSTAMP_CATALOG_VERSION 1
+
+/* Catálogo de estampas en datos de sólo lectura, lo genera cpstamp-catalog.
+ * Las estampas están en el lugar que les da el hash perfecto de su id,
+ * "hash" tiene hash_size cubetas, ver cpstamp_catalog_find */
+typedef struct {
+	int version;
+	int count;
+	const CPStampCatalogEntry *entries;
+	
+	int hash_size;
+	const Sint32 *hash;
+} CPStampCatalog;
+
+/* Almacenamiento de las categorías, ver CPStamp_SetStorage. Las funciones
+ * regresan 0, o -1 con errno, y pueden sumar en "stats" sus llamadas al
+ * sistema y los bytes que leen y escriben. Se llaman desde el hilo
+ * principal y desde el hilo de guardado al mismo tiempo.
+ * Las funciones opcionales pueden ser NULL */
+typedef struct {
+	/* Lee los datos de la categoría en un buffer de malloc, o NULL si todavía
+	 * no tiene nada guardado. Si falla con ENOENT la categoría no se abre,
+	 * con otro error se abre vacía pero no se guardará */
+	int (*load) (void *data, const char *clave, char **buf, size_t *len, CPStampRevision *rev, CPStampStats *stats);
+	
+	/* Reemplaza los datos completos. Quien lea ve los anteriores o los nuevos, nunca una mezcla */
+	int (*save) (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats);
+	
+	/* Opcional: agrega al final de los datos guardados */
+	int (*append) (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats);
+	
+	/* Opcional: la revisión sin leer los datos. Sin ella, cada guardado lee los datos */
+	int (*stat) (void *data, const char *clave, CPStampRevision *rev, CPStampStats *stats);
+	
+	/* Opcional: candado exclusivo entre procesos, mientras se leen, mezclan y guardan los datos */
+	int (*lock) (void *data, CPStampStats *stats);
+	void (*unlock) (void *data, CPStampStats *stats);
+	
+	/* Opcional: llama a "fn" con la clave de cada categoría guardada, para CPStamp_ListCategories */
+	int (*list) (void *data, void (*fn) (const char *clave, void *arg), void *arg, CPStampStats *stats);
+	
+	/* Opcional: libera "data" al cambiar de almacenamiento */
+	void (*destroy) (void *data);
+} CPStampStorage;
 
 CPStampHandle *CPStamp_Init (int argc, char **argv);
 
@@ -57,19 +233,62 @@ CPStampCategory *CPStamp_Open (CPStampHandle *handle, int tipo, char *nombre, ch
 void CPStamp_SetLocale (CPStampCategory *cat, char *domain, char *localedir);
 void CPStamp_SetResourceDir (CPStampCategory *cat, char *resource_dir);
 void CPStamp_Close (CPStampCategory *cat);
+int CPStamp_SaveAsync (CPStampCategory *cat);
+int CPStamp_CloseAsync (CPStampCategory *cat);
+int CPStamp_IsSaved (CPStampHandle *handle, int ticket);
+void CPStamp_WaitSaves (CPStampHandle *handle);
 
 void CPStamp_Register (CPStampCategory *cat, int id, char *titulo, char *descripcion, char *imagen, int categoria, int dificultad);
 int CPStamp_IsRegistered (CPStampCategory *cat, int id);
+const char *CPStamp_GetTitle (CPStampCategory *cat, int id);
+const char *CPStamp_GetDescription (CPStampCategory *cat, int id);
 void CPStamp_Earn (CPStampHandle *handle, CPStampCategory *cat, int id);
 
 void CPStamp_Restore (CPStampHandle *handle, SDL_Surface *screen);
 void CPStamp_Draw (CPStampHandle *handle, SDL_Surface *screen, int save);
+#if SDL_VERSION_ATLEAST (2, 0, 0)
+void CPStamp_DrawRenderer (CPStampHandle *handle, SDL_Renderer *renderer);
+void CPStamp_ReleaseRenderer (CPStampHandle *handle);
+#endif
+void CPStamp_SetRetained (CPStampHandle *handle, int retained);
+void CPStamp_Invalidate (CPStampHandle *handle, SDL_Rect *rect);
+int CPStamp_DrawBuffer (CPStampHandle *handle, void *pixels, int width, int height, int pitch, int format, const SDL_Rect *clip, SDL_Rect *dirty);
 
 void CPStamp_ClearStamps (CPStampCategory *cat);
+int CPStamp_AttachCatalog (CPStampCategory *cat, const CPStampCatalog *catalog);
+
+int CPStamp_SetStorage (CPStampHandle *handle, const CPStampStorage *storage, void *data);
+int CPStamp_UseFileStorage (CPStampHandle *handle);
+int CPStamp_UseMemoryStorage (CPStampHandle *handle);
+int CPStamp_UseDatabaseStorage (CPStampHandle *handle);
+
+int CPStamp_ListCategories (CPStampHandle *handle, CPStampSummary **list);
+void CPStamp_FreeCategories (CPStampSummary *list, int count);
+
+int CPStamp_WatchChanges (CPStampHandle *handle, int enable);
+int CPStamp_CheckChanges (CPStampHandle *handle);
 
 SDL_Rect CPStamp_GetUpdateRect (CPStampHandle *handle);
 int CPStamp_IsActive (CPStampHandle *handle);
 void CPStamp_WithSound (CPStampHandle *handle, int sound);
+void CPStamp_SetIconCacheSize (CPStampHandle *handle, int bytes);
+void CPStamp_SetIdleUnload (CPStampHandle *handle, int ms);
+int CPStamp_SetLayout (CPStampHandle *handle, int x, int y, int scale);
+
+void CPStamp_SetCallback (CPStampHandle *handle, int event, CPStampCallback callback, void *data);
+void CPStamp_SetUserEvent (CPStampHandle *handle, int code);
+void CPStamp_SetCoalescing (CPStampHandle *handle, int policy, int max_latency);
+
+void CPStamp_GetStats (CPStampHandle *handle, CPStampStats *stats);
+int CPStamp_FormatStats (CPStampHandle *handle, char *buf, int len);
+int CPStamp_WriteStats (CPStampHandle *handle, FILE *f);
+
+int CPStamp_ShareCategory (CPStampCategory *cat);
+CPStampLive *CPStamp_LiveOpen (const char *clave);
+void CPStamp_LiveClose (CPStampLive *live);
+Uint32 CPStamp_LiveGeneration (CPStampLive *live);
+int CPStamp_LiveIsEarned (CPStampLive *live, int id);
+int CPStamp_LiveEarned (CPStampLive *live, int *ids, int max);
 
 #endif /* __CP_STAMP_H__ */
 
@@ -0,0 +1,263 @@
+/*
+ * cpstamp_private.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Estructuras internas de la librería, compartidas entre sus módulos */
+
+#ifndef __CP_STAMP_PRIVATE_H__
+#define __CP_STAMP_PRIVATE_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <SDL.h>
+
+#ifdef HAVE_SDL_MIXER
+#include <SDL_mixer.h>
+#endif
+
+#include "cpstamp.h"
+#include "compat.h"
+#include "icons.h"
+#include "text.h"
+#include "dir.h"
+#include "table.h"
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef TRUE
+#define TRUE !FALSE
+#endif
+
+/* Lista de imágenes para cargar */
+enum {
+	IMG_STAMP_PANEL,
+	
+	IMG_STAMP_GAME_EASY,
+	IMG_STAMP_GAME_NORMAL,
+	IMG_STAMP_GAME_HARD,
+	IMG_STAMP_GAME_EXTREME,
+	
+	NUM_IMGS
+};
+
+/* Versión del archivo de estampas que escribimos */
+#define CPSTAMP_FILE_VERSION 2
+
+/* Versión que escribimos para las categorías con catálogo. Después de las
+ * estampas completas va la cantidad y los ids de las ganadas del catálogo */
+#define CPSTAMP_FILE_VERSION_CATALOG 3
+
+/* Una estampa: su categoría y su lugar en la tabla de la categoría.
+ * Las estampas nunca se quitan de la tabla, así que el lugar no cambia */
+typedef struct {
+	CPStampCategory *cat;
+	int pos;
+} CPStamp;
+
+struct _CPStampCategory {
+	char *nombre;
+	char *clave;
+	int categoria;
+	
+	CPStampTable estampas;
+	int read_version;
+	
+	char *l10n_domain;
+	char *l10n_dir;
+	int l10n_serial;
+	
+	char *resource_dir;
+	
+	CPStampHandle *handle;
+	int save_errno;
+	
+	/* Guardado en segundo plano que todavía usa "estampas", ver cpstamp_save_unshare */
+	struct _CPStampSave *pending_save;
+	
+	/* Cómo estaban los datos cuando los leímos, para saber si otro proceso los cambió */
+	CPStampRevision file_rev;
+	
+	/* Estado en memoria compartida, ver CPStamp_ShareCategory */
+	CPStampLive *live;
+	
+	/* La vigilancia avisó que otro proceso guardó, ver CPStamp_CheckChanges */
+	int watch_pending;
+	
+	/* Siguiente categoría abierta del mismo handle */
+	struct _CPStampCategory *sig;
+};
+
+/* Un guardado de categoría, en el hilo de guardado o en el que cierra la categoría */
+typedef struct _CPStampSave {
+	int ticket;
+	int closing;
+	
+	/* La categoría que se guarda. Al cerrarla se usa la misma, si no,
+	 * una copia de su encabezado en "copia" */
+	CPStampCategory *cat;
+	CPStampCategory copia;
+	CPStampCategory *owner;
+	
+	/* Las estampas a escribir. Son las de la categoría mientras el hilo no
+	 * las lea, si la categoría cambia antes se le entrega una copia */
+	CPStampTable *estampas;
+	CPStampTable copia_estampas;
+	int owns_table;
+	int serialized;
+	
+	/* Dónde se guarda. "dir" sólo si es el almacenamiento de archivos */
+	CPStampStorage storage;
+	void *storage_data;
+	CPStampDir *dir;
+	int error;
+	
+	/* Llamadas al sistema del hilo, se suman al handle al terminar */
+	CPStampStats stats;
+	
+	struct _CPStampSave *sig;
+} CPStampSave;
+
+struct _CPStampHandle {
+	/* Paquete de imágenes */
+	SDL_Surface *stamp_images [NUM_IMGS];
+	SDL_Surface *save_screen;
+	SDL_Surface *earned_text[2];
+	
+	/* Imágenes propias de cada estampa */
+	CPStampIconCache *icon_cache;
+	SDL_Surface *stamp_icon;
+
+#ifdef HAVE_SDL_TTF
+	/* Para renderizar los nombres de las estampas */
+	TTF_Font *font;
+	CPStampGlyphCache *glyphs;
+#endif
+
+	/* Sonido */
+	int use_sound;
+#ifdef HAVE_SDL_MIXER
+	Mix_Chunk *stamp_sound_earn;
+#endif
+
+	/* Las imágenes, la tipografía y el sonido se liberan tras "idle_unload"
+	 * milisegundos sin notificaciones y se cargan de nuevo desde "systemdata_path" */
+	char *systemdata_path;
+	int assets_loaded;
+	Uint32 idle_unload, idle_since;
+	int panel_w, panel_h;
+	
+	/* Esquina del panel y escala en porcentaje. Lo pedido en next_* se
+	 * aplica al empezar una notificación, las imágenes cargadas están a "scale" */
+	int anchor_x, anchor_y, scale;
+	int next_anchor_x, next_anchor_y, next_scale;
+	
+	/* Lista privada de estampas que se deben dibujar */
+	CPStamp stamp_queue[10];
+	int stamp_queue_start, stamp_queue_end;
+	int stamp_timer;
+	const char *stamp_title;
+	
+	/* Acumulación de notificaciones, ver CPStamp_SetCoalescing.
+	 * "stamp_merged" es la cantidad de estampas en el panel actual */
+	int coalesce, max_latency;
+	int stamp_merged;
+	char merged_label[64];
+	Uint32 frames;
+	Uint32 stamp_queue_frame[10];
+
+#ifdef CPSTAMP_SDL2
+	/* Texturas para CPStamp_DrawRenderer, pertenecen a "renderer" */
+	SDL_Renderer *renderer;
+	SDL_Texture *tex_images[NUM_IMGS];
+	SDL_Texture *tex_earned[2];
+	SDL_Texture *tex_title[2];
+	SDL_Texture *tex_merged[2];
+	SDL_Texture *tex_icon;
+#endif
+
+	/* Modo retenido, ver CPStamp_SetRetained */
+	int retained;
+	int background_valid;
+	int panel_drawn, panel_dirty, panel_y;
+	SDL_Rect invalid_rect;
+	
+	/* Capa premultiplicada de CPStamp_DrawBuffer, "buffer_layer" sólo
+	 * mientras se dibuja en ella */
+	int buffer_drawn, buffer_dirty, buffer_y;
+	SDL_Surface *buffer_layer;
+	
+	/* La carpeta del usuario */
+	char *userdata_path;
+	
+	/* La carpeta .cpstamps, se prepara al abrir la primera categoría */
+	CPStampDir dir;
+	
+	/* Dónde se guardan las categorías, ver CPStamp_SetStorage */
+	CPStampStorage storage;
+	void *storage_data;
+	
+	/* Guardado en segundo plano, ver CPStamp_SaveAsync. El hilo sólo toca
+	 * save_queue, save_done y save_ran, siempre con save_mutex */
+	SDL_Thread *save_thread;
+	SDL_mutex *save_mutex;
+	SDL_cond *save_cond, *save_done_cond;
+	CPStampSave *save_queue, *save_done;
+	int save_ran;
+	
+	/* Último ticket entregado y último avisado con CPSTAMP_EVENT_SAVED */
+	int save_tickets, save_collected;
+	int saves_pending;
+	
+	/* Categorías abiertas */
+	CPStampCategory *categorias;
+	
+	/* Vigilancia de la carpeta .cpstamps, -1 si no se pidió */
+	int watch_fd;
+	
+	/* Estadísticas de uso */
+	CPStampStats stats;
+	
+	/* Funciones de aviso de eventos */
+	CPStampCallback callbacks[NUM_CPSTAMP_EVENTS];
+	void *callbacks_data[NUM_CPSTAMP_EVENTS];
+	
+	/* Código del SDL_USEREVENT que se envía al ganar una estampa, -1 si no se envía */
+	int user_event;
+	
+	/* Para las aplicaciones */
+	SDL_Rect update_rect;
+	int activate;
+};
+
+/* Acceso a los archivos, en cpstamp.c */
+void cpstamp_lock_file (int fd, int exclusive);
+void cpstamp_unlock_file (int fd);
+char *cpstamp_read_file (int fd, struct stat *st, size_t *len, CPStampStats *stats);
+CPStampDir *cpstamp_user_dir (CPStampHandle *handle);
+
+/* Guardado en segundo plano, en cpstamp.c */
+void cpstamp_save_unshare (CPStampCategory *cat);
+void cpstamp_saves_collect (CPStampHandle *handle);
+
+#endif /* __CP_STAMP_PRIVATE_H__ */
+
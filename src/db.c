@@ -0,0 +1,875 @@
+/*
+ * db.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Base de datos de estampas: todas las categorías en un solo archivo
+ * de páginas, en lugar de un archivo por categoría.
+ *
+ * La página 0 tiene dos copias del encabezado, en 0 y en 512. Gana la
+ * válida con la generación más alta, y apunta al directorio de categorías.
+ * Guardar escribe las categorías y el directorio en páginas libres,
+ * y después el encabezado viejo con la siguiente generación. Si algo falla
+ * a la mitad, el otro encabezado sigue apuntando a datos completos */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "dir.h"
+#include "storage.h"
+#include "db.h"
+
+/* Dónde están las dos copias del encabezado, y cuánto mide cada una */
+#define CPSTAMP_DB_SLOT 512
+#define CPSTAMP_DB_HEADER 36
+
+/* Lecturas sin candado que se repiten si otro proceso guarda a la mitad */
+#define CPSTAMP_DB_RETRIES 8
+#define CPSTAMP_DB_STALE 1
+
+typedef struct {
+	Uint64 generation;
+	Uint32 dir_page, dir_len, page_count;
+} CPStampDbHeader;
+
+/* Una categoría para escribir en cpstamp_db_commit */
+typedef struct {
+	const char *clave;
+	const char *data;
+	size_t len;
+	CPStampDbEntry *entry;
+} CPStampDbWrite;
+
+static Uint32 cpstamp_db_pages (size_t len) {
+	return (len + CPSTAMP_DB_PAGE - 1) / CPSTAMP_DB_PAGE;
+}
+
+/* FNV-1a, sólo para descartar un encabezado escrito a medias */
+static Uint32 cpstamp_db_checksum (const char *data, size_t len) {
+	Uint32 hash = 2166136261U;
+	size_t g;
+	
+	for (g = 0; g < len; g++) {
+		hash ^= (Uint8) data[g];
+		hash *= 16777619U;
+	}
+	
+	return hash;
+}
+
+/* Lee hasta "len" bytes desde "offset". Regresa cuántos leyó, menos si
+ * el archivo termina antes, o -1 con errno */
+static ssize_t cpstamp_db_read_at (CPStampDb *db, void *buf, size_t len, off_t offset, CPStampStats *stats) {
+	size_t total;
+	ssize_t res;
+	
+	total = 0;
+#ifndef HAVE_PREAD
+	/* Sin pread, el mutex de la base de datos protege la posición */
+	stats->read_syscalls++;
+	if (lseek (db->fd, offset, SEEK_SET) < 0) return -1;
+#endif
+	while (total < len) {
+#ifdef HAVE_PREAD
+		res = pread (db->fd, (char *) buf + total, len - total, offset + total);
+#else
+		res = read (db->fd, (char *) buf + total, len - total);
+#endif
+		stats->read_syscalls++;
+		
+		if (res < 0 && errno == EINTR) continue;
+		if (res < 0) return -1;
+		if (res == 0) break;
+		
+		total += res;
+		stats->read_bytes += res;
+	}
+	
+	return total;
+}
+
+static int cpstamp_db_write_at (CPStampDb *db, const void *buf, size_t len, off_t offset, CPStampStats *stats) {
+	size_t total;
+	ssize_t res;
+	
+	total = 0;
+#ifndef HAVE_PWRITE
+	stats->write_syscalls++;
+	if (lseek (db->fd, offset, SEEK_SET) < 0) return -1;
+#endif
+	while (total < len) {
+#ifdef HAVE_PWRITE
+		res = pwrite (db->fd, (const char *) buf + total, len - total, offset + total);
+#else
+		res = write (db->fd, (const char *) buf + total, len - total);
+#endif
+		stats->write_syscalls++;
+		
+		if (res < 0 && errno == EINTR) continue;
+		if (res <= 0) {
+			if (res == 0) errno = ENOSPC;
+			return -1;
+		}
+		
+		total += res;
+		stats->written_bytes += res;
+	}
+	
+	return 0;
+}
+
+static int cpstamp_db_parse_header (const char *data, CPStampDbHeader *header) {
+	Uint32 version, page, checksum;
+	
+	if (memcmp (data, "CPDB", 4) != 0) return FALSE;
+	
+	memcpy (&version, &data[4], sizeof (Uint32));
+	memcpy (&page, &data[8], sizeof (Uint32));
+	memcpy (&checksum, &data[32], sizeof (Uint32));
+	
+	if (version != CPSTAMP_DB_VERSION || page != CPSTAMP_DB_PAGE) return FALSE;
+	if (checksum != cpstamp_db_checksum (data, 32)) return FALSE;
+	
+	memcpy (&header->dir_page, &data[12], sizeof (Uint32));
+	memcpy (&header->dir_len, &data[16], sizeof (Uint32));
+	memcpy (&header->page_count, &data[20], sizeof (Uint32));
+	memcpy (&header->generation, &data[24], sizeof (Uint64));
+	
+	return TRUE;
+}
+
+static void cpstamp_db_put_header (char *data, CPStampDbHeader *header) {
+	Uint32 temp;
+	
+	memset (data, 0, CPSTAMP_DB_HEADER);
+	memcpy (data, "CPDB", 4);
+	temp = CPSTAMP_DB_VERSION;
+	memcpy (&data[4], &temp, sizeof (Uint32));
+	temp = CPSTAMP_DB_PAGE;
+	memcpy (&data[8], &temp, sizeof (Uint32));
+	memcpy (&data[12], &header->dir_page, sizeof (Uint32));
+	memcpy (&data[16], &header->dir_len, sizeof (Uint32));
+	memcpy (&data[20], &header->page_count, sizeof (Uint32));
+	memcpy (&data[24], &header->generation, sizeof (Uint64));
+	
+	temp = cpstamp_db_checksum (data, 32);
+	memcpy (&data[32], &temp, sizeof (Uint32));
+}
+
+/* El encabezado vigente, y en "slot" cuál de las dos copias es.
+ * Falla con EINVAL si ninguna copia es válida */
+static int cpstamp_db_read_header (CPStampDb *db, CPStampDbHeader *header, int *slot, CPStampStats *stats) {
+	char data[CPSTAMP_DB_SLOT * 2];
+	CPStampDbHeader copias[2];
+	int validas[2];
+	ssize_t leido;
+	int g;
+	
+	memset (data, 0, sizeof (data));
+	leido = cpstamp_db_read_at (db, data, sizeof (data), 0, stats);
+	if (leido < 0) return -1;
+	
+	for (g = 0; g < 2; g++) {
+		validas[g] = cpstamp_db_parse_header (&data[g * CPSTAMP_DB_SLOT], &copias[g]);
+	}
+	
+	if (!validas[0] && !validas[1]) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	*slot = (validas[0] && (!validas[1] || copias[0].generation > copias[1].generation)) ? 0 : 1;
+	*header = copias[*slot];
+	
+	return 0;
+}
+
+static void cpstamp_db_free_entries (CPStampDbEntry *entries, int count) {
+	int g;
+	
+	for (g = 0; g < count; g++) {
+		free (entries[g].clave);
+	}
+	
+	free (entries);
+}
+
+/* Lee el directorio: la cantidad de categorías y por cada una su clave,
+ * primera página, tamaño y generación */
+static int cpstamp_db_parse_dir (const char *data, size_t len, CPStampDbEntry **entries, int *count) {
+	CPStampDbEntry *lista;
+	Uint32 n, clave_len;
+	size_t pos;
+	int g;
+	
+	*entries = NULL;
+	*count = 0;
+	
+	if (len < sizeof (Uint32)) return (len == 0);
+	
+	memcpy (&n, data, sizeof (Uint32));
+	pos = sizeof (Uint32);
+	
+	/* Cada entrada mide por lo menos 20 bytes, no creer en cantidades imposibles */
+	if (n > (len - pos) / 20) return FALSE;
+	
+	lista = (CPStampDbEntry *) calloc ((n > 0) ? n : 1, sizeof (CPStampDbEntry));
+	if (lista == NULL) return FALSE;
+	
+	for (g = 0; g < (int) n; g++) {
+		if (len - pos < sizeof (Uint32)) break;
+		memcpy (&clave_len, &data[pos], sizeof (Uint32));
+		pos += sizeof (Uint32);
+		
+		if (clave_len == 0 || len - pos < (size_t) clave_len + 16) break;
+		
+		lista[g].clave = (char *) malloc (clave_len + 1);
+		if (lista[g].clave == NULL) break;
+		
+		memcpy (lista[g].clave, &data[pos], clave_len);
+		lista[g].clave[clave_len] = 0;
+		pos += clave_len;
+		
+		memcpy (&lista[g].first_page, &data[pos], sizeof (Uint32));
+		memcpy (&lista[g].len, &data[pos + 4], sizeof (Uint32));
+		memcpy (&lista[g].serial, &data[pos + 8], sizeof (Uint64));
+		pos += 16;
+	}
+	
+	if (g < (int) n) {
+		cpstamp_db_free_entries (lista, n);
+		return FALSE;
+	}
+	
+	*entries = lista;
+	*count = n;
+	
+	return TRUE;
+}
+
+static size_t cpstamp_db_dir_size (CPStampDbEntry *entries, int count) {
+	size_t len;
+	int g;
+	
+	len = sizeof (Uint32);
+	for (g = 0; g < count; g++) {
+		len += sizeof (Uint32) + strlen (entries[g].clave) + 16;
+	}
+	
+	return len;
+}
+
+static void cpstamp_db_put_dir (char *data, CPStampDbEntry *entries, int count) {
+	Uint32 temp;
+	size_t pos;
+	int g;
+	
+	temp = count;
+	memcpy (data, &temp, sizeof (Uint32));
+	pos = sizeof (Uint32);
+	
+	for (g = 0; g < count; g++) {
+		temp = strlen (entries[g].clave);
+		memcpy (&data[pos], &temp, sizeof (Uint32));
+		memcpy (&data[pos + 4], entries[g].clave, temp);
+		pos += 4 + temp;
+		
+		memcpy (&data[pos], &entries[g].first_page, sizeof (Uint32));
+		memcpy (&data[pos + 4], &entries[g].len, sizeof (Uint32));
+		memcpy (&data[pos + 8], &entries[g].serial, sizeof (Uint64));
+		pos += 16;
+	}
+}
+
+/* Pone al día el directorio si otro proceso o hilo guardó desde la última
+ * vez. Si la generación no cambió, sólo cuesta leer el encabezado */
+static int cpstamp_db_refresh (CPStampDb *db, CPStampStats *stats) {
+	CPStampDbHeader header;
+	CPStampDbEntry *entries;
+	char *data;
+	int slot, count, ok;
+	
+	if (cpstamp_db_read_header (db, &header, &slot, stats) < 0) return -1;
+	if (header.generation == db->generation) return 0;
+	
+	data = NULL;
+	if (header.dir_len > 0) {
+		data = (char *) malloc (header.dir_len);
+		if (data == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		
+		if (cpstamp_db_read_at (db, data, header.dir_len, (off_t) header.dir_page * CPSTAMP_DB_PAGE, stats) != (ssize_t) header.dir_len) {
+			free (data);
+			errno = EIO;
+			return -1;
+		}
+	}
+	
+	ok = cpstamp_db_parse_dir (data, header.dir_len, &entries, &count);
+	free (data);
+	
+	if (!ok) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	cpstamp_db_free_entries (db->entries, db->count);
+	db->entries = entries;
+	db->count = count;
+	db->generation = header.generation;
+	db->slot = slot;
+	db->dir_page = header.dir_page;
+	db->dir_len = header.dir_len;
+	db->page_count = header.page_count;
+	
+	return 0;
+}
+
+static CPStampDbEntry *cpstamp_db_find (CPStampDbEntry *entries, int count, const char *clave) {
+	int g;
+	
+	for (g = 0; g < count; g++) {
+		if (strcmp (entries[g].clave, clave) == 0) return &entries[g];
+	}
+	
+	return NULL;
+}
+
+static void cpstamp_db_revision (CPStampDbEntry *entry, CPStampRevision *rev) {
+	rev->id = entry->first_page;
+	rev->size = entry->len;
+	rev->mtime = entry->serial;
+	rev->mtime_nsec = 0;
+}
+
+/* Marca "n" páginas desde "first" como ocupadas. Un directorio dañado
+ * puede apuntar fuera del archivo */
+static void cpstamp_db_mark (Uint8 *usadas, Uint32 size, Uint32 first, Uint32 n) {
+	if (first >= size) return;
+	if (n > size - first) n = size - first;
+	
+	memset (&usadas[first], 1, n);
+}
+
+/* Primeras "n" páginas libres contiguas. Después de "page_count" todo está
+ * libre, así que siempre hay lugar al final */
+static Uint32 cpstamp_db_alloc (Uint8 *usadas, Uint32 size, Uint32 n) {
+	Uint32 g, libres;
+	
+	libres = 0;
+	for (g = 1; g < size; g++) {
+		libres = usadas[g] ? 0 : libres + 1;
+		
+		if (libres == n) {
+			cpstamp_db_mark (usadas, size, g - n + 1, n);
+			return g - n + 1;
+		}
+	}
+	
+	return 0;
+}
+
+/* Escribe "n" categorías en páginas libres, el directorio nuevo y al final
+ * el encabezado. Las páginas que usa la generación actual no se tocan,
+ * así que el encabezado anterior siempre es válido. Con el mutex y el
+ * candado de la carpeta tomados */
+static int cpstamp_db_commit (CPStampDb *db, CPStampDbWrite *writes, int n, CPStampStats *stats) {
+	CPStampDbHeader header;
+	CPStampDbEntry *nuevas, *entry;
+	Uint8 *usadas;
+	Uint32 size, max, paginas;
+	char *dir_data, slot_data[CPSTAMP_DB_HEADER];
+	int g, count, error;
+	
+	/* Una base de datos nueva todavía no tiene encabezado */
+	if (db->generation != 0 && cpstamp_db_refresh (db, stats) < 0) return -1;
+	
+	nuevas = (CPStampDbEntry *) calloc (db->count + n + 1, sizeof (CPStampDbEntry));
+	if (nuevas == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	count = 0;
+	error = 0;
+	for (g = 0; g < db->count && error == 0; g++) {
+		nuevas[count] = db->entries[g];
+		nuevas[count].clave = strdup (db->entries[g].clave);
+		if (nuevas[count].clave == NULL) error = ENOMEM;
+		count++;
+	}
+	
+	/* Páginas ocupadas por la generación actual, más lugar al final para
+	 * todo lo nuevo: las categorías y el directorio con sus claves */
+	size = db->page_count;
+	paginas = cpstamp_db_dir_size (nuevas, count);
+	for (g = 0; g < n; g++) {
+		size += cpstamp_db_pages (writes[g].len);
+		paginas += sizeof (Uint32) + strlen (writes[g].clave) + 16;
+	}
+	size += cpstamp_db_pages (paginas);
+	
+	usadas = NULL;
+	dir_data = NULL;
+	if (error == 0) {
+		usadas = (Uint8 *) calloc (size, 1);
+		if (usadas == NULL) error = ENOMEM;
+	}
+	
+	if (error == 0) {
+		cpstamp_db_mark (usadas, size, 0, 1);
+		cpstamp_db_mark (usadas, size, db->dir_page, cpstamp_db_pages (db->dir_len));
+		for (g = 0; g < db->count; g++) {
+			cpstamp_db_mark (usadas, size, db->entries[g].first_page, cpstamp_db_pages (db->entries[g].len));
+		}
+	}
+	
+	max = db->page_count;
+	for (g = 0; g < n && error == 0; g++) {
+		entry = cpstamp_db_find (nuevas, count, writes[g].clave);
+		
+		if (entry == NULL) {
+			entry = &nuevas[count++];
+			entry->clave = strdup (writes[g].clave);
+			if (entry->clave == NULL) {
+				error = ENOMEM;
+				break;
+			}
+		}
+		
+		paginas = cpstamp_db_pages (writes[g].len);
+		entry->first_page = (paginas > 0) ? cpstamp_db_alloc (usadas, size, paginas) : 0;
+		entry->len = writes[g].len;
+		entry->serial = db->generation + 1;
+		writes[g].entry = entry;
+		
+		if (entry->first_page + paginas > max) max = entry->first_page + paginas;
+		
+		if (paginas > 0 && cpstamp_db_write_at (db, writes[g].data, writes[g].len, (off_t) entry->first_page * CPSTAMP_DB_PAGE, stats) < 0) {
+			error = errno;
+		}
+	}
+	
+	/* El directorio también va en páginas libres */
+	if (error == 0) {
+		header.dir_len = cpstamp_db_dir_size (nuevas, count);
+		header.dir_page = cpstamp_db_alloc (usadas, size, cpstamp_db_pages (header.dir_len));
+		header.generation = db->generation + 1;
+		
+		paginas = cpstamp_db_pages (header.dir_len);
+		if (header.dir_page + paginas > max) max = header.dir_page + paginas;
+		header.page_count = max;
+		
+		dir_data = (char *) malloc (header.dir_len);
+		if (dir_data == NULL) error = ENOMEM;
+	}
+	
+	if (error == 0) {
+		cpstamp_db_put_dir (dir_data, nuevas, count);
+		if (cpstamp_db_write_at (db, dir_data, header.dir_len, (off_t) header.dir_page * CPSTAMP_DB_PAGE, stats) < 0) error = errno;
+	}
+	
+	/* Todo debe estar en disco antes de que el encabezado apunte a ello */
+	if (error == 0) {
+		stats->write_syscalls++;
+		if (cpstamp_sync (db->fd) < 0) error = errno;
+	}
+	
+	if (error == 0) {
+		cpstamp_db_put_header (slot_data, &header);
+		if (cpstamp_db_write_at (db, slot_data, CPSTAMP_DB_HEADER, (1 - db->slot) * CPSTAMP_DB_SLOT, stats) < 0) error = errno;
+	}
+	
+	if (error == 0) {
+		stats->write_syscalls++;
+		if (cpstamp_sync (db->fd) < 0) error = errno;
+	}
+	
+	free (dir_data);
+	free (usadas);
+	
+	if (error != 0) {
+		cpstamp_db_free_entries (nuevas, count);
+		errno = error;
+		return -1;
+	}
+	
+	cpstamp_db_free_entries (db->entries, db->count);
+	db->entries = nuevas;
+	db->count = count;
+	db->generation = header.generation;
+	db->slot = 1 - db->slot;
+	db->dir_page = header.dir_page;
+	db->dir_len = header.dir_len;
+	db->page_count = header.page_count;
+	
+	return 0;
+}
+
+/* Lee una categoría. Sin el candado, otro proceso puede guardar mientras
+ * tanto y reusar sus páginas; si la generación cambió se debe repetir */
+static int cpstamp_db_read_entry (CPStampDb *db, const char *clave, char **buf, size_t *len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDbHeader header;
+	CPStampDbEntry *entry;
+	int slot;
+	
+	if (cpstamp_db_refresh (db, stats) < 0) return -1;
+	
+	/* Una categoría nueva, todavía sin datos */
+	entry = cpstamp_db_find (db->entries, db->count, clave);
+	if (entry == NULL) return 0;
+	
+	if (entry->len > 0) {
+		*buf = (char *) malloc (entry->len);
+		if (*buf == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		
+		if (cpstamp_db_read_at (db, *buf, entry->len, (off_t) entry->first_page * CPSTAMP_DB_PAGE, stats) != (ssize_t) entry->len) {
+			free (*buf);
+			*buf = NULL;
+			errno = EIO;
+			return -1;
+		}
+	}
+	
+	if (cpstamp_db_read_header (db, &header, &slot, stats) < 0 || header.generation != db->generation) {
+		free (*buf);
+		*buf = NULL;
+		return CPSTAMP_DB_STALE;
+	}
+	
+	*len = entry->len;
+	cpstamp_db_revision (entry, rev);
+	
+	return 0;
+}
+
+static int cpstamp_db_load (void *data, const char *clave, char **buf, size_t *len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	int intento, res;
+	
+	*buf = NULL;
+	*len = 0;
+	memset (rev, 0, sizeof (CPStampRevision));
+	
+	res = CPSTAMP_DB_STALE;
+	for (intento = 0; intento < CPSTAMP_DB_RETRIES && res == CPSTAMP_DB_STALE; intento++) {
+		SDL_LockMutex (db->mutex);
+		res = cpstamp_db_read_entry (db, clave, buf, len, rev, stats);
+		SDL_UnlockMutex (db->mutex);
+	}
+	
+	/* Otro proceso no deja de guardar, esperar a que suelte el candado */
+	if (res == CPSTAMP_DB_STALE) {
+		cpstamp_dir_lock (db->dir, FALSE);
+		SDL_LockMutex (db->mutex);
+		res = cpstamp_db_read_entry (db, clave, buf, len, rev, stats);
+		SDL_UnlockMutex (db->mutex);
+		cpstamp_dir_unlock (db->dir);
+		stats->read_syscalls += 2;
+		
+		if (res == CPSTAMP_DB_STALE) {
+			errno = EAGAIN;
+			res = -1;
+		}
+	}
+	
+	return res;
+}
+
+static int cpstamp_db_save (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	CPStampDbWrite escritura;
+	int res;
+	
+	escritura.clave = clave;
+	escritura.data = buf;
+	escritura.len = len;
+	
+	SDL_LockMutex (db->mutex);
+	res = cpstamp_db_commit (db, &escritura, 1, stats);
+	if (res == 0) cpstamp_db_revision (escritura.entry, rev);
+	SDL_UnlockMutex (db->mutex);
+	
+	return res;
+}
+
+static int cpstamp_db_stat (void *data, const char *clave, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	CPStampDbEntry *entry;
+	int res;
+	
+	SDL_LockMutex (db->mutex);
+	res = cpstamp_db_refresh (db, stats);
+	
+	if (res == 0) {
+		entry = cpstamp_db_find (db->entries, db->count, clave);
+		
+		if (entry != NULL) {
+			cpstamp_db_revision (entry, rev);
+		} else {
+			errno = ENOENT;
+			res = -1;
+		}
+	}
+	SDL_UnlockMutex (db->mutex);
+	
+	return res;
+}
+
+static int cpstamp_db_lock (void *data, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	
+	cpstamp_dir_lock (db->dir, TRUE);
+	stats->write_syscalls++;
+	
+	return 0;
+}
+
+static void cpstamp_db_unlock (void *data, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	
+	cpstamp_dir_unlock (db->dir);
+	stats->write_syscalls++;
+}
+
+/* Las claves se copian, "fn" vuelve a usar la base de datos */
+static int cpstamp_db_list (void *data, void (*fn) (const char *clave, void *arg), void *arg, CPStampStats *stats) {
+	CPStampDb *db = (CPStampDb *) data;
+	char **claves;
+	int g, count;
+	
+	SDL_LockMutex (db->mutex);
+	if (cpstamp_db_refresh (db, stats) < 0) {
+		SDL_UnlockMutex (db->mutex);
+		return -1;
+	}
+	
+	count = db->count;
+	claves = (char **) calloc ((count > 0) ? count : 1, sizeof (char *));
+	
+	for (g = 0; g < count && claves != NULL; g++) {
+		claves[g] = strdup (db->entries[g].clave);
+	}
+	SDL_UnlockMutex (db->mutex);
+	
+	if (claves == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	for (g = 0; g < count; g++) {
+		if (claves[g] != NULL) fn (claves[g], arg);
+		free (claves[g]);
+	}
+	
+	free (claves);
+	
+	return 0;
+}
+
+static void cpstamp_db_destroy (void *data) {
+	CPStampDb *db = (CPStampDb *) data;
+	
+	if (db->fd >= 0) close (db->fd);
+	cpstamp_db_free_entries (db->entries, db->count);
+	if (db->mutex != NULL) SDL_DestroyMutex (db->mutex);
+	free (db);
+}
+
+/* La primera vez, las categorías de la carpeta .cpstamps pasan a la base de
+ * datos en un solo guardado. Los archivos se borran hasta que la base de
+ * datos está en disco */
+static int cpstamp_db_migrate (CPStampDb *db, CPStampStats *stats) {
+	CPStampDbWrite *writes, *nuevas;
+	DIR *listado;
+	struct dirent *ent;
+	struct stat st, leido;
+	int g, n, size, fd, res, error;
+	char *data;
+	size_t len;
+	
+	writes = NULL;
+	n = size = 0;
+	error = 0;
+	
+	listado = cpstamp_dir_list (db->dir);
+	while (listado != NULL && (ent = readdir (listado)) != NULL) {
+		/* El índice, el candado y la misma base de datos empiezan con punto */
+		if (ent->d_name[0] == '.') continue;
+		
+		stats->read_syscalls++;
+		if (cpstamp_dir_stat (db->dir, ent->d_name, &st) < 0) {
+			/* Sólo se ignora si se borró mientras tanto */
+			if (errno == ENOENT) continue;
+			error = errno;
+			break;
+		}
+		if (!S_ISREG (st.st_mode)) continue;
+		
+		/* Un archivo que no se puede leer completo también es un error,
+		 * guardarlo vacío o cortado y borrarlo perdería las estampas */
+		fd = cpstamp_dir_open (db->dir, ent->d_name, O_RDONLY, 0);
+		stats->read_syscalls++;
+		if (fd < 0) {
+			error = errno;
+			break;
+		}
+		
+		data = cpstamp_read_file (fd, &leido, &len, stats);
+		close (fd);
+		stats->read_syscalls++;
+		
+		if ((data == NULL) ? (st.st_size > 0 || leido.st_size > 0) : (len != (size_t) leido.st_size)) {
+			free (data);
+			error = EIO;
+			break;
+		}
+		
+		if (n == size) {
+			size = (size > 0) ? size * 2 : 16;
+			nuevas = (CPStampDbWrite *) realloc (writes, size * sizeof (CPStampDbWrite));
+			if (nuevas == NULL) {
+				free (data);
+				error = ENOMEM;
+				break;
+			}
+			writes = nuevas;
+		}
+		
+		writes[n].clave = strdup (ent->d_name);
+		writes[n].data = data;
+		writes[n].len = (data != NULL) ? len : 0;
+		if (writes[n].clave == NULL) {
+			free (data);
+			error = ENOMEM;
+			break;
+		}
+		n++;
+	}
+	
+	if (listado != NULL) closedir (listado);
+	
+	/* Sin todas las categorías no se migra nada, los archivos siguen ahí */
+	if (error == 0) {
+		res = cpstamp_db_commit (db, writes, n, stats);
+	} else {
+		errno = error;
+		res = -1;
+	}
+	
+	for (g = 0; g < n; g++) {
+		if (res == 0) {
+			cpstamp_dir_unlink (db->dir, writes[g].clave);
+			stats->write_syscalls++;
+		}
+		
+		free ((char *) writes[g].clave);
+		free ((char *) writes[g].data);
+	}
+	
+	free (writes);
+	
+	return res;
+}
+
+/* Abre la base de datos en la carpeta .cpstamps, creándola y pasando a ella
+ * las categorías si no existe. Regresa NULL con errno si falla */
+CPStampDb *cpstamp_db_open (CPStampDir *dir, CPStampStats *stats) {
+	CPStampDb *db;
+	struct stat st;
+	int res, err;
+	
+	db = (CPStampDb *) calloc (1, sizeof (CPStampDb));
+	if (db == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	db->dir = dir;
+	db->mutex = SDL_CreateMutex ();
+	db->fd = cpstamp_dir_open (dir, CPSTAMP_DB_FILE, O_RDWR | O_CREAT, 0644);
+	stats->read_syscalls++;
+	
+	if (db->fd < 0 || db->mutex == NULL) {
+		err = (db->fd < 0) ? errno : ENOMEM;
+		cpstamp_db_destroy (db);
+		errno = err;
+		return NULL;
+	}
+	
+	/* Nadie más debe crear la base de datos ni guardar en archivos mientras tanto */
+	cpstamp_dir_lock (dir, TRUE);
+	stats->write_syscalls++;
+	
+	stats->read_syscalls++;
+	if (fstat (db->fd, &st) < 0) {
+		res = -1;
+	} else if (st.st_size == 0) {
+		/* Nueva, el primer guardado escribe el encabezado 0 */
+		db->slot = 1;
+		db->page_count = 1;
+		res = cpstamp_db_migrate (db, stats);
+	} else {
+		res = cpstamp_db_refresh (db, stats);
+	}
+	err = errno;
+	
+	cpstamp_dir_unlock (dir);
+	stats->write_syscalls++;
+	
+	if (res < 0) {
+		cpstamp_db_destroy (db);
+		errno = err;
+		return NULL;
+	}
+	
+	return db;
+}
+
+/* No hay "append" barato, las páginas de una categoría se escriben completas */
+const CPStampStorage cpstamp_db_storage = {
+	cpstamp_db_load,
+	cpstamp_db_save,
+	NULL,
+	cpstamp_db_stat,
+	cpstamp_db_lock,
+	cpstamp_db_unlock,
+	cpstamp_db_list,
+	cpstamp_db_destroy
+};
+
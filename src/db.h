@@ -0,0 +1,70 @@
+/*
+ * db.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_DB_H__
+#define __CPSTAMP_DB_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "dir.h"
+
+#define CPSTAMP_DB_VERSION 1
+
+/* Nombre de la base de datos dentro de la carpeta .cpstamps */
+#define CPSTAMP_DB_FILE ".database"
+
+/* Tamaño de página, cada categoría ocupa páginas contiguas */
+#define CPSTAMP_DB_PAGE 4096
+
+/* Una categoría dentro de la base de datos */
+typedef struct {
+	char *clave;
+	Uint32 first_page;
+	Uint32 len;
+	
+	/* Generación en la que se escribió, cambia con cada guardado */
+	Uint64 serial;
+} CPStampDbEntry;
+
+/* Todas las categorías en un solo archivo. La página 0 tiene dos copias
+ * del encabezado, la válida más nueva apunta al directorio de categorías */
+typedef struct {
+	CPStampDir *dir;
+	int fd;
+	
+	/* Entre el hilo principal y el de guardado */
+	SDL_mutex *mutex;
+	
+	/* El último encabezado leído y su directorio */
+	Uint64 generation;
+	int slot;
+	Uint32 dir_page, dir_len, page_count;
+	CPStampDbEntry *entries;
+	int count;
+} CPStampDb;
+
+/* "data" es el CPStampDb de cpstamp_db_open */
+extern const CPStampStorage cpstamp_db_storage;
+
+CPStampDb *cpstamp_db_open (CPStampDir *dir, CPStampStats *stats);
+
+#endif /* __CPSTAMP_DB_H__ */
+
@@ -0,0 +1,390 @@
+/*
+ * dbtest.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Pruebas de la base de datos de categorías, se corren con "make check".
+ * Se liga directamente con los objetos de la librería usando --wrap,
+ * para guardar desde otro lado a la mitad de una lectura */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpstamp.h"
+#include "dir.h"
+#include "db.h"
+
+/* Las copias del encabezado en la página 0, ver db.c */
+#define DBTEST_SLOT 512
+#define DBTEST_GENERATION 24
+
+static int dbtest_failures = 0;
+
+/* Mientras "dbtest_cambios" no sea 0, cada lectura de datos de "dbtest_lector"
+ * guarda antes "dbtest_nuevo" desde "dbtest_escritor". Con -1 nunca para */
+static CPStampDb *dbtest_lector = NULL, *dbtest_escritor = NULL;
+static const char *dbtest_nuevo = NULL;
+static int dbtest_cambios = 0;
+
+/* Con TRUE, read falla con EIO */
+static int dbtest_fail_reads = FALSE;
+
+/* Envolturas, ver cpstamp_dbtest_LDFLAGS en Makefile.am */
+ssize_t __real_read (int fd, void *buf, size_t count);
+ssize_t __real_pread (int fd, void *buf, size_t count, off_t offset);
+
+static void dbtest_interfere (int fd, off_t offset) {
+	CPStampStats stats;
+	CPStampRevision rev;
+	
+	if (dbtest_cambios == 0 || dbtest_lector == NULL || fd != dbtest_lector->fd) return;
+	
+	/* Los encabezados se leen al principio y al final, sólo cambiar antes de los datos */
+	if (offset < CPSTAMP_DB_PAGE) return;
+	
+	if (dbtest_cambios > 0) dbtest_cambios--;
+	
+	memset (&stats, 0, sizeof (stats));
+	cpstamp_db_storage.save (dbtest_escritor, "juego", dbtest_nuevo, strlen (dbtest_nuevo), &rev, &stats);
+}
+
+ssize_t __wrap_read (int fd, void *buf, size_t count) {
+	if (dbtest_fail_reads) {
+		errno = EIO;
+		return -1;
+	}
+	
+	if (dbtest_cambios != 0) dbtest_interfere (fd, lseek (fd, 0, SEEK_CUR));
+	
+	return __real_read (fd, buf, count);
+}
+
+ssize_t __wrap_pread (int fd, void *buf, size_t count, off_t offset) {
+	dbtest_interfere (fd, offset);
+	
+	return __real_pread (fd, buf, count, offset);
+}
+
+static void dbtest_check (int ok, const char *test, const char *what) {
+	if (ok) return;
+	
+	fprintf (stderr, "%s: %s\n", test, what);
+	dbtest_failures++;
+}
+
+/* Una carpeta de usuario temporal con su carpeta .cpstamps */
+static int dbtest_setup (char *tmp, CPStampDir *dir) {
+	strcpy (tmp, "/tmp/cpstamp-dbtest-XXXXXX");
+	
+	if (mkdtemp (tmp) == NULL) {
+		perror ("mkdtemp");
+		return -1;
+	}
+	
+	if (cpstamp_dir_init (dir, tmp) < 0) {
+		perror ("cpstamp_dir_init");
+		rmdir (tmp);
+		return -1;
+	}
+	
+	return 0;
+}
+
+static void dbtest_cleanup (char *tmp, CPStampDir *dir) {
+	DIR *listado;
+	struct dirent *ent;
+	
+	listado = cpstamp_dir_list (dir);
+	while (listado != NULL && (ent = readdir (listado)) != NULL) {
+		if (strcmp (ent->d_name, ".") == 0 || strcmp (ent->d_name, "..") == 0) continue;
+		cpstamp_dir_unlink (dir, ent->d_name);
+	}
+	if (listado != NULL) closedir (listado);
+	
+	rmdir (dir->path);
+	rmdir (tmp);
+	
+	if (dir->fd >= 0) close (dir->fd);
+	if (dir->lock_fd >= 0) close (dir->lock_fd);
+	if (dir->mutex != NULL) SDL_DestroyMutex (dir->mutex);
+	free (dir->path);
+}
+
+static int dbtest_write_file (CPStampDir *dir, const char *clave, const char *data, size_t len) {
+	int fd;
+	ssize_t res;
+	
+	fd = cpstamp_dir_open (dir, clave, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	
+	res = (len > 0) ? write (fd, data, len) : 0;
+	close (fd);
+	
+	return (res == (ssize_t) len) ? 0 : -1;
+}
+
+/* TRUE si la categoría tiene exactamente esos datos */
+static int dbtest_has (CPStampDb *db, const char *clave, const char *data, size_t len) {
+	CPStampStats stats;
+	CPStampRevision rev;
+	char *buf;
+	size_t leido;
+	int ok;
+	
+	memset (&stats, 0, sizeof (stats));
+	if (cpstamp_db_storage.load (db, clave, &buf, &leido, &rev, &stats) < 0) return FALSE;
+	
+	ok = (leido == len && (len == 0 || (buf != NULL && memcmp (buf, data, len) == 0)));
+	free (buf);
+	
+	return ok;
+}
+
+static void dbtest_fill (char *data, size_t len, int seed) {
+	size_t g;
+	
+	for (g = 0; g < len; g++) {
+		data[g] = (char) ((g * 31 + seed) & 0xFF);
+	}
+}
+
+/* Lo que se guarda es lo que se lee, desde el mismo CPStampDb y desde otro */
+static void dbtest_round_trip (void) {
+	const char *test = "round-trip";
+	char tmp[64], data[CPSTAMP_DB_PAGE * 2 + 100];
+	CPStampDir dir;
+	CPStampDb *db, *otro;
+	CPStampStats stats;
+	CPStampRevision guardada, leida;
+	
+	if (dbtest_setup (tmp, &dir) < 0) {
+		dbtest_check (FALSE, test, "setup failed");
+		return;
+	}
+	
+	memset (&stats, 0, sizeof (stats));
+	dbtest_fill (data, sizeof (data), 1);
+	
+	db = cpstamp_db_open (&dir, &stats);
+	dbtest_check (db != NULL, test, "cpstamp_db_open failed");
+	
+	if (db != NULL) {
+		dbtest_check (cpstamp_db_storage.save (db, "juego", data, sizeof (data), &guardada, &stats) == 0, test, "save failed");
+		dbtest_check (cpstamp_db_storage.save (db, "otro", "abc", 3, &leida, &stats) == 0, test, "second save failed");
+		dbtest_check (dbtest_has (db, "juego", data, sizeof (data)), test, "data differs after save");
+		
+		dbtest_check (cpstamp_db_storage.stat (db, "juego", &leida, &stats) == 0, test, "stat failed");
+		dbtest_check (memcmp (&guardada, &leida, sizeof (CPStampRevision)) == 0, test, "revision changed without a save");
+		
+		otro = cpstamp_db_open (&dir, &stats);
+		dbtest_check (otro != NULL, test, "reopen failed");
+		if (otro != NULL) {
+			dbtest_check (dbtest_has (otro, "juego", data, sizeof (data)), test, "data differs after reopen");
+			dbtest_check (dbtest_has (otro, "otro", "abc", 3), test, "second category differs after reopen");
+			cpstamp_db_storage.destroy (otro);
+		}
+		
+		cpstamp_db_storage.destroy (db);
+	}
+	
+	dbtest_cleanup (tmp, &dir);
+}
+
+/* Si el encabezado más nuevo está dañado, se lee la generación anterior */
+static void dbtest_fallback (void) {
+	const char *test = "header fallback";
+	char tmp[64], slots[DBTEST_SLOT * 2], *copia;
+	CPStampDir dir;
+	CPStampDb *db;
+	CPStampStats stats;
+	CPStampRevision rev;
+	Uint64 generaciones[2];
+	int fd, g, nueva;
+	
+	if (dbtest_setup (tmp, &dir) < 0) {
+		dbtest_check (FALSE, test, "setup failed");
+		return;
+	}
+	
+	memset (&stats, 0, sizeof (stats));
+	
+	db = cpstamp_db_open (&dir, &stats);
+	dbtest_check (db != NULL, test, "cpstamp_db_open failed");
+	
+	if (db != NULL) {
+		dbtest_check (cpstamp_db_storage.save (db, "juego", "anterior", 8, &rev, &stats) == 0, test, "first save failed");
+		dbtest_check (cpstamp_db_storage.save (db, "juego", "nueva", 5, &rev, &stats) == 0, test, "second save failed");
+		cpstamp_db_storage.destroy (db);
+	}
+	
+	/* Dañar la copia con la generación más alta */
+	fd = cpstamp_dir_open (&dir, CPSTAMP_DB_FILE, O_RDWR, 0);
+	dbtest_check (fd >= 0, test, "can't open the database file");
+	
+	if (fd >= 0) {
+		dbtest_check (pread (fd, slots, sizeof (slots), 0) == (ssize_t) sizeof (slots), test, "can't read the headers");
+		for (g = 0; g < 2; g++) {
+			memcpy (&generaciones[g], &slots[g * DBTEST_SLOT + DBTEST_GENERATION], sizeof (Uint64));
+		}
+		
+		nueva = (generaciones[0] > generaciones[1]) ? 0 : 1;
+		copia = &slots[nueva * DBTEST_SLOT];
+		copia[DBTEST_GENERATION] ^= 0x5A;
+		
+		dbtest_check (pwrite (fd, copia, DBTEST_SLOT, nueva * DBTEST_SLOT) == DBTEST_SLOT, test, "can't corrupt the header");
+		close (fd);
+	}
+	
+	db = cpstamp_db_open (&dir, &stats);
+	dbtest_check (db != NULL, test, "reopen with a corrupted header failed");
+	
+	if (db != NULL) {
+		dbtest_check (dbtest_has (db, "juego", "anterior", 8), test, "didn't fall back to the previous generation");
+		cpstamp_db_storage.destroy (db);
+	}
+	
+	dbtest_cleanup (tmp, &dir);
+}
+
+/* Si otro guarda entre la lectura de los datos y la del encabezado, la
+ * lectura se repite; si nunca deja de guardar, falla con EAGAIN */
+static void dbtest_stale (void) {
+	const char *test = "stale read";
+	char tmp[64];
+	CPStampDir dir;
+	CPStampStats stats;
+	CPStampRevision rev;
+	char *buf;
+	size_t len;
+	
+	if (dbtest_setup (tmp, &dir) < 0) {
+		dbtest_check (FALSE, test, "setup failed");
+		return;
+	}
+	
+	memset (&stats, 0, sizeof (stats));
+	
+	dbtest_lector = cpstamp_db_open (&dir, &stats);
+	dbtest_escritor = cpstamp_db_open (&dir, &stats);
+	dbtest_check (dbtest_lector != NULL && dbtest_escritor != NULL, test, "cpstamp_db_open failed");
+	
+	if (dbtest_lector != NULL && dbtest_escritor != NULL) {
+		dbtest_check (cpstamp_db_storage.save (dbtest_lector, "juego", "anterior", 8, &rev, &stats) == 0, test, "save failed");
+		
+		/* Una sola vez: la primera lectura queda vieja y la segunda ve lo nuevo */
+		dbtest_nuevo = "nueva";
+		dbtest_cambios = 1;
+		dbtest_check (dbtest_has (dbtest_lector, "juego", "nueva", 5), test, "stale read wasn't retried");
+		dbtest_check (dbtest_cambios == 0, test, "the generation didn't change during the read");
+		
+		/* Siempre */
+		dbtest_nuevo = "siempre";
+		dbtest_cambios = -1;
+		errno = 0;
+		dbtest_check (cpstamp_db_storage.load (dbtest_lector, "juego", &buf, &len, &rev, &stats) < 0 && errno == EAGAIN, test, "endless stale reads didn't fail with EAGAIN");
+		dbtest_cambios = 0;
+		
+		dbtest_check (dbtest_has (dbtest_lector, "juego", "siempre", 7), test, "data differs after stale reads");
+	}
+	
+	if (dbtest_lector != NULL) cpstamp_db_storage.destroy (dbtest_lector);
+	if (dbtest_escritor != NULL) cpstamp_db_storage.destroy (dbtest_escritor);
+	dbtest_lector = dbtest_escritor = NULL;
+	
+	dbtest_cleanup (tmp, &dir);
+}
+
+/* Los archivos de la carpeta .cpstamps pasan completos a la base de datos.
+ * Si uno no se puede leer no se migra nada y los archivos siguen ahí */
+static void dbtest_migrate (void) {
+	const char *test = "migration";
+	static const char *claves[] = {"juego-1", "juego-2", "juego-3"};
+	static const size_t sizes[] = {100, CPSTAMP_DB_PAGE * 3 + 7, 0};
+	char tmp[64], *datos[3];
+	CPStampDir dir;
+	CPStampDb *db;
+	CPStampStats stats;
+	struct stat st;
+	int g;
+	
+	if (dbtest_setup (tmp, &dir) < 0) {
+		dbtest_check (FALSE, test, "setup failed");
+		return;
+	}
+	
+	memset (&stats, 0, sizeof (stats));
+	
+	for (g = 0; g < 3; g++) {
+		datos[g] = (char *) malloc (sizes[g] + 1);
+		dbtest_fill (datos[g], sizes[g], g);
+		dbtest_check (dbtest_write_file (&dir, claves[g], datos[g], sizes[g]) == 0, test, "can't create a category file");
+	}
+	
+	/* Una lectura fallida aborta la migración */
+	dbtest_fail_reads = TRUE;
+	db = cpstamp_db_open (&dir, &stats);
+	dbtest_fail_reads = FALSE;
+	
+	dbtest_check (db == NULL, test, "migration didn't abort on a read error");
+	if (db != NULL) cpstamp_db_storage.destroy (db);
+	
+	for (g = 0; g < 3; g++) {
+		dbtest_check (cpstamp_dir_stat (&dir, claves[g], &st) == 0 && st.st_size == (off_t) sizes[g], test, "aborted migration touched a category file");
+	}
+	
+	db = cpstamp_db_open (&dir, &stats);
+	dbtest_check (db != NULL, test, "cpstamp_db_open failed");
+	
+	if (db != NULL) {
+		for (g = 0; g < 3; g++) {
+			dbtest_check (dbtest_has (db, claves[g], datos[g], sizes[g]), test, "migrated data differs");
+			dbtest_check (cpstamp_dir_stat (&dir, claves[g], &st) < 0 && errno == ENOENT, test, "migrated file wasn't deleted");
+		}
+		cpstamp_db_storage.destroy (db);
+	}
+	
+	for (g = 0; g < 3; g++) {
+		free (datos[g]);
+	}
+	
+	dbtest_cleanup (tmp, &dir);
+}
+
+int main (int argc, char **argv) {
+	dbtest_round_trip ();
+	dbtest_fallback ();
+	dbtest_stale ();
+	dbtest_migrate ();
+	
+	if (dbtest_failures > 0) {
+		fprintf (stderr, "%d checks failed\n", dbtest_failures);
+		return 1;
+	}
+	
+	printf ("All database checks passed\n");
+	
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * dir.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "path.h"
+#include "dir.h"
+
+#if defined (HAVE_OPENAT) && defined (HAVE_FSTATAT) && defined (HAVE_RENAMEAT) && defined (HAVE_UNLINKAT)
+#define CPSTAMP_DIR_AT 1
+#endif
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+static int cpstamp_folder_exists (const char *fname) {
+	struct stat s;
+	return (stat(fname, &s) == 0 && S_ISDIR(s.st_mode));
+}
+
+static int cpstamp_folder_create (const char *fname) {
+	char *parent_folder;
+	char *sub_folder;
+	int ok = TRUE;
+	
+	if (cpstamp_folder_exists (fname)) return TRUE;
+	
+	parent_folder = strdup (fname);
+	sub_folder = strdup (fname);
+	
+	if (cpstamp_split_path (fname, parent_folder, sub_folder)) {
+		if (!cpstamp_folder_exists (parent_folder)) {
+			ok = cpstamp_folder_create (parent_folder);
+		}
+	}
+	
+	if (ok) {
+		#ifdef __MINGW32__
+		ok = mkdir(fname) == 0;
+		#else
+		ok = mkdir(fname, 0775) == 0;
+		#endif
+	}
+	
+	free (parent_folder);
+	free (sub_folder);
+	return ok;
+}
+
+#ifndef CPSTAMP_DIR_AT
+/* Sin openat, cada operación arma la ruta completa. Liberar con free */
+static char *cpstamp_dir_path (CPStampDir *dir, const char *name) {
+	return cpstamp_resolve_path (dir->path, name);
+}
+#endif
+
+/* Resuelve y crea la carpeta de estampas. Regresa -1 con errno si no se pudo */
+int cpstamp_dir_init (CPStampDir *dir, const char *userdata_path) {
+	int err;
+	
+	dir->path = NULL;
+	dir->fd = dir->lock_fd = -1;
+	dir->mutex = NULL;
+	
+	if (userdata_path == NULL || userdata_path[0] == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	
+	dir->path = cpstamp_resolve_path (userdata_path, ".cpstamps/");
+	if (dir->path == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	if (!cpstamp_folder_exists (dir->path) && !cpstamp_folder_create (dir->path)) {
+		err = errno;
+		free (dir->path);
+		dir->path = NULL;
+		errno = err;
+		return -1;
+	}
+
+#ifdef CPSTAMP_DIR_AT
+	dir->fd = open (dir->path, O_RDONLY | O_DIRECTORY);
+	if (dir->fd < 0) {
+		err = errno;
+		free (dir->path);
+		dir->path = NULL;
+		errno = err;
+		return -1;
+	}
+#endif
+
+	/* Sin el archivo de candados todo funciona, pero sin protección entre procesos */
+	dir->lock_fd = cpstamp_dir_open (dir, CPSTAMP_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+	dir->mutex = SDL_CreateMutex ();
+	
+	return 0;
+}
+
+/* Las claves de las categorías son nombres de archivo dentro de la carpeta.
+ * Los nombres con punto al inicio son de la librería */
+int cpstamp_dir_valid_name (const char *name) {
+	if (name == NULL || name[0] == 0 || name[0] == '.') return FALSE;
+	if (strchr (name, '/') != NULL || strchr (name, '\\') != NULL) return FALSE;
+	
+	return TRUE;
+}
+
+/* Nombre del archivo temporal donde se guarda "name" antes de renombrarlo.
+ * Empieza con punto para no confundirlo con una categoría. Liberar con free */
+char *cpstamp_dir_temp_name (const char *name) {
+	char *temp;
+	
+	temp = (char *) malloc (strlen (name) + 6);
+	if (temp == NULL) return NULL;
+	
+	sprintf (temp, ".%s.tmp", name);
+	
+	return temp;
+}
+
+int cpstamp_dir_open (CPStampDir *dir, const char *name, int flags, mode_t mode) {
+#ifdef CPSTAMP_DIR_AT
+	return openat (dir->fd, name, flags, mode);
+#else
+	char *path;
+	int fd, err;
+	
+	path = cpstamp_dir_path (dir, name);
+	if (path == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	fd = open (path, flags, mode);
+	err = errno;
+	free (path);
+	errno = err;
+	
+	return fd;
+#endif
+}
+
+int cpstamp_dir_stat (CPStampDir *dir, const char *name, struct stat *st) {
+#ifdef CPSTAMP_DIR_AT
+	return fstatat (dir->fd, name, st, 0);
+#else
+	char *path;
+	int res, err;
+	
+	path = cpstamp_dir_path (dir, name);
+	if (path == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	res = stat (path, st);
+	err = errno;
+	free (path);
+	errno = err;
+	
+	return res;
+#endif
+}
+
+/* Reemplaza "to" con "from" de forma atómica */
+int cpstamp_dir_rename (CPStampDir *dir, const char *from, const char *to) {
+#ifdef CPSTAMP_DIR_AT
+	return renameat (dir->fd, from, dir->fd, to);
+#else
+	char *path_from, *path_to;
+	int res, err;
+	
+	path_from = cpstamp_dir_path (dir, from);
+	path_to = cpstamp_dir_path (dir, to);
+	
+	if (path_from == NULL || path_to == NULL) {
+		free (path_from);
+		free (path_to);
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	#ifdef __MINGW32__
+	/* rename no reemplaza archivos existentes en Windows */
+	res = MoveFileEx (path_from, path_to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+	err = EACCES;
+	#else
+	res = rename (path_from, path_to);
+	err = errno;
+	#endif
+	
+	free (path_from);
+	free (path_to);
+	errno = err;
+	
+	return res;
+#endif
+}
+
+int cpstamp_dir_unlink (CPStampDir *dir, const char *name) {
+#ifdef CPSTAMP_DIR_AT
+	return unlinkat (dir->fd, name, 0);
+#else
+	char *path;
+	int res;
+	
+	path = cpstamp_dir_path (dir, name);
+	if (path == NULL) return -1;
+	
+	res = unlink (path);
+	free (path);
+	
+	return res;
+#endif
+}
+
+DIR *cpstamp_dir_list (CPStampDir *dir) {
+	return opendir (dir->path);
+}
+
+/* Un solo candado para todos los archivos de estampas. Los archivos se
+ * reemplazan al guardar, así que no sirve bloquear el archivo mismo */
+void cpstamp_dir_lock (CPStampDir *dir, int exclusive) {
+	if (dir->mutex != NULL) SDL_LockMutex (dir->mutex);
+	cpstamp_lock_file (dir->lock_fd, exclusive);
+}
+
+void cpstamp_dir_unlock (CPStampDir *dir) {
+	cpstamp_unlock_file (dir->lock_fd);
+	if (dir->mutex != NULL) SDL_UnlockMutex (dir->mutex);
+}
@@ -0,0 +1,58 @@
+/*
+ * dir.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_DIR_H__
+#define __CPSTAMP_DIR_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <SDL.h>
+
+/* Nombre del archivo de candados dentro de la carpeta .cpstamps */
+#define CPSTAMP_LOCK_FILE ".lock"
+
+/* La carpeta .cpstamps del usuario, se resuelve y crea una sola vez por handle.
+ * Los archivos se abren relativos a "fd" donde existe openat */
+typedef struct {
+	char *path;  /* Con la diagonal final */
+	int fd;
+	int lock_fd;
+	
+	/* Los candados de fcntl son del proceso, entre hilos se usa el mutex */
+	SDL_mutex *mutex;
+} CPStampDir;
+
+int cpstamp_dir_init (CPStampDir *dir, const char *userdata_path);
+int cpstamp_dir_valid_name (const char *name);
+char *cpstamp_dir_temp_name (const char *name);
+
+int cpstamp_dir_open (CPStampDir *dir, const char *name, int flags, mode_t mode);
+int cpstamp_dir_stat (CPStampDir *dir, const char *name, struct stat *st);
+int cpstamp_dir_rename (CPStampDir *dir, const char *from, const char *to);
+int cpstamp_dir_unlink (CPStampDir *dir, const char *name);
+DIR *cpstamp_dir_list (CPStampDir *dir);
+
+void cpstamp_dir_lock (CPStampDir *dir, int exclusive);
+void cpstamp_dir_unlock (CPStampDir *dir);
+
+#endif /* __CPSTAMP_DIR_H__ */
+
@@ -0,0 +1,570 @@
+/*
+ * gencatalog.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* cpstamp-catalog: convierte una lista de estampas en un catálogo de C con
+ * datos de sólo lectura y un hash perfecto de los ids, para usarlo con
+ * CPStamp_AttachCatalog en lugar de registrar las estampas al iniciar.
+ *
+ * Cada línea de la lista es una estampa, con los campos separados por |
+ *
+ *   id | tipo | dificultad | título | descripción | imagen
+ *
+ * El tipo es activity, game, event o pin, y la dificultad easy, normal,
+ * hard o extreme, o sus números. La descripción y la imagen son opcionales.
+ * En los textos, \| es una barra, \\ una diagonal y \n un salto de línea.
+ * Las líneas vacías y las que empiezan con # se ignoran */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "cpstamp.h"
+#include "catalog.h"
+
+/* SDL puede renombrar main, este programa no usa SDL */
+#undef main
+
+/* Cuántos desplazamientos probar por cubeta antes de rendirse */
+#define GEN_MAX_DESPLAZAMIENTO (1 << 24)
+
+typedef struct {
+	int id;
+	char *titulo;
+	char *descripcion;
+	char *imagen;
+	int categoria;
+	int dificultad;
+	int linea;
+} GenStamp;
+
+static const char *gen_tipos[NUM_STAMP_TYPE] = {"activity", "game", "event", "pin"};
+static const char *gen_tipos_c[NUM_STAMP_TYPE] = {"STAMP_TYPE_ACTIVITY", "STAMP_TYPE_GAME", "STAMP_TYPE_EVENT", "STAMP_TYPE_PIN"};
+static const char *gen_dificultades[NUM_STAMP_DIFFICULTY] = {"easy", "normal", "hard", "extreme"};
+static const char *gen_dificultades_c[NUM_STAMP_DIFFICULTY] = {"STAMP_EASY", "STAMP_NORMAL", "STAMP_HARD", "STAMP_EXTREME"};
+
+static const char *gen_archivo;
+
+static void gen_error (int linea, const char *mensaje, const char *dato) {
+	fprintf (stderr, "%s:%d: %s", gen_archivo, linea, mensaje);
+	if (dato != NULL) fprintf (stderr, " '%s'", dato);
+	fprintf (stderr, "\n");
+}
+
+/* Quita los espacios de los extremos, sobre la misma cadena */
+static char *gen_trim (char *str) {
+	char *fin;
+	
+	while (isspace ((unsigned char) *str)) str++;
+	
+	fin = str + strlen (str);
+	while (fin > str && isspace ((unsigned char) fin[-1])) fin--;
+	*fin = 0;
+	
+	return str;
+}
+
+/* Separa el siguiente campo de "*linea" en el primer | sin escapar y
+ * resuelve los escapes. Regresa NULL si ya no hay campos */
+static char *gen_field (char **linea) {
+	char *lee, *escribe, *campo;
+	
+	if (*linea == NULL) return NULL;
+	
+	campo = escribe = lee = *linea;
+	*linea = NULL;
+	
+	while (*lee != 0) {
+		if (*lee == '|') {
+			*linea = lee + 1;
+			break;
+		}
+		
+		if (*lee == '\\' && (lee[1] == '|' || lee[1] == '\\')) {
+			lee++;
+		} else if (*lee == '\\' && lee[1] == 'n') {
+			lee++;
+			*lee = '\n';
+		}
+		
+		*escribe++ = *lee++;
+	}
+	*escribe = 0;
+	
+	return gen_trim (campo);
+}
+
+/* Un nombre de la lista o su número */
+static int gen_enum (const char *str, const char **nombres, int n) {
+	char *fin;
+	long valor;
+	int g;
+	
+	for (g = 0; g < n; g++) {
+		if (strcasecmp (str, nombres[g]) == 0) return g;
+	}
+	
+	valor = strtol (str, &fin, 10);
+	if (*str == 0 || *fin != 0 || valor < 0 || valor >= n) return -1;
+	
+	return valor;
+}
+
+static char *gen_strdup_empty (const char *str) {
+	if (str == NULL || str[0] == 0) return NULL;
+	
+	return strdup (str);
+}
+
+/* Lee la lista completa. Regresa la cantidad de estampas o -1 */
+static int gen_read (FILE *f, GenStamp **lista) {
+	GenStamp *stamps, *s;
+	char buffer[4096], *linea, *campos[6];
+	int count, size, n, numero, errores;
+	long id;
+	char *fin;
+	
+	stamps = NULL;
+	count = size = 0;
+	numero = errores = 0;
+	
+	while (fgets (buffer, sizeof (buffer), f) != NULL) {
+		numero++;
+		
+		if (strchr (buffer, '\n') == NULL && !feof (f)) {
+			gen_error (numero, "line too long", NULL);
+			errores++;
+			while (fgets (buffer, sizeof (buffer), f) != NULL && strchr (buffer, '\n') == NULL);
+			continue;
+		}
+		
+		linea = gen_trim (buffer);
+		if (linea[0] == 0 || linea[0] == '#') continue;
+		
+		for (n = 0; n < 6; n++) {
+			campos[n] = gen_field (&linea);
+			if (campos[n] == NULL) break;
+		}
+		
+		if (n < 4 || linea != NULL) {
+			gen_error (numero, "expected 4 to 6 fields: id | type | difficulty | title | description | image", NULL);
+			errores++;
+			continue;
+		}
+		
+		if (count == size) {
+			size = (size > 0) ? size * 2 : 64;
+			s = (GenStamp *) realloc (stamps, size * sizeof (GenStamp));
+			if (s == NULL) {
+				perror ("realloc");
+				exit (1);
+			}
+			stamps = s;
+		}
+		
+		s = &stamps[count];
+		memset (s, 0, sizeof (GenStamp));
+		s->linea = numero;
+		
+		errno = 0;
+		id = strtol (campos[0], &fin, 0);
+		if (campos[0][0] == 0 || *fin != 0 || errno != 0 || id < INT_MIN || id > INT_MAX) {
+			gen_error (numero, "invalid id", campos[0]);
+			errores++;
+			continue;
+		}
+		s->id = id;
+		
+		s->categoria = gen_enum (campos[1], gen_tipos, NUM_STAMP_TYPE);
+		s->dificultad = gen_enum (campos[2], gen_dificultades, NUM_STAMP_DIFFICULTY);
+		if (s->categoria < 0) {
+			gen_error (numero, "unknown stamp type", campos[1]);
+			errores++;
+			continue;
+		}
+		
+		if (s->dificultad < 0) {
+			gen_error (numero, "unknown difficulty", campos[2]);
+			errores++;
+			continue;
+		}
+		
+		if (campos[3][0] == 0) {
+			gen_error (numero, "empty title", NULL);
+			errores++;
+			continue;
+		}
+		
+		s->titulo = strdup (campos[3]);
+		s->descripcion = gen_strdup_empty ((n > 4) ? campos[4] : NULL);
+		s->imagen = gen_strdup_empty ((n > 5) ? campos[5] : NULL);
+		count++;
+	}
+	
+	*lista = stamps;
+	
+	return (errores > 0) ? -1 : count;
+}
+
+static int gen_compare_ids (const void *a, const void *b) {
+	const GenStamp *sa = *(const GenStamp * const *) a;
+	const GenStamp *sb = *(const GenStamp * const *) b;
+	
+	if (sa->id != sb->id) return (sa->id < sb->id) ? -1 : 1;
+	
+	return sa->linea - sb->linea;
+}
+
+/* Regresa FALSE si algún id se repite */
+static int gen_check_ids (GenStamp *stamps, int count) {
+	GenStamp **orden;
+	char mensaje[64];
+	int g, ok;
+	
+	if (count == 0) return TRUE;
+	
+	orden = (GenStamp **) malloc (count * sizeof (GenStamp *));
+	for (g = 0; g < count; g++) orden[g] = &stamps[g];
+	qsort (orden, count, sizeof (GenStamp *), gen_compare_ids);
+	
+	ok = TRUE;
+	for (g = 1; g < count; g++) {
+		if (orden[g]->id != orden[g - 1]->id) continue;
+		
+		sprintf (mensaje, "duplicate id, first defined on line %d", orden[g - 1]->linea);
+		gen_error (orden[g]->linea, mensaje, NULL);
+		ok = FALSE;
+	}
+	
+	free (orden);
+	
+	return ok;
+}
+
+/* Arma el hash perfecto, ver catalog.c. Las cubetas más llenas buscan
+ * primero el desplazamiento con el que todos sus ids caen en lugares
+ * libres y distintos, las de un solo id toman el siguiente lugar libre.
+ * En "lugares" queda el lugar de cada estampa. Regresa FALSE si no lo encontró */
+static int gen_hash (GenStamp *stamps, int count, Sint32 *hash, int size, int *lugares) {
+	int *cubeta, *inicio, *miembros, *orden, *usado;
+	int g, h, b, n, mayor, libre, ok;
+	Uint32 d;
+	
+	cubeta = (int *) malloc (count * sizeof (int));
+	inicio = (int *) calloc (size + 1, sizeof (int));
+	miembros = (int *) malloc (count * sizeof (int));
+	orden = (int *) malloc (size * sizeof (int));
+	usado = (int *) calloc (count, sizeof (int));
+	
+	/* Agrupar los ids por cubeta */
+	for (g = 0; g < count; g++) {
+		cubeta[g] = cpstamp_catalog_hash (stamps[g].id, 0) % (Uint32) size;
+		inicio[cubeta[g] + 1]++;
+	}
+	
+	for (b = 0; b < size; b++) inicio[b + 1] += inicio[b];
+	for (g = 0; g < count; g++) miembros[inicio[cubeta[g]]++] = g;
+	for (b = size; b > 0; b--) inicio[b] = inicio[b - 1];
+	inicio[0] = 0;
+	
+	/* Las cubetas de mayor a menor, recorriéndolas una vez por tamaño */
+	mayor = 0;
+	for (b = 0; b < size; b++) {
+		if (inicio[b + 1] - inicio[b] > mayor) mayor = inicio[b + 1] - inicio[b];
+	}
+	
+	n = 0;
+	for (h = mayor; h > 0; h--) {
+		for (b = 0; b < size; b++) {
+			if (inicio[b + 1] - inicio[b] == h) orden[n++] = b;
+		}
+	}
+	
+	ok = TRUE;
+	libre = 0;
+	for (g = 0; g < size; g++) hash[g] = 0;
+	
+	for (g = 0; g < n && ok; g++) {
+		b = orden[g];
+		
+		if (inicio[b + 1] - inicio[b] == 1) {
+			while (usado[libre]) libre++;
+			
+			usado[libre] = TRUE;
+			lugares[miembros[inicio[b]]] = libre;
+			hash[b] = -(libre + 1);
+			continue;
+		}
+		
+		for (d = 1; d < GEN_MAX_DESPLAZAMIENTO; d++) {
+			for (h = inicio[b]; h < inicio[b + 1]; h++) {
+				lugares[miembros[h]] = cpstamp_catalog_hash (stamps[miembros[h]].id, d) % (Uint32) count;
+				if (usado[lugares[miembros[h]]]) break;
+				
+				/* Dos de la misma cubeta en el mismo lugar */
+				usado[lugares[miembros[h]]] = TRUE;
+			}
+			
+			if (h == inicio[b + 1]) break;
+			
+			/* Deshacer lo que se marcó con este desplazamiento */
+			while (--h >= inicio[b]) usado[lugares[miembros[h]]] = FALSE;
+		}
+		
+		if (d == GEN_MAX_DESPLAZAMIENTO) {
+			ok = FALSE;
+		} else {
+			hash[b] = d;
+		}
+	}
+	
+	free (cubeta);
+	free (inicio);
+	free (miembros);
+	free (orden);
+	free (usado);
+	
+	return ok;
+}
+
+/* Escribe la cadena como literal de C. Los bytes de UTF-8 pasan tal cual */
+static void gen_put_string (FILE *f, const char *str, int traducible) {
+	const unsigned char *c;
+	
+	if (str == NULL) {
+		fprintf (f, "NULL");
+		return;
+	}
+	
+	fprintf (f, traducible ? "N_(\"" : "\"");
+	for (c = (const unsigned char *) str; *c != 0; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf (f, "\\%c", *c);
+		} else if (*c == '\n') {
+			fprintf (f, "\\n");
+		} else if (*c == '?' && c[1] == '?') {
+			/* Evitar los trígrafos */
+			fprintf (f, "?\\");
+		} else if (*c < 32 || *c == 127) {
+			fprintf (f, "\\%03o", *c);
+		} else {
+			fputc (*c, f);
+		}
+	}
+	fprintf (f, traducible ? "\")" : "\"");
+}
+
+static void gen_write (FILE *f, const char *nombre, GenStamp *stamps, int count, Sint32 *hash, int size, int *lugares) {
+	GenStamp **orden;
+	int g;
+	
+	fprintf (f, "/* Generado por cpstamp-catalog a partir de %s, no editar */\n\n", gen_archivo);
+	fprintf (f, "#include <cpstamp.h>\n\n");
+	fprintf (f, "/* Para que xgettext encuentre los textos, con --keyword=N_ */\n");
+	fprintf (f, "#ifndef N_\n#define N_(str) str\n#endif\n\n");
+	
+	if (count > 0) {
+		/* Cada estampa en el lugar que le tocó en el hash */
+		orden = (GenStamp **) malloc (count * sizeof (GenStamp *));
+		for (g = 0; g < count; g++) orden[lugares[g]] = &stamps[g];
+		
+		fprintf (f, "static const CPStampCatalogEntry %s_entries[%d] = {\n", nombre, count);
+		for (g = 0; g < count; g++) {
+			fprintf (f, "\t{%d, ", orden[g]->id);
+			gen_put_string (f, orden[g]->titulo, TRUE);
+			fprintf (f, ", ");
+			gen_put_string (f, orden[g]->descripcion, TRUE);
+			fprintf (f, ", ");
+			gen_put_string (f, orden[g]->imagen, FALSE);
+			fprintf (f, ", %s, %s}%s\n", gen_tipos_c[orden[g]->categoria], gen_dificultades_c[orden[g]->dificultad], (g + 1 < count) ? "," : "");
+		}
+		fprintf (f, "};\n\n");
+		free (orden);
+		
+		fprintf (f, "static const Sint32 %s_hash[%d] = {", nombre, size);
+		for (g = 0; g < size; g++) {
+			fprintf (f, "%s%s%d", (g > 0) ? "," : "", (g % 16 == 0) ? "\n\t" : " ", hash[g]);
+		}
+		fprintf (f, "\n};\n\n");
+	}
+	
+	fprintf (f, "const CPStampCatalog %s = {\n", nombre);
+	fprintf (f, "\tCPSTAMP_CATALOG_VERSION,\n");
+	fprintf (f, "\t%d,\n", count);
+	if (count > 0) {
+		fprintf (f, "\t%s_entries,\n\t%d,\n\t%s_hash\n", nombre, size, nombre);
+	} else {
+		fprintf (f, "\tNULL,\n\t0,\n\tNULL\n");
+	}
+	fprintf (f, "};\n");
+}
+
+static void gen_write_header (FILE *f, const char *nombre) {
+	fprintf (f, "/* Generado por cpstamp-catalog a partir de %s, no editar */\n\n", gen_archivo);
+	fprintf (f, "#ifndef __CPSTAMP_CATALOG_%s__\n#define __CPSTAMP_CATALOG_%s__\n\n", nombre, nombre);
+	fprintf (f, "#include <cpstamp.h>\n\n");
+	fprintf (f, "extern const CPStampCatalog %s;\n\n", nombre);
+	fprintf (f, "#endif\n");
+}
+
+/* El nombre del catálogo a partir del archivo: "juego.stamps" es juego_stamps */
+static char *gen_default_name (const char *archivo) {
+	const char *base;
+	char *nombre, *c;
+	
+	base = strrchr (archivo, '/');
+	base = (base != NULL) ? base + 1 : archivo;
+	
+	nombre = (char *) malloc (strlen (base) + 2);
+	sprintf (nombre, "%s%s", isdigit ((unsigned char) base[0]) ? "_" : "", base);
+	
+	c = strrchr (nombre, '.');
+	if (c != NULL && c != nombre) *c = 0;
+	
+	for (c = nombre; *c != 0; c++) {
+		if (!isalnum ((unsigned char) *c)) *c = '_';
+	}
+	
+	return nombre;
+}
+
+static int gen_valid_name (const char *nombre) {
+	const char *c;
+	
+	if (nombre[0] == 0 || isdigit ((unsigned char) nombre[0])) return FALSE;
+	
+	for (c = nombre; *c != 0; c++) {
+		if (!isalnum ((unsigned char) *c) && *c != '_') return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static FILE *gen_open_output (const char *archivo) {
+	FILE *f;
+	
+	if (archivo == NULL || strcmp (archivo, "-") == 0) return stdout;
+	
+	f = fopen (archivo, "w");
+	if (f == NULL) {
+		perror (archivo);
+		exit (1);
+	}
+	
+	return f;
+}
+
+static void gen_usage (const char *programa) {
+	fprintf (stderr, "Usage: %s [-n name] [-H header.h] stamps.txt [catalog.c]\n", programa);
+	fprintf (stderr, "Generates a static stamp catalog for CPStamp_AttachCatalog.\n");
+	exit (2);
+}
+
+int main (int argc, char **argv) {
+	GenStamp *stamps;
+	Sint32 *hash;
+	const char *nombre, *cabecera, *salida;
+	char *nombre_auto;
+	int *lugares;
+	int g, count, size;
+	FILE *f;
+	
+	nombre = cabecera = salida = NULL;
+	gen_archivo = NULL;
+	
+	for (g = 1; g < argc; g++) {
+		if (strcmp (argv[g], "-n") == 0 && g + 1 < argc) {
+			nombre = argv[++g];
+		} else if (strcmp (argv[g], "-H") == 0 && g + 1 < argc) {
+			cabecera = argv[++g];
+		} else if (argv[g][0] == '-' && argv[g][1] != 0) {
+			gen_usage (argv[0]);
+		} else if (gen_archivo == NULL) {
+			gen_archivo = argv[g];
+		} else if (salida == NULL) {
+			salida = argv[g];
+		} else {
+			gen_usage (argv[0]);
+		}
+	}
+	
+	if (gen_archivo == NULL) gen_usage (argv[0]);
+	
+	nombre_auto = gen_default_name (gen_archivo);
+	if (nombre == NULL) nombre = nombre_auto;
+	
+	if (!gen_valid_name (nombre)) {
+		fprintf (stderr, "%s: '%s' is not a valid C identifier, use -n\n", argv[0], nombre);
+		return 1;
+	}
+	
+	f = (strcmp (gen_archivo, "-") == 0) ? stdin : fopen (gen_archivo, "r");
+	if (f == NULL) {
+		perror (gen_archivo);
+		return 1;
+	}
+	
+	count = gen_read (f, &stamps);
+	if (f != stdin) fclose (f);
+	
+	if (count < 0 || !gen_check_ids (stamps, count)) return 1;
+	
+	/* Una cubeta por estampa, casi todas quedan con uno o dos ids */
+	size = (count > 0) ? count : 1;
+	hash = (Sint32 *) malloc (size * sizeof (Sint32));
+	lugares = (int *) malloc (size * sizeof (int));
+	
+	if (count > 0 && !gen_hash (stamps, count, hash, size, lugares)) {
+		fprintf (stderr, "%s: could not build a perfect hash for %s\n", argv[0], gen_archivo);
+		return 1;
+	}
+	
+	f = gen_open_output (salida);
+	gen_write (f, nombre, stamps, count, hash, size, lugares);
+	if (f != stdout && fclose (f) != 0) {
+		perror (salida);
+		return 1;
+	}
+	
+	if (cabecera != NULL) {
+		f = gen_open_output (cabecera);
+		gen_write_header (f, nombre);
+		if (f != stdout && fclose (f) != 0) {
+			perror (cabecera);
+			return 1;
+		}
+	}
+	
+	for (g = 0; g < count; g++) {
+		free (stamps[g].titulo);
+		free (stamps[g].descripcion);
+		free (stamps[g].imagen);
+	}
+	free (stamps);
+	free (hash);
+	free (lugares);
+	free (nombre_auto);
+	
+	return 0;
+}
+
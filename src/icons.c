@@ -0,0 +1,242 @@
+/*
+ * icons.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SDL_IMAGE
+#include <SDL_image.h>
+#endif
+
+#include "icons.h"
+#include "blend.h"
+
+/* Máximo de entradas, incluyendo las imágenes que no se pudieron cargar */
+#define MAX_ENTRIES 64
+
+typedef struct _CPStampIcon {
+	char *path;
+	SDL_Surface *surface; /* NULL si la imagen no se pudo cargar */
+	int bytes;
+	
+	struct _CPStampIcon *prev, *sig;
+} CPStampIcon;
+
+struct _CPStampIconCache {
+	/* La primera entrada es la usada más recientemente */
+	CPStampIcon *first, *last;
+	
+	int n_entries;
+	int bytes, max_bytes;
+	
+	/* Las imágenes se guardan ya escaladas, en porcentaje */
+	int scale;
+};
+
+static void cpstamp_icon_unlink (CPStampIconCache *cache, CPStampIcon *icon) {
+	if (icon->prev != NULL) {
+		icon->prev->sig = icon->sig;
+	} else {
+		cache->first = icon->sig;
+	}
+	
+	if (icon->sig != NULL) {
+		icon->sig->prev = icon->prev;
+	} else {
+		cache->last = icon->prev;
+	}
+	
+	icon->prev = icon->sig = NULL;
+}
+
+static void cpstamp_icon_push_front (CPStampIconCache *cache, CPStampIcon *icon) {
+	icon->prev = NULL;
+	icon->sig = cache->first;
+	
+	if (cache->first != NULL) {
+		cache->first->prev = icon;
+	} else {
+		cache->last = icon;
+	}
+	
+	cache->first = icon;
+}
+
+static void cpstamp_icon_destroy (CPStampIconCache *cache, CPStampIcon *icon) {
+	cpstamp_icon_unlink (cache, icon);
+	
+	cache->bytes -= icon->bytes;
+	cache->n_entries--;
+	
+	/* Si alguien conserva una referencia a la superficie, SDL sólo decrementa el contador */
+	if (icon->surface != NULL) SDL_FreeSurface (icon->surface);
+	free (icon->path);
+	free (icon);
+}
+
+/* Eliminar las entradas menos usadas hasta respetar el límite, sin tocar a "keep" */
+static void cpstamp_icon_cache_trim (CPStampIconCache *cache, CPStampIcon *keep) {
+	CPStampIcon *icon, *prev;
+	
+	icon = cache->last;
+	while (icon != NULL && (cache->bytes > cache->max_bytes || cache->n_entries > MAX_ENTRIES)) {
+		prev = icon->prev;
+		
+		if (icon != keep) {
+			cpstamp_icon_destroy (cache, icon);
+		}
+		
+		icon = prev;
+	}
+}
+
+static CPStampIcon *cpstamp_icon_cache_lookup (CPStampIconCache *cache, const char *path) {
+	CPStampIcon *icon;
+	SDL_Surface *scaled;
+	
+	icon = cache->first;
+	while (icon != NULL) {
+		if (strcmp (icon->path, path) == 0) {
+			/* Moverlo al frente, es el más reciente */
+			if (icon != cache->first) {
+				cpstamp_icon_unlink (cache, icon);
+				cpstamp_icon_push_front (cache, icon);
+			}
+			return icon;
+		}
+		
+		icon = icon->sig;
+	}
+	
+	/* No está en caché, cargar la imagen */
+	icon = (CPStampIcon *) malloc (sizeof (CPStampIcon));
+	
+	if (icon == NULL) return NULL;
+	
+	icon->path = strdup (path);
+	if (icon->path == NULL) {
+		free (icon);
+		return NULL;
+	}
+
+#ifdef HAVE_SDL_IMAGE
+	icon->surface = cpstamp_blend_convert (IMG_Load (path));
+#else
+	/* Sin SDL_image sólo se pueden cargar imágenes BMP */
+	icon->surface = cpstamp_blend_convert (SDL_LoadBMP (path));
+#endif
+
+	if (icon->surface != NULL && cache->scale != 100) {
+		scaled = cpstamp_blend_scale (icon->surface, (icon->surface->w * cache->scale + 50) / 100, (icon->surface->h * cache->scale + 50) / 100);
+		
+		if (scaled != NULL) {
+			SDL_FreeSurface (icon->surface);
+			icon->surface = scaled;
+		}
+	}
+	icon->bytes = 0;
+	
+	if (icon->surface != NULL) {
+		icon->bytes = icon->surface->h * icon->surface->pitch;
+	}
+	
+	cpstamp_icon_push_front (cache, icon);
+	cache->bytes += icon->bytes;
+	cache->n_entries++;
+	
+	cpstamp_icon_cache_trim (cache, icon);
+	
+	return icon;
+}
+
+CPStampIconCache *cpstamp_icon_cache_new (int max_bytes) {
+	CPStampIconCache *cache;
+	
+	cache = (CPStampIconCache *) malloc (sizeof (CPStampIconCache));
+	
+	if (cache == NULL) return NULL;
+	
+	cache->first = cache->last = NULL;
+	cache->n_entries = 0;
+	cache->bytes = 0;
+	cache->max_bytes = max_bytes;
+	cache->scale = 100;
+	
+	return cache;
+}
+
+void cpstamp_icon_cache_set_size (CPStampIconCache *cache, int max_bytes) {
+	if (cache == NULL) return;
+	
+	cache->max_bytes = max_bytes;
+	cpstamp_icon_cache_trim (cache, NULL);
+}
+
+/* Regresa la imagen desde el caché, o NULL si no se pudo cargar.
+ * La superficie pertenece al caché, quien la quiera conservar debe incrementar su refcount */
+SDL_Surface *cpstamp_icon_cache_get (CPStampIconCache *cache, const char *path) {
+	CPStampIcon *icon;
+	
+	if (cache == NULL || path == NULL) return NULL;
+	
+	icon = cpstamp_icon_cache_lookup (cache, path);
+	
+	if (icon == NULL) return NULL;
+	
+	return icon->surface;
+}
+
+void cpstamp_icon_cache_prefetch (CPStampIconCache *cache, const char *path) {
+	if (cache == NULL || path == NULL) return;
+	
+	cpstamp_icon_cache_lookup (cache, path);
+}
+
+/* Vacía el caché. Las superficies con referencias siguen vivas hasta que las suelten */
+void cpstamp_icon_cache_clear (CPStampIconCache *cache) {
+	if (cache == NULL) return;
+	
+	while (cache->first != NULL) {
+		cpstamp_icon_destroy (cache, cache->first);
+	}
+}
+
+/* Cambiar la escala descarta las imágenes cargadas a la escala anterior */
+void cpstamp_icon_cache_set_scale (CPStampIconCache *cache, int scale) {
+	if (cache == NULL || cache->scale == scale) return;
+	
+	cpstamp_icon_cache_clear (cache);
+	cache->scale = scale;
+}
+
+void cpstamp_icon_cache_free (CPStampIconCache *cache) {
+	if (cache == NULL) return;
+	
+	cpstamp_icon_cache_clear (cache);
+	
+	free (cache);
+}
+
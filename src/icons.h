@@ -0,0 +1,40 @@
+/*
+ * icons.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_ICONS_H__
+#define __CPSTAMP_ICONS_H__
+
+#include <SDL.h>
+
+/* Tamaño por defecto del caché de iconos, en bytes */
+#define CPSTAMP_ICON_CACHE_SIZE (1024 * 1024)
+
+typedef struct _CPStampIconCache CPStampIconCache;
+
+CPStampIconCache *cpstamp_icon_cache_new (int max_bytes);
+void cpstamp_icon_cache_set_size (CPStampIconCache *cache, int max_bytes);
+void cpstamp_icon_cache_set_scale (CPStampIconCache *cache, int scale);
+SDL_Surface *cpstamp_icon_cache_get (CPStampIconCache *cache, const char *path);
+void cpstamp_icon_cache_prefetch (CPStampIconCache *cache, const char *path);
+void cpstamp_icon_cache_clear (CPStampIconCache *cache);
+void cpstamp_icon_cache_free (CPStampIconCache *cache);
+
+#endif /* __CPSTAMP_ICONS_H__ */
+
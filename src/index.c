@@ -0,0 +1,313 @@
+/*
+ * index.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Índice con el resumen de todas las categorías del usuario, para mostrar
+ * el progreso general sin abrir cada archivo de estampas */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <SDL.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "dir.h"
+#include "index.h"
+
+typedef struct {
+	const char *data;
+	size_t len, pos;
+} CPStampIndexReader;
+
+static int cpstamp_index_read (CPStampIndexReader *r, void *dest, size_t len) {
+	if (r->len - r->pos < len) return FALSE;
+	
+	memcpy (dest, &r->data[r->pos], len);
+	r->pos += len;
+	
+	return TRUE;
+}
+
+static char *cpstamp_index_read_string (CPStampIndexReader *r) {
+	uint32_t len;
+	char *str;
+	
+	if (!cpstamp_index_read (r, &len, sizeof (len)) || r->len - r->pos < len) return NULL;
+	
+	str = (char *) malloc (len + 1);
+	if (str == NULL) return NULL;
+	
+	memcpy (str, &r->data[r->pos], len);
+	str[len] = 0;
+	r->pos += len;
+	
+	return str;
+}
+
+static void cpstamp_index_free_entry (CPStampIndexEntry *entry) {
+	free (entry->clave);
+	free (entry->nombre);
+}
+
+/* Interpretar el índice. Un índice dañado o de otra versión se descarta,
+ * porque se puede reconstruir desde los archivos de las categorías */
+static void cpstamp_index_parse (CPStampIndex *index, const char *data, size_t len) {
+	CPStampIndexReader r;
+	CPStampIndexEntry entry;
+	uint32_t version, count, temp;
+	uint32_t g;
+	
+	r.data = data;
+	r.len = len;
+	r.pos = 0;
+	
+	if (!cpstamp_index_read (&r, &version, sizeof (version)) || version != CPSTAMP_INDEX_VERSION) return;
+	if (!cpstamp_index_read (&r, &count, sizeof (count))) return;
+	
+	for (g = 0; g < count; g++) {
+		memset (&entry, 0, sizeof (entry));
+		
+		entry.clave = cpstamp_index_read_string (&r);
+		entry.nombre = cpstamp_index_read_string (&r);
+		
+		if (entry.clave == NULL || entry.nombre == NULL ||
+		    !cpstamp_index_read (&r, &temp, sizeof (temp)) ||
+		    !cpstamp_index_read (&r, entry.counts, sizeof (entry.counts)) ||
+		    !cpstamp_index_read (&r, &entry.file_size, sizeof (entry.file_size)) ||
+		    !cpstamp_index_read (&r, &entry.file_mtime, sizeof (entry.file_mtime)) ||
+		    !cpstamp_index_read (&r, &entry.file_mtime_nsec, sizeof (entry.file_mtime_nsec))) {
+			/* Archivo cortado, lo que falta se reconstruye */
+			cpstamp_index_free_entry (&entry);
+			index->dirty = TRUE;
+			return;
+		}
+		
+		entry.categoria = (temp < NUM_STAMP_TYPE) ? temp : STAMP_TYPE_ACTIVITY;
+		
+		if (cpstamp_index_find (index, entry.clave) != NULL || cpstamp_index_add (index, NULL) == NULL) {
+			cpstamp_index_free_entry (&entry);
+			continue;
+		}
+		
+		index->entries[index->count - 1] = entry;
+	}
+}
+
+/* Abre el índice y lo bloquea hasta cpstamp_index_close. Si el archivo
+ * no se puede abrir, o "dir" es NULL porque las categorías no están en
+ * archivos, el índice queda vacío y sólo se usa en memoria */
+int cpstamp_index_open (CPStampIndex *index, CPStampDir *dir, CPStampStats *stats) {
+	struct stat st;
+	char *data;
+	size_t len;
+	
+	index->entries = NULL;
+	index->count = index->size = 0;
+	index->dirty = FALSE;
+	index->fd = -1;
+	index->mutex = NULL;
+	
+	if (dir == NULL) return -1;
+	
+	/* El hilo de guardado también actualiza el índice */
+	index->mutex = dir->mutex;
+	if (index->mutex != NULL) SDL_LockMutex (index->mutex);
+	
+	index->fd = cpstamp_dir_open (dir, CPSTAMP_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+	stats->read_syscalls++;
+	
+	if (index->fd < 0) {
+		if (index->mutex != NULL) SDL_UnlockMutex (index->mutex);
+		index->mutex = NULL;
+		return -1;
+	}
+	
+	cpstamp_lock_file (index->fd, TRUE);
+	stats->read_syscalls++;
+	
+	data = cpstamp_read_file (index->fd, &st, &len, stats);
+	cpstamp_index_parse (index, data, len);
+	free (data);
+	
+	return 0;
+}
+
+CPStampIndexEntry *cpstamp_index_find (CPStampIndex *index, const char *clave) {
+	int g;
+	
+	for (g = 0; g < index->count; g++) {
+		if (strcmp (index->entries[g].clave, clave) == 0) return &index->entries[g];
+	}
+	
+	return NULL;
+}
+
+/* Regresa la entrada de "clave", creándola vacía si no existe */
+CPStampIndexEntry *cpstamp_index_add (CPStampIndex *index, const char *clave) {
+	CPStampIndexEntry *entry, *nuevas;
+	int size;
+	
+	if (clave != NULL) {
+		entry = cpstamp_index_find (index, clave);
+		if (entry != NULL) return entry;
+	}
+	
+	if (index->count == index->size) {
+		size = (index->size > 0) ? index->size * 2 : 16;
+		nuevas = (CPStampIndexEntry *) realloc (index->entries, size * sizeof (CPStampIndexEntry));
+		
+		if (nuevas == NULL) return NULL;
+		
+		index->entries = nuevas;
+		index->size = size;
+	}
+	
+	entry = &index->entries[index->count];
+	memset (entry, 0, sizeof (CPStampIndexEntry));
+	
+	if (clave != NULL) {
+		entry->clave = strdup (clave);
+		if (entry->clave == NULL) return NULL;
+		
+		index->dirty = TRUE;
+	}
+	
+	index->count++;
+	
+	return entry;
+}
+
+void cpstamp_index_remove (CPStampIndex *index, CPStampIndexEntry *entry) {
+	int pos;
+	
+	pos = entry - index->entries;
+	cpstamp_index_free_entry (entry);
+	
+	index->count--;
+	if (pos < index->count) {
+		index->entries[pos] = index->entries[index->count];
+	}
+	
+	index->dirty = TRUE;
+}
+
+static const char *cpstamp_index_nombre (CPStampIndexEntry *entry) {
+	return (entry->nombre != NULL) ? entry->nombre : "";
+}
+
+static void cpstamp_index_append (char *buf, size_t *pos, const void *data, size_t len) {
+	memcpy (&buf[*pos], data, len);
+	*pos += len;
+}
+
+/* Escribe el índice si cambió, en una sola llamada a write, y lo libera */
+void cpstamp_index_close (CPStampIndex *index, CPStampStats *stats) {
+	CPStampIndexEntry *entry;
+	char *buf;
+	size_t len, pos;
+	uint32_t temp;
+	ssize_t res;
+	int g;
+	
+	if (index->fd >= 0 && index->dirty) {
+		len = 2 * sizeof (uint32_t);
+		for (g = 0; g < index->count; g++) {
+			entry = &index->entries[g];
+			len += 3 * sizeof (uint32_t) + strlen (entry->clave) + strlen (cpstamp_index_nombre (entry));
+			len += sizeof (entry->counts) + sizeof (entry->file_size) + sizeof (entry->file_mtime) + sizeof (entry->file_mtime_nsec);
+		}
+		
+		buf = (char *) malloc (len);
+		
+		if (buf != NULL) {
+			pos = 0;
+			temp = CPSTAMP_INDEX_VERSION;
+			cpstamp_index_append (buf, &pos, &temp, sizeof (temp));
+			temp = index->count;
+			cpstamp_index_append (buf, &pos, &temp, sizeof (temp));
+			
+			for (g = 0; g < index->count; g++) {
+				entry = &index->entries[g];
+				
+				temp = strlen (entry->clave);
+				cpstamp_index_append (buf, &pos, &temp, sizeof (temp));
+				cpstamp_index_append (buf, &pos, entry->clave, temp);
+				
+				temp = strlen (cpstamp_index_nombre (entry));
+				cpstamp_index_append (buf, &pos, &temp, sizeof (temp));
+				cpstamp_index_append (buf, &pos, cpstamp_index_nombre (entry), temp);
+				
+				temp = entry->categoria;
+				cpstamp_index_append (buf, &pos, &temp, sizeof (temp));
+				cpstamp_index_append (buf, &pos, entry->counts, sizeof (entry->counts));
+				cpstamp_index_append (buf, &pos, &entry->file_size, sizeof (entry->file_size));
+				cpstamp_index_append (buf, &pos, &entry->file_mtime, sizeof (entry->file_mtime));
+				cpstamp_index_append (buf, &pos, &entry->file_mtime_nsec, sizeof (entry->file_mtime_nsec));
+			}
+			
+			lseek (index->fd, 0, SEEK_SET);
+			ftruncate (index->fd, 0);
+			
+			pos = 0;
+			while (pos < len) {
+				res = write (index->fd, &buf[pos], len - pos);
+				stats->write_syscalls++;
+				
+				if (res < 0 && errno == EINTR) continue;
+				if (res <= 0) break;
+				
+				pos += res;
+				stats->written_bytes += res;
+			}
+			
+			stats->write_syscalls += 2;
+			free (buf);
+		}
+	}
+	
+	if (index->fd >= 0) {
+		/* Cerrar también suelta el candado */
+		close (index->fd);
+		stats->write_syscalls++;
+	}
+	
+	if (index->mutex != NULL) SDL_UnlockMutex (index->mutex);
+	index->mutex = NULL;
+	
+	for (g = 0; g < index->count; g++) {
+		cpstamp_index_free_entry (&index->entries[g]);
+	}
+	
+	free (index->entries);
+	index->entries = NULL;
+	index->count = index->size = 0;
+	index->fd = -1;
+}
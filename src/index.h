@@ -0,0 +1,67 @@
+/*
+ * index.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_INDEX_H__
+#define __CPSTAMP_INDEX_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "dir.h"
+
+#define CPSTAMP_INDEX_VERSION 1
+
+/* Nombre del índice dentro de la carpeta .cpstamps */
+#define CPSTAMP_INDEX_FILE ".index"
+
+/* Resumen de una categoría guardado en el índice */
+typedef struct {
+	char *clave;
+	char *nombre;
+	int categoria;
+	
+	/* Estampas por tipo y dificultad, [0] todas y [1] las ganadas */
+	Uint32 counts[NUM_STAMP_TYPE][NUM_STAMP_DIFFICULTY][2];
+	
+	/* El archivo de la categoría cuando se calculó el resumen */
+	Sint64 file_size, file_mtime;
+	Uint32 file_mtime_nsec;
+	
+	/* Para encontrar las entradas cuyo archivo ya no existe */
+	int seen;
+} CPStampIndexEntry;
+
+typedef struct {
+	CPStampIndexEntry *entries;
+	int count, size;
+	
+	int fd;
+	int dirty;
+	SDL_mutex *mutex;
+} CPStampIndex;
+
+int cpstamp_index_open (CPStampIndex *index, CPStampDir *dir, CPStampStats *stats);
+CPStampIndexEntry *cpstamp_index_find (CPStampIndex *index, const char *clave);
+CPStampIndexEntry *cpstamp_index_add (CPStampIndex *index, const char *clave);
+void cpstamp_index_remove (CPStampIndex *index, CPStampIndexEntry *entry);
+void cpstamp_index_close (CPStampIndex *index, CPStampStats *stats);
+
+#endif /* __CPSTAMP_INDEX_H__ */
+
@@ -0,0 +1,493 @@
+/*
+ * live.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Estado de las estampas en memoria compartida, para que otros procesos
+ * (un lanzador, un panel) vean lo que se gana sin leer archivos.
+ *
+ * El segmento tiene un encabezado, los ids de las estampas y un bit por
+ * estampa ganada. La generación es un contador de secuencia: es impar
+ * mientras el juego escribe, así que quien lee sin candado repite si la
+ * vio impar o si cambió mientras leía */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined (HAVE_SHM_OPEN) && defined (HAVE_SYS_MMAN_H)
+#define CPSTAMP_LIVE 1
+#include <sys/mman.h>
+#endif
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "dir.h"
+#include "live.h"
+
+#define CPSTAMP_LIVE_MAGIC 0x4C535043 /* "CPSL" */
+
+/* Cuántas veces reintentar una lectura antes de rendirse */
+#define CPSTAMP_LIVE_RETRIES 1000
+
+#if defined (__GNUC__) || defined (__clang__)
+#define CPSTAMP_LIVE_BARRIER() __sync_synchronize ()
+#else
+#define CPSTAMP_LIVE_BARRIER()
+#endif
+
+typedef struct {
+	Uint32 magic;
+	Uint32 version;
+	volatile Uint32 generation;
+	Uint32 count;
+	Uint32 capacity;
+	
+	/* 0 cuando el juego cerró la categoría */
+	Uint32 activa;
+} CPStampLiveHeader;
+
+struct _CPStampLive {
+	char *name;
+	int fd;
+	int writable;
+	
+	CPStampLiveHeader *header;
+	size_t size;
+};
+
+#ifdef CPSTAMP_LIVE
+/* Después del encabezado van los ids y luego los bits */
+static Sint32 *cpstamp_live_ids (CPStampLiveHeader *header) {
+	return (Sint32 *) (header + 1);
+}
+
+/* "capacity" es la del mapeo de quien llama, no se vuelve a leer del encabezado */
+static Uint32 *cpstamp_live_bits (CPStampLiveHeader *header, Uint32 capacity) {
+	return (Uint32 *) (cpstamp_live_ids (header) + capacity);
+}
+
+static size_t cpstamp_live_size (Uint32 capacity) {
+	return sizeof (CPStampLiveHeader) + capacity * sizeof (Sint32) + ((capacity + 31) / 32) * sizeof (Uint32);
+}
+
+/* Un segmento por usuario y categoría. Liberar con free */
+static char *cpstamp_live_name (const char *clave) {
+	char *name;
+	
+	name = (char *) malloc (strlen (clave) + 32);
+	if (name == NULL) return NULL;
+	
+	sprintf (name, "/cpstamp-%lu-%s", (unsigned long) getuid (), clave);
+	
+	return name;
+}
+
+static void cpstamp_live_write_begin (CPStampLive *live) {
+	live->header->generation++;
+	CPSTAMP_LIVE_BARRIER ();
+}
+
+static void cpstamp_live_write_end (CPStampLive *live) {
+	CPSTAMP_LIVE_BARRIER ();
+	live->header->generation++;
+}
+
+/* Vuelve a mapear el segmento con "size" bytes */
+static int cpstamp_live_map (CPStampLive *live, size_t size) {
+	void *mapa;
+	
+	mapa = mmap (NULL, size, live->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, live->fd, 0);
+	if (mapa == MAP_FAILED) return -1;
+	
+	if (live->header != NULL) munmap (live->header, live->size);
+	live->header = (CPStampLiveHeader *) mapa;
+	live->size = size;
+	
+	return 0;
+}
+
+static void cpstamp_live_set_bit (CPStampLiveHeader *header, int pos, int ganada) {
+	Uint32 *bits = cpstamp_live_bits (header, header->capacity);
+	
+	if (ganada) {
+		bits[pos / 32] |= 1U << (pos % 32);
+	} else {
+		bits[pos / 32] &= ~(1U << (pos % 32));
+	}
+}
+#endif
+
+/* Crea el segmento de la categoría y le copia su estado. Uno que ya exista
+ * puede ser de otro usuario o de un juego que terminó mal, y alguien más lo
+ * podría recortar mientras lo usamos. Se borra y se crea uno nuevo, sólo
+ * para nosotros. Quien tenía abierto el anterior lo tiene que volver a abrir */
+CPStampLive *cpstamp_live_create (const char *clave, const CPStampTable *t) {
+#ifdef CPSTAMP_LIVE
+	CPStampLive *live;
+	int err;
+	
+	live = (CPStampLive *) calloc (1, sizeof (CPStampLive));
+	if (live == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	live->writable = TRUE;
+	live->name = cpstamp_live_name (clave);
+	if (live->name != NULL) shm_unlink (live->name);
+	live->fd = (live->name != NULL) ? shm_open (live->name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+	
+	if (live->fd < 0) {
+		err = (live->name != NULL) ? errno : ENOMEM;
+		free (live->name);
+		free (live);
+		errno = err;
+		return NULL;
+	}
+	
+	cpstamp_live_fill (live, t);
+	
+	if (live->header == NULL) {
+		err = errno;
+		cpstamp_live_destroy (live);
+		errno = err;
+		return NULL;
+	}
+	
+	return live;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+/* Copia todo el estado, al compartir, al crecer y al borrar lo ganado */
+void cpstamp_live_fill (CPStampLive *live, const CPStampTable *t) {
+#ifdef CPSTAMP_LIVE
+	CPStampLiveHeader *header;
+	Uint32 capacity;
+	size_t size;
+	int g;
+	
+	capacity = 64;
+	while (capacity < (Uint32) t->count) capacity *= 2;
+	size = cpstamp_live_size (capacity);
+	
+	/* Quien lee ve el tamaño nuevo hasta que cambia la capacidad, y para
+	 * entonces el segmento ya creció */
+	if (size > live->size) {
+		if (ftruncate (live->fd, size) < 0) return;
+		if (cpstamp_live_map (live, size) < 0) return;
+	} else {
+		capacity = live->header->capacity;
+	}
+	
+	header = live->header;
+	cpstamp_live_write_begin (live);
+	
+	header->magic = CPSTAMP_LIVE_MAGIC;
+	header->version = CPSTAMP_LIVE_VERSION;
+	header->capacity = capacity;
+	header->count = t->count;
+	header->activa = TRUE;
+	
+	memset (cpstamp_live_bits (header, capacity), 0, ((capacity + 31) / 32) * sizeof (Uint32));
+	for (g = 0; g < t->count; g++) {
+		cpstamp_live_ids (header)[g] = t->ids[g];
+		if (t->ganadas[g]) cpstamp_live_set_bit (header, g, TRUE);
+	}
+	
+	cpstamp_live_write_end (live);
+#endif
+}
+
+/* Agrega las estampas registradas desde la última vez */
+void cpstamp_live_update (CPStampLive *live, const CPStampTable *t) {
+#ifdef CPSTAMP_LIVE
+	CPStampLiveHeader *header = live->header;
+	int g;
+	
+	if ((Uint32) t->count > header->capacity) {
+		cpstamp_live_fill (live, t);
+		return;
+	}
+	
+	if ((Uint32) t->count == header->count) return;
+	
+	cpstamp_live_write_begin (live);
+	for (g = header->count; g < t->count; g++) {
+		cpstamp_live_ids (header)[g] = t->ids[g];
+		cpstamp_live_set_bit (header, g, t->ganadas[g]);
+	}
+	header->count = t->count;
+	cpstamp_live_write_end (live);
+#endif
+}
+
+void cpstamp_live_earn (CPStampLive *live, int pos) {
+#ifdef CPSTAMP_LIVE
+	if (pos < 0 || (Uint32) pos >= live->header->count) return;
+	
+	cpstamp_live_write_begin (live);
+	cpstamp_live_set_bit (live->header, pos, TRUE);
+	cpstamp_live_write_end (live);
+#endif
+}
+
+/* Al cerrar la categoría, quien lee sabe que ya no cambiará.
+ * El nombre se borra, quien ya lo tiene abierto lo sigue viendo */
+void cpstamp_live_destroy (CPStampLive *live) {
+#ifdef CPSTAMP_LIVE
+	if (live->writable && live->header != NULL) {
+		cpstamp_live_write_begin (live);
+		live->header->activa = FALSE;
+		cpstamp_live_write_end (live);
+	}
+	
+	if (live->writable && live->name != NULL) shm_unlink (live->name);
+	if (live->header != NULL) munmap (live->header, live->size);
+	if (live->fd >= 0) close (live->fd);
+#endif
+	free (live->name);
+	free (live);
+}
+
+/* Comparte el estado de la categoría en memoria, hasta cerrarla */
+int CPStamp_ShareCategory (CPStampCategory *cat) {
+	if (cat == NULL) return -1;
+	if (cat->live != NULL) return 0;
+	
+	cat->live = cpstamp_live_create (cat->clave, &cat->estampas);
+	
+	return (cat->live != NULL) ? 0 : -1;
+}
+
+/* Abre el estado que comparte el juego con la categoría "clave", en otro
+ * proceso. No necesita CPStamp_Init. Regresa NULL con errno si el juego
+ * no lo comparte, o en EACCES si el segmento es de otro usuario */
+CPStampLive *CPStamp_LiveOpen (const char *clave) {
+#ifdef CPSTAMP_LIVE
+	CPStampLive *live;
+	struct stat st;
+	int err;
+	
+	if (!cpstamp_dir_valid_name (clave)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	live = (CPStampLive *) calloc (1, sizeof (CPStampLive));
+	if (live == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	live->name = cpstamp_live_name (clave);
+	live->fd = (live->name != NULL) ? shm_open (live->name, O_RDONLY, 0) : -1;
+	
+	err = ENOENT;
+	if (live->fd < 0) {
+		err = (live->name != NULL) ? errno : ENOMEM;
+	} else if (fstat (live->fd, &st) < 0) {
+		err = errno;
+	} else if (st.st_uid != geteuid ()) {
+		/* No lo creó un juego nuestro, podría cambiar de tamaño bajo nosotros */
+		err = EACCES;
+	} else if ((size_t) st.st_size >= cpstamp_live_size (0)) {
+		if (cpstamp_live_map (live, st.st_size) == 0 && live->header->magic == CPSTAMP_LIVE_MAGIC && live->header->version == CPSTAMP_LIVE_VERSION) {
+			return live;
+		}
+		err = EINVAL;
+	}
+	
+	CPStamp_LiveClose (live);
+	errno = err;
+	return NULL;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+void CPStamp_LiveClose (CPStampLive *live) {
+	if (live == NULL) return;
+	
+	cpstamp_live_destroy (live);
+}
+
+#ifdef CPSTAMP_LIVE
+/* Empieza una lectura: espera a que el juego no esté escribiendo y mapea
+ * de nuevo si el segmento creció. Regresa la generación o -1, y en "capacity"
+ * la capacidad que cabe en el mapeo. El juego puede crecer el segmento en
+ * cualquier momento, así que los índices se calculan sólo con esta copia */
+static Sint64 cpstamp_live_read_begin (CPStampLive *live, Uint32 *capacity) {
+	struct stat st;
+	Uint32 gen;
+	int intento;
+	
+	for (intento = 0; intento < CPSTAMP_LIVE_RETRIES; intento++) {
+		gen = live->header->generation;
+		CPSTAMP_LIVE_BARRIER ();
+		
+		if (gen & 1) continue;
+		
+		*capacity = ((volatile CPStampLiveHeader *) live->header)->capacity;
+		if (cpstamp_live_size (*capacity) > live->size) {
+			if (fstat (live->fd, &st) < 0 || cpstamp_live_map (live, st.st_size) < 0) return -1;
+			continue;
+		}
+		
+		return gen;
+	}
+	
+	errno = EAGAIN;
+	return -1;
+}
+
+/* TRUE si nadie escribió ni creció el segmento durante la lectura */
+static int cpstamp_live_read_end (CPStampLive *live, Uint32 gen, Uint32 capacity) {
+	CPSTAMP_LIVE_BARRIER ();
+	
+	return live->header->generation == gen && live->header->capacity == capacity;
+}
+
+/* Cuántas estampas leer, nunca más de las que caben en "capacity" */
+static Uint32 cpstamp_live_count (CPStampLive *live, Uint32 capacity) {
+	Uint32 count;
+	
+	count = ((volatile CPStampLiveHeader *) live->header)->count;
+	
+	return (count < capacity) ? count : capacity;
+}
+#endif
+
+/* Cambia cada vez que se gana o registra una estampa. 0 si el juego ya
+ * cerró la categoría */
+Uint32 CPStamp_LiveGeneration (CPStampLive *live) {
+#ifdef CPSTAMP_LIVE
+	Sint64 gen;
+	Uint32 capacity;
+	int activa, intento;
+	
+	if (live == NULL) return 0;
+	
+	for (intento = 0; intento < CPSTAMP_LIVE_RETRIES; intento++) {
+		gen = cpstamp_live_read_begin (live, &capacity);
+		if (gen < 0) return 0;
+		
+		activa = live->header->activa;
+		if (cpstamp_live_read_end (live, gen, capacity)) return activa ? (Uint32) gen / 2 : 0;
+	}
+#endif
+	return 0;
+}
+
+/* TRUE si la estampa está ganada, FALSE si no o si no está registrada, -1 si falla */
+int CPStamp_LiveIsEarned (CPStampLive *live, int id) {
+#ifdef CPSTAMP_LIVE
+	CPStampLiveHeader *header;
+	Sint32 *ids;
+	Sint64 gen;
+	Uint32 capacity, count, g;
+	int res, intento;
+	
+	if (live == NULL) return -1;
+	
+	for (intento = 0; intento < CPSTAMP_LIVE_RETRIES; intento++) {
+		gen = cpstamp_live_read_begin (live, &capacity);
+		if (gen < 0) return -1;
+		
+		header = live->header;
+		ids = cpstamp_live_ids (header);
+		count = cpstamp_live_count (live, capacity);
+		
+		res = FALSE;
+		for (g = 0; g < count; g++) {
+			if (ids[g] == id) {
+				res = (cpstamp_live_bits (header, capacity)[g / 32] >> (g % 32)) & 1;
+				break;
+			}
+		}
+		
+		if (cpstamp_live_read_end (live, gen, capacity)) return res;
+	}
+	
+	errno = EAGAIN;
+#else
+	errno = ENOSYS;
+#endif
+	return -1;
+}
+
+/* Copia en "ids" hasta "max" estampas ganadas. Regresa cuántas hay
+ * ganadas en total, o -1 si falla */
+int CPStamp_LiveEarned (CPStampLive *live, int *ids, int max) {
+#ifdef CPSTAMP_LIVE
+	CPStampLiveHeader *header;
+	Uint32 *bits;
+	Sint64 gen;
+	Uint32 capacity, count, g;
+	int total, intento;
+	
+	if (live == NULL) return -1;
+	
+	for (intento = 0; intento < CPSTAMP_LIVE_RETRIES; intento++) {
+		gen = cpstamp_live_read_begin (live, &capacity);
+		if (gen < 0) return -1;
+		
+		header = live->header;
+		bits = cpstamp_live_bits (header, capacity);
+		count = cpstamp_live_count (live, capacity);
+		
+		total = 0;
+		for (g = 0; g < count; g++) {
+			if (bits[g / 32] == 0) {
+				/* Palabra sin ganadas, saltar a la siguiente */
+				g |= 31;
+				continue;
+			}
+			
+			if ((bits[g / 32] >> (g % 32)) & 1) {
+				if (ids != NULL && total < max) ids[total] = cpstamp_live_ids (header)[g];
+				total++;
+			}
+		}
+		
+		if (cpstamp_live_read_end (live, gen, capacity)) return total;
+	}
+	
+	errno = EAGAIN;
+#else
+	errno = ENOSYS;
+#endif
+	return -1;
+}
+
@@ -0,0 +1,40 @@
+/*
+ * live.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_LIVE_H__
+#define __CPSTAMP_LIVE_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "table.h"
+
+#define CPSTAMP_LIVE_VERSION 1
+
+/* Lado de la categoría que comparte su estado, ver CPStamp_ShareCategory.
+ * Sólo el hilo principal escribe */
+CPStampLive *cpstamp_live_create (const char *clave, const CPStampTable *t);
+void cpstamp_live_fill (CPStampLive *live, const CPStampTable *t);
+void cpstamp_live_update (CPStampLive *live, const CPStampTable *t);
+void cpstamp_live_earn (CPStampLive *live, int pos);
+void cpstamp_live_destroy (CPStampLive *live);
+
+#endif /* __CPSTAMP_LIVE_H__ */
+
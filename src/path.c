@@ -112,6 +112,35 @@ int cpstamp_split_path (const char *path, char * dir_part, char * filename_part)
 	return TRUE;
 }
 
+/* Regresa una nueva cadena con "file" relativo a "base", o una copia de "file" si es absoluto */
+char *cpstamp_resolve_path (const char *base, const char *file) {
+	char *res;
+	int len;
+	
+	if (file == NULL) return NULL;
+	
+	if (base == NULL || base[0] == 0 || file[0] == '/' || file[0] == '\\'
+	#ifdef __MINGW32__
+		|| (file[0] != 0 && file[1] == ':')
+	#endif
+	) {
+		return strdup (file);
+	}
+	
+	len = strlen (base);
+	res = (char *) malloc (len + strlen (file) + 2);
+	
+	if (res == NULL) return NULL;
+	
+	if (base[len - 1] == '/' || base[len - 1] == '\\') {
+		sprintf (res, "%s%s", base, file);
+	} else {
+		sprintf (res, "%s/%s", base, file);
+	}
+	
+	return res;
+}
+
 #ifdef __MINGW32__
 // should be ecl_system_windows.cc ?
 static void ApplicationDataPath (char * buffer) {
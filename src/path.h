@@ -27,5 +27,7 @@ void cpstamp_init_paths (const char *argv_0, char **systemdata_path, char **l10n
 
 int cpstamp_split_path (const char *path, char * dir_part, char * filename_part);
 
+char *cpstamp_resolve_path (const char *base, const char *file);
+
 #endif /* __PATH_H__ */
 
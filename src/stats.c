@@ -0,0 +1,286 @@
+/*
+ * stats.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef __MINGW32__
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <SDL.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "stats.h"
+#include "blend.h"
+
+/* Límites de las cubetas, la última no tiene límite */
+static const Uint32 cpstamp_draw_buckets [CPSTAMP_DRAW_BUCKETS - 1] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+Uint64 cpstamp_now_usec (void) {
+#ifdef __MINGW32__
+	LARGE_INTEGER freq, count;
+	
+	if (QueryPerformanceFrequency (&freq) && QueryPerformanceCounter (&count)) {
+		return (Uint64) (count.QuadPart / (freq.QuadPart / 1000000.0));
+	}
+#elif defined (CLOCK_MONOTONIC)
+	struct timespec ts;
+	
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0) {
+		return (Uint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+	return (Uint64) SDL_GetTicks () * 1000;
+}
+
+void cpstamp_stats_draw (CPStampStats *stats, Uint64 usec) {
+	int g;
+	
+	stats->draw_calls++;
+	stats->draw_time_us += usec;
+	
+	for (g = 0; g < CPSTAMP_DRAW_BUCKETS - 1; g++) {
+		if (usec <= cpstamp_draw_buckets[g]) break;
+	}
+	
+	stats->draw_histogram[g]++;
+}
+
+/* SDL_BlitSurface, contando la cantidad de pixeles copiados.
+ * Las imágenes con alpha por pixel se mezclan con nuestros propios kernels */
+int cpstamp_blit (CPStampStats *stats, SDL_Surface *src, SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect) {
+	int res;
+	
+	res = cpstamp_blend (src, srcrect, dst, dstrect);
+	
+	if (res == CPSTAMP_BLEND_UNSUPPORTED) {
+		res = SDL_BlitSurface (src, srcrect, dst, dstrect);
+	}
+	
+	if (res == 0 && stats != NULL) {
+		stats->blits++;
+		
+		/* SDL deja en dstrect el rectángulo final, después de recortar */
+		if (dstrect != NULL) {
+			stats->blit_pixels += dstrect->w * dstrect->h;
+		} else if (srcrect != NULL) {
+			stats->blit_pixels += srcrect->w * srcrect->h;
+		} else {
+			stats->blit_pixels += src->w * src->h;
+		}
+	}
+	
+	return res;
+}
+
+#ifdef CPSTAMP_SDL2
+/* SDL_RenderCopy de la textura completa en (x, y), contando los pixeles */
+int cpstamp_render_copy (CPStampStats *stats, SDL_Renderer *renderer, SDL_Texture *texture, int x, int y) {
+	SDL_Rect rect;
+	int res;
+	
+	if (texture == NULL) return -1;
+	
+	rect.x = x;
+	rect.y = y;
+	SDL_QueryTexture (texture, NULL, NULL, &rect.w, &rect.h);
+	
+	res = SDL_RenderCopy (renderer, texture, NULL, &rect);
+	
+	if (res == 0 && stats != NULL) {
+		stats->blits++;
+		stats->blit_pixels += rect.w * rect.h;
+	}
+	
+	return res;
+}
+#endif
+
+static int cpstamp_string_memory (const char *str) {
+	if (str == NULL) return 0;
+	
+	return strlen (str) + 1;
+}
+
+static Uint32 cpstamp_category_memory (CPStampCategory *cat) {
+	Uint32 total;
+	
+	total = sizeof (CPStampCategory);
+	total += cpstamp_string_memory (cat->clave);
+	total += cpstamp_string_memory (cat->l10n_domain);
+	total += cpstamp_string_memory (cat->l10n_dir);
+	total += cpstamp_string_memory (cat->resource_dir);
+	
+	total += cpstamp_table_memory (&cat->estampas);
+	
+	return total;
+}
+
+void CPStamp_GetStats (CPStampHandle *handle, CPStampStats *stats) {
+	CPStampCategory *cat;
+	
+	if (handle == NULL || stats == NULL) return;
+	
+	memcpy (stats, &handle->stats, sizeof (CPStampStats));
+	
+	stats->queue_depth = (handle->stamp_queue_end - handle->stamp_queue_start + 10) % 10;
+	
+	stats->categories = 0;
+	stats->category_memory = 0;
+	for (cat = handle->categorias; cat != NULL; cat = cat->sig) {
+		stats->categories++;
+		stats->category_memory += cpstamp_category_memory (cat);
+	}
+}
+
+/* Acumulador de texto tipo snprintf, cuenta lo que no cupo */
+typedef struct {
+	char *buf;
+	int len, pos;
+} CPStampWriter;
+
+static void cpstamp_writer_printf (CPStampWriter *w, const char *fmt, ...) {
+	va_list ap;
+	int res;
+	
+	va_start (ap, fmt);
+	if (w->pos < w->len) {
+		res = vsnprintf (&w->buf[w->pos], w->len - w->pos, fmt, ap);
+	} else {
+		res = vsnprintf (NULL, 0, fmt, ap);
+	}
+	va_end (ap);
+	
+	if (res > 0) w->pos += res;
+}
+
+static void cpstamp_writer_metric (CPStampWriter *w, const char *name, const char *type, const char *help, double value) {
+	cpstamp_writer_printf (w, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n", name, help, name, type, name, value);
+}
+
+/* Valor de una etiqueta, escapando los caracteres especiales */
+static void cpstamp_writer_label (CPStampWriter *w, const char *value) {
+	const char *p;
+	
+	for (p = value; *p != 0; p++) {
+		if (*p == '\\' || *p == '"') {
+			cpstamp_writer_printf (w, "\\%c", *p);
+		} else if (*p == '\n') {
+			cpstamp_writer_printf (w, "\\n");
+		} else {
+			cpstamp_writer_printf (w, "%c", *p);
+		}
+	}
+}
+
+/* Escribe las estadísticas en el formato de texto de Prometheus.
+ * Regresa la longitud completa del texto, igual que snprintf */
+int CPStamp_FormatStats (CPStampHandle *handle, char *buf, int len) {
+	CPStampWriter w;
+	CPStampStats stats;
+	CPStampCategory *cat;
+	Uint32 acumulado;
+	int g;
+	
+	if (handle == NULL) return -1;
+	
+	w.buf = buf;
+	w.len = (buf != NULL && len > 0) ? len : 0;
+	w.pos = 0;
+	
+	if (w.len > 0) buf[0] = 0;
+	
+	CPStamp_GetStats (handle, &stats);
+	
+	cpstamp_writer_printf (&w, "# HELP cpstamp_draw_seconds Time spent in CPStamp_Draw while a notification is shown.\n");
+	cpstamp_writer_printf (&w, "# TYPE cpstamp_draw_seconds histogram\n");
+	acumulado = 0;
+	for (g = 0; g < CPSTAMP_DRAW_BUCKETS - 1; g++) {
+		acumulado += stats.draw_histogram[g];
+		cpstamp_writer_printf (&w, "cpstamp_draw_seconds_bucket{le=\"%g\"} %lu\n", cpstamp_draw_buckets[g] / 1000000.0, (unsigned long) acumulado);
+	}
+	cpstamp_writer_printf (&w, "cpstamp_draw_seconds_bucket{le=\"+Inf\"} %lu\n", (unsigned long) stats.draw_calls);
+	cpstamp_writer_printf (&w, "cpstamp_draw_seconds_sum %.6f\n", stats.draw_time_us / 1000000.0);
+	cpstamp_writer_printf (&w, "cpstamp_draw_seconds_count %lu\n", (unsigned long) stats.draw_calls);
+	
+	cpstamp_writer_metric (&w, "cpstamp_blits_total", "counter", "Surfaces blitted by the overlay.", stats.blits);
+	cpstamp_writer_metric (&w, "cpstamp_blit_pixels_total", "counter", "Pixels blitted by the overlay.", (double) stats.blit_pixels);
+	
+	cpstamp_writer_metric (&w, "cpstamp_queue_depth", "gauge", "Notifications waiting to be shown.", stats.queue_depth);
+	cpstamp_writer_metric (&w, "cpstamp_queue_max_depth", "gauge", "Deepest the notification queue has been.", stats.queue_max_depth);
+	cpstamp_writer_metric (&w, "cpstamp_notifications_total", "counter", "Notifications queued.", stats.notifications);
+	cpstamp_writer_metric (&w, "cpstamp_dropped_notifications_total", "counter", "Notifications dropped because the queue was full.", stats.dropped);
+	
+	cpstamp_writer_metric (&w, "cpstamp_file_opens_total", "counter", "Stamp files loaded.", stats.opens);
+	cpstamp_writer_metric (&w, "cpstamp_file_saves_total", "counter", "Stamp files saved.", stats.saves);
+	cpstamp_writer_metric (&w, "cpstamp_file_reloads_total", "counter", "Stamp files merged after another process saved them.", stats.reloads);
+	cpstamp_writer_metric (&w, "cpstamp_file_read_bytes_total", "counter", "Bytes read from stamp files.", (double) stats.read_bytes);
+	cpstamp_writer_metric (&w, "cpstamp_file_written_bytes_total", "counter", "Bytes written to stamp files.", (double) stats.written_bytes);
+	cpstamp_writer_metric (&w, "cpstamp_file_read_syscalls_total", "counter", "System calls made while loading stamp files.", stats.read_syscalls);
+	cpstamp_writer_metric (&w, "cpstamp_file_write_syscalls_total", "counter", "System calls made while saving stamp files.", stats.write_syscalls);
+	cpstamp_writer_metric (&w, "cpstamp_file_load_seconds_total", "counter", "Time spent loading stamp files.", stats.load_time_us / 1000000.0);
+	cpstamp_writer_metric (&w, "cpstamp_file_last_load_seconds", "gauge", "Time spent loading the last stamp file.", stats.last_load_time_us / 1000000.0);
+	
+	cpstamp_writer_metric (&w, "cpstamp_asset_loads_total", "counter", "Times the images, font and sound were loaded.", stats.asset_loads);
+	cpstamp_writer_metric (&w, "cpstamp_asset_unloads_total", "counter", "Times the images, font and sound were freed, when idle or to change the scale.", stats.asset_unloads);
+	cpstamp_writer_metric (&w, "cpstamp_asset_memory_bytes", "gauge", "Memory used by the loaded images, font and sound.", stats.asset_memory);
+	
+	cpstamp_writer_metric (&w, "cpstamp_categories", "gauge", "Stamp categories currently open.", stats.categories);
+	cpstamp_writer_printf (&w, "# HELP cpstamp_category_memory_bytes Memory used by an open stamp category.\n");
+	cpstamp_writer_printf (&w, "# TYPE cpstamp_category_memory_bytes gauge\n");
+	for (cat = handle->categorias; cat != NULL; cat = cat->sig) {
+		cpstamp_writer_printf (&w, "cpstamp_category_memory_bytes{category=\"");
+		cpstamp_writer_label (&w, (cat->clave != NULL) ? cat->clave : "");
+		cpstamp_writer_printf (&w, "\"} %lu\n", (unsigned long) cpstamp_category_memory (cat));
+	}
+	
+	return w.pos;
+}
+
+int CPStamp_WriteStats (CPStampHandle *handle, FILE *f) {
+	char *buf;
+	int len, res;
+	
+	if (handle == NULL || f == NULL) return -1;
+	
+	len = CPStamp_FormatStats (handle, NULL, 0);
+	buf = (char *) malloc (len + 1);
+	
+	if (buf == NULL) return -1;
+	
+	CPStamp_FormatStats (handle, buf, len + 1);
+	res = fwrite (buf, sizeof (char), len, f);
+	free (buf);
+	
+	return (res == len) ? len : -1;
+}
+
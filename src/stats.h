@@ -0,0 +1,37 @@
+/*
+ * stats.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_STATS_H__
+#define __CPSTAMP_STATS_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "compat.h"
+
+Uint64 cpstamp_now_usec (void);
+void cpstamp_stats_draw (CPStampStats *stats, Uint64 usec);
+int cpstamp_blit (CPStampStats *stats, SDL_Surface *src, SDL_Rect *srcrect, SDL_Surface *dst, SDL_Rect *dstrect);
+#ifdef CPSTAMP_SDL2
+int cpstamp_render_copy (CPStampStats *stats, SDL_Renderer *renderer, SDL_Texture *texture, int x, int y);
+#endif
+
+#endif /* __CPSTAMP_STATS_H__ */
+
@@ -0,0 +1,497 @@
+/*
+ * storage.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Almacenamientos incluidos en la librería: un archivo por categoría
+ * en la carpeta .cpstamps, y uno en memoria para pruebas */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef __MINGW32__
+#include <io.h>
+#endif
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "cpstamp_private.h"
+#include "dir.h"
+#include "storage.h"
+
+void cpstamp_revision_from_stat (CPStampRevision *rev, struct stat *st) {
+	rev->id = st->st_ino;
+	rev->size = st->st_size;
+	rev->mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	rev->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+	rev->mtime_nsec = 0;
+#endif
+}
+
+int cpstamp_revision_equal (const CPStampRevision *a, const CPStampRevision *b) {
+	return a->id == b->id && a->size == b->size && a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec;
+}
+
+/* El archivo debe estar en disco antes de reemplazar al anterior */
+int cpstamp_sync (int fd) {
+#ifdef __MINGW32__
+	return _commit (fd);
+#else
+	return fsync (fd);
+#endif
+}
+
+/* Escribe todo el buffer, regresa 0 o el errno */
+static int cpstamp_file_write (int fd, const char *buf, size_t len, CPStampStats *stats) {
+	size_t pos;
+	ssize_t res;
+	
+	pos = 0;
+	while (pos < len) {
+		res = write (fd, &buf[pos], len - pos);
+		stats->write_syscalls++;
+		
+		if (res < 0 && errno == EINTR) continue;
+		if (res <= 0) return (res < 0) ? errno : ENOSPC;
+		
+		pos += res;
+		stats->written_bytes += res;
+	}
+	
+	return 0;
+}
+
+/* Sincroniza, consulta cómo quedó y cierra el archivo, regresa 0 o el errno */
+static int cpstamp_file_finish (int fd, int error, struct stat *st, CPStampStats *stats) {
+	if (error == 0 && cpstamp_sync (fd) < 0) error = errno;
+	if (error == 0 && fstat (fd, st) < 0) error = errno;
+	
+	if (close (fd) < 0 && error == 0) error = errno;
+	stats->write_syscalls += 3; /* fsync, fstat y close */
+	
+	return error;
+}
+
+/* Lee el archivo completo. Se crea si no existe, para saber desde que se
+ * abre la categoría si se podrá guardar */
+static int cpstamp_file_load (void *data, const char *clave, char **buf, size_t *len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDir *dir;
+	struct stat st;
+	int fd;
+	
+	*buf = NULL;
+	*len = 0;
+	memset (rev, 0, sizeof (CPStampRevision));
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	fd = cpstamp_dir_open (dir, clave, O_RDWR | O_CREAT, 0644);
+	stats->read_syscalls++;
+	if (fd < 0) return -1;
+	
+	*buf = cpstamp_read_file (fd, &st, len, stats);
+	close (fd);
+	stats->read_syscalls++;
+	
+	cpstamp_revision_from_stat (rev, &st);
+	
+	return 0;
+}
+
+/* Se escribe un archivo temporal y se renombra sobre el de la categoría,
+ * otro proceso siempre ve el archivo viejo o el nuevo completo */
+static int cpstamp_file_save (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDir *dir;
+	struct stat st;
+	char *temporal;
+	int fd, error;
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	temporal = cpstamp_dir_temp_name (clave);
+	if (temporal == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	fd = cpstamp_dir_open (dir, temporal, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	stats->write_syscalls++;
+	
+	if (fd < 0) {
+		error = errno;
+		free (temporal);
+		errno = error;
+		return -1;
+	}
+	
+	error = cpstamp_file_write (fd, buf, len, stats);
+	error = cpstamp_file_finish (fd, error, &st, stats);
+	
+	if (error == 0 && cpstamp_dir_rename (dir, temporal, clave) < 0) error = errno;
+	
+	/* Si algo falló, el archivo de la categoría queda como estaba */
+	if (error != 0) cpstamp_dir_unlink (dir, temporal);
+	stats->write_syscalls++;
+	
+	free (temporal);
+	
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	
+	cpstamp_revision_from_stat (rev, &st);
+	
+	return 0;
+}
+
+static int cpstamp_file_append (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDir *dir;
+	struct stat st;
+	int fd, error;
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	fd = cpstamp_dir_open (dir, clave, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	stats->write_syscalls++;
+	if (fd < 0) return -1;
+	
+	error = cpstamp_file_write (fd, buf, len, stats);
+	error = cpstamp_file_finish (fd, error, &st, stats);
+	
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	
+	cpstamp_revision_from_stat (rev, &st);
+	
+	return 0;
+}
+
+static int cpstamp_file_stat (void *data, const char *clave, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampDir *dir;
+	struct stat st;
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	stats->read_syscalls++;
+	if (cpstamp_dir_stat (dir, clave, &st) < 0) return -1;
+	
+	if (!S_ISREG (st.st_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	
+	cpstamp_revision_from_stat (rev, &st);
+	
+	return 0;
+}
+
+static int cpstamp_file_lock (void *data, CPStampStats *stats) {
+	CPStampDir *dir;
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	cpstamp_dir_lock (dir, TRUE);
+	stats->write_syscalls++;
+	
+	return 0;
+}
+
+static void cpstamp_file_unlock (void *data, CPStampStats *stats) {
+	cpstamp_dir_unlock (&((CPStampHandle *) data)->dir);
+	stats->write_syscalls++;
+}
+
+static int cpstamp_file_list (void *data, void (*fn) (const char *clave, void *arg), void *arg, CPStampStats *stats) {
+	CPStampDir *dir;
+	DIR *listado;
+	struct dirent *ent;
+	
+	dir = cpstamp_user_dir ((CPStampHandle *) data);
+	if (dir == NULL) return -1;
+	
+	listado = cpstamp_dir_list (dir);
+	if (listado == NULL) return -1;
+	
+	while ((ent = readdir (listado)) != NULL) {
+		/* El índice, el candado y los archivos temporales empiezan con punto */
+		if (ent->d_name[0] == '.') continue;
+		
+		fn (ent->d_name, arg);
+	}
+	
+	closedir (listado);
+	
+	return 0;
+}
+
+const CPStampStorage cpstamp_file_storage = {
+	cpstamp_file_load,
+	cpstamp_file_save,
+	cpstamp_file_append,
+	cpstamp_file_stat,
+	cpstamp_file_lock,
+	cpstamp_file_unlock,
+	cpstamp_file_list,
+	NULL
+};
+
+/* Almacenamiento en memoria, una entrada por categoría */
+typedef struct {
+	char *clave;
+	char *data;
+	size_t len;
+	CPStampRevision rev;
+} CPStampMemoryEntry;
+
+typedef struct {
+	SDL_mutex *mutex;
+	CPStampMemoryEntry *entries;
+	int count, size;
+	
+	/* Cada escritura tiene un número distinto, es su "mtime" */
+	Sint64 serial;
+} CPStampMemoryStorage;
+
+void *cpstamp_memory_storage_new (void) {
+	CPStampMemoryStorage *mem;
+	
+	mem = (CPStampMemoryStorage *) calloc (1, sizeof (CPStampMemoryStorage));
+	if (mem == NULL) return NULL;
+	
+	mem->mutex = SDL_CreateMutex ();
+	if (mem->mutex == NULL) {
+		free (mem);
+		return NULL;
+	}
+	
+	return mem;
+}
+
+static CPStampMemoryEntry *cpstamp_memory_find (CPStampMemoryStorage *mem, const char *clave, int create) {
+	CPStampMemoryEntry *entry, *nuevas;
+	int g, size;
+	
+	for (g = 0; g < mem->count; g++) {
+		if (strcmp (mem->entries[g].clave, clave) == 0) return &mem->entries[g];
+	}
+	
+	if (!create) {
+		errno = ENOENT;
+		return NULL;
+	}
+	
+	if (mem->count == mem->size) {
+		size = (mem->size > 0) ? mem->size * 2 : 16;
+		nuevas = (CPStampMemoryEntry *) realloc (mem->entries, size * sizeof (CPStampMemoryEntry));
+		
+		if (nuevas == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		
+		mem->entries = nuevas;
+		mem->size = size;
+	}
+	
+	entry = &mem->entries[mem->count];
+	memset (entry, 0, sizeof (CPStampMemoryEntry));
+	
+	entry->clave = strdup (clave);
+	if (entry->clave == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	mem->count++;
+	entry->rev.id = mem->count;
+	entry->rev.mtime = ++mem->serial;
+	
+	return entry;
+}
+
+/* Como en los archivos, leer una categoría que no existe la crea vacía */
+static int cpstamp_memory_load (void *data, const char *clave, char **buf, size_t *len, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampMemoryStorage *mem = (CPStampMemoryStorage *) data;
+	CPStampMemoryEntry *entry;
+	int res;
+	
+	*buf = NULL;
+	*len = 0;
+	res = 0;
+	
+	SDL_LockMutex (mem->mutex);
+	entry = cpstamp_memory_find (mem, clave, TRUE);
+	
+	if (entry == NULL) {
+		res = -1;
+	} else if (entry->len > 0) {
+		*buf = (char *) malloc (entry->len);
+		
+		if (*buf == NULL) {
+			errno = ENOMEM;
+			res = -1;
+		} else {
+			memcpy (*buf, entry->data, entry->len);
+			*len = entry->len;
+			stats->read_bytes += entry->len;
+		}
+	}
+	
+	if (entry != NULL) *rev = entry->rev;
+	SDL_UnlockMutex (mem->mutex);
+	
+	return res;
+}
+
+/* Cambia los datos de la entrada por "buf", agregándolo al final si "append" */
+static int cpstamp_memory_write (CPStampMemoryStorage *mem, const char *clave, const char *buf, size_t len, int append, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampMemoryEntry *entry;
+	char *nuevo;
+	size_t inicio;
+	int res;
+	
+	res = -1;
+	
+	SDL_LockMutex (mem->mutex);
+	entry = cpstamp_memory_find (mem, clave, TRUE);
+	
+	if (entry != NULL) {
+		inicio = append ? entry->len : 0;
+		nuevo = (char *) malloc ((inicio + len > 0) ? inicio + len : 1);
+		
+		if (nuevo == NULL) {
+			errno = ENOMEM;
+		} else {
+			if (inicio > 0) memcpy (nuevo, entry->data, inicio);
+			memcpy (&nuevo[inicio], buf, len);
+			
+			free (entry->data);
+			entry->data = nuevo;
+			entry->len = inicio + len;
+			entry->rev.size = entry->len;
+			entry->rev.mtime = ++mem->serial;
+			
+			*rev = entry->rev;
+			stats->written_bytes += len;
+			res = 0;
+		}
+	}
+	
+	SDL_UnlockMutex (mem->mutex);
+	
+	return res;
+}
+
+static int cpstamp_memory_save (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats) {
+	return cpstamp_memory_write ((CPStampMemoryStorage *) data, clave, buf, len, FALSE, rev, stats);
+}
+
+static int cpstamp_memory_append (void *data, const char *clave, const char *buf, size_t len, CPStampRevision *rev, CPStampStats *stats) {
+	return cpstamp_memory_write ((CPStampMemoryStorage *) data, clave, buf, len, TRUE, rev, stats);
+}
+
+static int cpstamp_memory_stat (void *data, const char *clave, CPStampRevision *rev, CPStampStats *stats) {
+	CPStampMemoryStorage *mem = (CPStampMemoryStorage *) data;
+	CPStampMemoryEntry *entry;
+	
+	SDL_LockMutex (mem->mutex);
+	entry = cpstamp_memory_find (mem, clave, FALSE);
+	if (entry != NULL) *rev = entry->rev;
+	SDL_UnlockMutex (mem->mutex);
+	
+	return (entry != NULL) ? 0 : -1;
+}
+
+/* Las claves se copian antes de llamar a "fn", que puede usar el almacenamiento */
+static int cpstamp_memory_list (void *data, void (*fn) (const char *clave, void *arg), void *arg, CPStampStats *stats) {
+	CPStampMemoryStorage *mem = (CPStampMemoryStorage *) data;
+	char **claves;
+	int g, count;
+	
+	SDL_LockMutex (mem->mutex);
+	count = mem->count;
+	claves = (char **) calloc ((count > 0) ? count : 1, sizeof (char *));
+	
+	for (g = 0; g < count && claves != NULL; g++) {
+		claves[g] = strdup (mem->entries[g].clave);
+	}
+	SDL_UnlockMutex (mem->mutex);
+	
+	if (claves == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	for (g = 0; g < count; g++) {
+		if (claves[g] != NULL) fn (claves[g], arg);
+		free (claves[g]);
+	}
+	
+	free (claves);
+	
+	return 0;
+}
+
+static void cpstamp_memory_destroy (void *data) {
+	CPStampMemoryStorage *mem = (CPStampMemoryStorage *) data;
+	int g;
+	
+	for (g = 0; g < mem->count; g++) {
+		free (mem->entries[g].clave);
+		free (mem->entries[g].data);
+	}
+	
+	free (mem->entries);
+	SDL_DestroyMutex (mem->mutex);
+	free (mem);
+}
+
+/* Un solo proceso usa la memoria, no hace falta candado */
+const CPStampStorage cpstamp_memory_storage = {
+	cpstamp_memory_load,
+	cpstamp_memory_save,
+	cpstamp_memory_append,
+	cpstamp_memory_stat,
+	NULL,
+	NULL,
+	cpstamp_memory_list,
+	cpstamp_memory_destroy
+};
+
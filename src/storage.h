@@ -0,0 +1,41 @@
+/*
+ * storage.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_STORAGE_H__
+#define __CPSTAMP_STORAGE_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cpstamp.h"
+
+/* Un archivo por categoría en la carpeta .cpstamps, "data" es el handle */
+extern const CPStampStorage cpstamp_file_storage;
+
+/* Todo en memoria, se pierde al terminar el proceso. Para pruebas */
+extern const CPStampStorage cpstamp_memory_storage;
+void *cpstamp_memory_storage_new (void);
+
+void cpstamp_revision_from_stat (CPStampRevision *rev, struct stat *st);
+int cpstamp_revision_equal (const CPStampRevision *a, const CPStampRevision *b);
+int cpstamp_sync (int fd);
+
+#endif /* __CPSTAMP_STORAGE_H__ */
+
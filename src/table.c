@@ -0,0 +1,385 @@
+/*
+ * table.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Tabla de estampas de una categoría. Cada campo es un arreglo contiguo,
+ * así las búsquedas y los recorridos leen sólo lo que necesitan */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+#include "table.h"
+#include "catalog.h"
+
+#if defined (__SSE2__) && (defined (__GNUC__) || defined (__clang__))
+#define CPSTAMP_TABLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Los datos de un bloque de textos van después de su encabezado */
+#define CPSTAMP_TABLE_DATA(bloque) ((char *) ((bloque) + 1))
+
+void cpstamp_table_init (CPStampTable *table) {
+	memset (table, 0, sizeof (CPStampTable));
+}
+
+void cpstamp_table_free (CPStampTable *table) {
+	CPStampTableText *bloque, *anterior;
+	
+	free (table->ids);
+	free (table->categorias);
+	free (table->dificultades);
+	free (table->ganadas);
+	free (table->titulos);
+	free (table->descripciones);
+	free (table->imagenes);
+	free (table->l10n);
+	
+	for (bloque = table->textos; bloque != NULL; bloque = anterior) {
+		anterior = bloque->anterior;
+		free (bloque);
+	}
+	
+	cpstamp_table_init (table);
+}
+
+/* Cambia el tamaño de uno de los arreglos, regresa FALSE si no hubo memoria */
+static int cpstamp_table_resize (void **arreglo, int size, size_t elemento) {
+	void *nuevo;
+	
+	nuevo = realloc (*arreglo, size * elemento);
+	if (nuevo == NULL) return FALSE;
+	
+	*arreglo = nuevo;
+	return TRUE;
+}
+
+static int cpstamp_table_resize_all (CPStampTable *table, int size) {
+	if (!cpstamp_table_resize ((void **) &table->ids, size, sizeof (int))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->categorias, size, sizeof (Uint8))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->dificultades, size, sizeof (Uint8))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->ganadas, size, sizeof (Uint8))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->titulos, size, sizeof (Uint32))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->descripciones, size, sizeof (Uint32))) return FALSE;
+	if (!cpstamp_table_resize ((void **) &table->imagenes, size, sizeof (Uint32))) return FALSE;
+	
+	/* Las traducciones se vuelven a pedir la próxima vez */
+	free (table->l10n);
+	table->l10n = NULL;
+	
+	table->size = size;
+	return TRUE;
+}
+
+/* Hace crecer los textos para que quepan "len" bytes más. Si ya se
+ * entregaron apuntadores a las cadenas, el bloque viejo se conserva */
+static int cpstamp_table_grow_text (CPStampTable *table, Uint32 len) {
+	CPStampTableText *bloque;
+	Uint32 usado, size;
+	
+	usado = (table->textos != NULL) ? table->textos->len : 1;
+	if (table->textos != NULL && table->textos->size - usado >= len) return TRUE;
+	
+	size = (table->textos != NULL) ? table->textos->size * 2 : 256;
+	if (size < usado + len) size = usado + len;
+	
+	if (table->textos != NULL && !table->textos_fijos) {
+		bloque = (CPStampTableText *) realloc (table->textos, sizeof (CPStampTableText) + size);
+		if (bloque == NULL) return FALSE;
+	} else {
+		bloque = (CPStampTableText *) malloc (sizeof (CPStampTableText) + size);
+		if (bloque == NULL) return FALSE;
+		
+		if (table->textos != NULL) {
+			memcpy (CPSTAMP_TABLE_DATA (bloque), CPSTAMP_TABLE_DATA (table->textos), usado);
+		} else {
+			/* La posición 0 es la cadena nula */
+			CPSTAMP_TABLE_DATA (bloque)[0] = 0;
+		}
+		bloque->anterior = table->textos;
+		bloque->len = usado;
+		table->textos_fijos = FALSE;
+	}
+	
+	bloque->size = size;
+	table->textos = bloque;
+	
+	return TRUE;
+}
+
+/* Reserva lugar para "count" estampas y "text" bytes de textos */
+int cpstamp_table_reserve (CPStampTable *table, int count, Uint32 text) {
+	if (count > table->size && !cpstamp_table_resize_all (table, count)) return FALSE;
+	
+	return cpstamp_table_grow_text (table, text);
+}
+
+/* Deja la tabla del tamaño justo, después de leer un archivo.
+ * Sólo mueve los textos si nadie tiene apuntadores a ellos */
+void cpstamp_table_trim (CPStampTable *table) {
+	CPStampTableText *bloque;
+	
+	if (table->count > 0 && table->count < table->size) cpstamp_table_resize_all (table, table->count);
+	
+	if (table->textos != NULL && !table->textos_fijos && table->textos->len < table->textos->size) {
+		bloque = (CPStampTableText *) realloc (table->textos, sizeof (CPStampTableText) + table->textos->len);
+		if (bloque == NULL) return;
+		
+		bloque->size = bloque->len;
+		table->textos = bloque;
+	}
+}
+
+/* Copia lo que se guarda de las estampas, sin traducciones.
+ * Regresa FALSE si no hubo memoria */
+int cpstamp_table_copy (CPStampTable *dest, const CPStampTable *src) {
+	cpstamp_table_init (dest);
+	dest->catalogo = src->catalogo;
+	
+	if (src->count == 0) return TRUE;
+	
+	if (!cpstamp_table_reserve (dest, src->count, (src->textos != NULL) ? src->textos->len : 1)) {
+		cpstamp_table_free (dest);
+		return FALSE;
+	}
+	
+	dest->count = src->count;
+	memcpy (dest->ids, src->ids, src->count * sizeof (int));
+	memcpy (dest->categorias, src->categorias, src->count * sizeof (Uint8));
+	memcpy (dest->dificultades, src->dificultades, src->count * sizeof (Uint8));
+	memcpy (dest->ganadas, src->ganadas, src->count * sizeof (Uint8));
+	memcpy (dest->titulos, src->titulos, src->count * sizeof (Uint32));
+	memcpy (dest->descripciones, src->descripciones, src->count * sizeof (Uint32));
+	memcpy (dest->imagenes, src->imagenes, src->count * sizeof (Uint32));
+	
+	if (src->textos != NULL) {
+		memcpy (CPSTAMP_TABLE_DATA (dest->textos), CPSTAMP_TABLE_DATA (src->textos), src->textos->len);
+		dest->textos->len = src->textos->len;
+	}
+	
+	return TRUE;
+}
+
+/* Posición de la primera estampa con el id, o -1 si no está */
+int cpstamp_table_find (const CPStampTable *table, int id) {
+	int g;
+#ifdef CPSTAMP_TABLE_SSE2
+	__m128i buscado, ids;
+	int mask;
+#endif
+
+	g = 0;
+	if (table->catalogo != NULL) {
+		/* Las del catálogo se encuentran con su hash, sólo se recorren las demás */
+		g = cpstamp_catalog_find (table->catalogo, id);
+		if (g >= 0) return g;
+		
+		g = table->catalogo->count;
+	}
+
+#ifdef CPSTAMP_TABLE_SSE2
+	/* Cuatro ids por comparación, la máscara tiene 4 bits por id */
+	buscado = _mm_set1_epi32 (id);
+	for (; g + 4 <= table->count; g += 4) {
+		ids = _mm_loadu_si128 ((const __m128i *) &table->ids[g]);
+		mask = _mm_movemask_epi8 (_mm_cmpeq_epi32 (ids, buscado));
+		
+		if (mask != 0) return g + __builtin_ctz (mask) / 4;
+	}
+#endif
+	for (; g < table->count; g++) {
+		if (table->ids[g] == id) return g;
+	}
+	
+	return -1;
+}
+
+/* Agrega una estampa sin textos y no ganada, regresa su posición o -1 */
+int cpstamp_table_append (CPStampTable *table, int id) {
+	int g;
+	
+	if (table->count == table->size) {
+		if (!cpstamp_table_resize_all (table, (table->size > 0) ? table->size * 2 : 16)) return -1;
+	}
+	
+	g = table->count++;
+	table->ids[g] = id;
+	table->categorias[g] = 0;
+	table->dificultades[g] = 0;
+	table->ganadas[g] = FALSE;
+	table->titulos[g] = table->descripciones[g] = table->imagenes[g] = 0;
+	
+	if (table->l10n != NULL) table->l10n[g * 2] = table->l10n[g * 2 + 1] = NULL;
+	
+	return g;
+}
+
+/* Pone las estampas del catálogo en los primeros lugares, sin copiar sus
+ * textos. Las que ya tenía la tabla conservan lo ganado, y las que no están
+ * en el catálogo quedan después con los mismos textos, que no se mueven.
+ * Regresa FALSE si no hubo memoria, y entonces la tabla no cambia */
+int cpstamp_table_attach (CPStampTable *table, const CPStampCatalog *catalog) {
+	CPStampTable nueva;
+	int g, pos, fuera;
+	
+	fuera = 0;
+	for (g = 0; g < table->count; g++) {
+		if (cpstamp_catalog_find (catalog, table->ids[g]) < 0) fuera++;
+	}
+	
+	cpstamp_table_init (&nueva);
+	if (catalog->count + fuera > 0 && !cpstamp_table_resize_all (&nueva, catalog->count + fuera)) {
+		cpstamp_table_free (&nueva);
+		return FALSE;
+	}
+	
+	for (g = 0; g < catalog->count; g++) {
+		nueva.ids[g] = catalog->entries[g].id;
+		nueva.categorias[g] = catalog->entries[g].categoria;
+		nueva.dificultades[g] = catalog->entries[g].dificultad;
+		nueva.ganadas[g] = FALSE;
+		nueva.titulos[g] = nueva.descripciones[g] = nueva.imagenes[g] = 0;
+	}
+	nueva.count = catalog->count;
+	
+	for (g = 0; g < table->count; g++) {
+		pos = cpstamp_catalog_find (catalog, table->ids[g]);
+		if (pos < 0) {
+			pos = nueva.count++;
+			nueva.ids[pos] = table->ids[g];
+			nueva.categorias[pos] = table->categorias[g];
+			nueva.dificultades[pos] = table->dificultades[g];
+			nueva.ganadas[pos] = FALSE;
+			nueva.titulos[pos] = table->titulos[g];
+			nueva.descripciones[pos] = table->descripciones[g];
+			nueva.imagenes[pos] = table->imagenes[g];
+		}
+		
+		if (table->ganadas[g]) nueva.ganadas[pos] = TRUE;
+	}
+	
+	/* Los textos pasan completos a la tabla nueva */
+	nueva.textos = table->textos;
+	nueva.textos_fijos = table->textos_fijos;
+	nueva.catalogo = catalog;
+	table->textos = NULL;
+	
+	cpstamp_table_free (table);
+	*table = nueva;
+	
+	return TRUE;
+}
+
+/* Copia "len" bytes como una cadena nueva y deja su posición en "pos" */
+int cpstamp_table_add_text (CPStampTable *table, const char *str, size_t len, Uint32 *pos) {
+	Uint32 propia;
+	char *data;
+	
+	/* La cadena puede venir de la misma tabla, y los textos se pueden mover */
+	propia = 0;
+	if (table->textos != NULL && str > CPSTAMP_TABLE_DATA (table->textos) && str < CPSTAMP_TABLE_DATA (table->textos) + table->textos->len) {
+		propia = str - CPSTAMP_TABLE_DATA (table->textos);
+	}
+	
+	if (!cpstamp_table_grow_text (table, len + 1)) return FALSE;
+	
+	data = CPSTAMP_TABLE_DATA (table->textos);
+	if (propia != 0) str = &data[propia];
+	
+	*pos = table->textos->len;
+	memcpy (&data[*pos], str, len);
+	data[*pos + len] = 0;
+	table->textos->len += len + 1;
+	
+	return TRUE;
+}
+
+/* Cambia una de las cadenas de una estampa. Si es igual a la que ya
+ * tenía no se copia, como al registrar las estampas leídas del archivo */
+int cpstamp_table_set_text (CPStampTable *table, Uint32 *pos, const char *str) {
+	const char *actual;
+	
+	if (str == NULL) {
+		*pos = 0;
+		return TRUE;
+	}
+	
+	actual = cpstamp_table_string (table, *pos);
+	if (actual != NULL && strcmp (actual, str) == 0) return TRUE;
+	
+	return cpstamp_table_add_text (table, str, strlen (str), pos);
+}
+
+/* La cadena para usarla fuera de la tabla. Desde ahora los textos
+ * ya no se mueven de lugar, el apuntador vale hasta liberar la tabla */
+const char *cpstamp_table_keep (CPStampTable *table, Uint32 pos) {
+	if (pos == 0) return NULL;
+	
+	table->textos_fijos = TRUE;
+	
+	return cpstamp_table_string (table, pos);
+}
+
+/* Los textos de la estampa "g" para usarlos fuera de la tabla, ver
+ * cpstamp_table_keep. Los del catálogo siempre son válidos */
+const char *cpstamp_table_keep_title (CPStampTable *table, int g) {
+	if (cpstamp_table_fixed (table, g)) return table->catalogo->entries[g].titulo;
+	
+	return cpstamp_table_keep (table, table->titulos[g]);
+}
+
+const char *cpstamp_table_keep_description (CPStampTable *table, int g) {
+	if (cpstamp_table_fixed (table, g)) return table->catalogo->entries[g].descripcion;
+	
+	return cpstamp_table_keep (table, table->descripciones[g]);
+}
+
+/* Las traducciones de la tabla, vacías si cambió el idioma desde la última
+ * vez. Regresa NULL si no hubo memoria */
+const char **cpstamp_table_l10n (CPStampTable *table, int serial) {
+	if (table->l10n == NULL) {
+		table->l10n = (const char **) calloc (table->size * 2, sizeof (const char *));
+		if (table->l10n == NULL) return NULL;
+	} else if (table->l10n_serial != serial) {
+		memset (table->l10n, 0, table->size * 2 * sizeof (const char *));
+	}
+	
+	table->l10n_serial = serial;
+	
+	return table->l10n;
+}
+
+/* Memoria reservada por la tabla, incluyendo los bloques de textos viejos */
+Uint32 cpstamp_table_memory (const CPStampTable *table) {
+	CPStampTableText *bloque;
+	Uint32 total;
+	
+	total = table->size * (sizeof (int) + 3 * sizeof (Uint8) + 3 * sizeof (Uint32));
+	if (table->l10n != NULL) total += table->size * 2 * sizeof (const char *);
+	
+	for (bloque = table->textos; bloque != NULL; bloque = bloque->anterior) {
+		total += sizeof (CPStampTableText) + bloque->size;
+	}
+	
+	return total;
+}
+
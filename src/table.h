@@ -0,0 +1,113 @@
+/*
+ * table.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_TABLE_H__
+#define __CPSTAMP_TABLE_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+
+/* Bloque con los textos de las estampas. Los bloques viejos se conservan
+ * si alguien ya tiene apuntadores a sus cadenas */
+typedef struct _CPStampTableText {
+	struct _CPStampTableText *anterior;
+	Uint32 len, size;
+} CPStampTableText;
+
+/* Las estampas de una categoría, un arreglo por campo. La estampa "g" es
+ * ids[g], categorias[g], etc. Las cadenas son posiciones dentro de los
+ * textos, la posición 0 es NULL */
+typedef struct {
+	int count, size;
+	
+	int *ids;
+	Uint8 *categorias;
+	Uint8 *dificultades;
+	Uint8 *ganadas;
+	
+	Uint32 *titulos;
+	Uint32 *descripciones;
+	Uint32 *imagenes;
+	
+	CPStampTableText *textos;
+	int textos_fijos;
+	
+	/* Traducciones del título y la descripción, dos por estampa.
+	 * Se reservan la primera vez que se piden */
+	const char **l10n;
+	int l10n_serial;
+	
+	/* Catálogo fijo: sus estampas ocupan los primeros lugares y sus textos
+	 * se quedan en él, ver CPStamp_AttachCatalog */
+	const CPStampCatalog *catalogo;
+} CPStampTable;
+
+void cpstamp_table_init (CPStampTable *table);
+void cpstamp_table_free (CPStampTable *table);
+int cpstamp_table_reserve (CPStampTable *table, int count, Uint32 text);
+void cpstamp_table_trim (CPStampTable *table);
+int cpstamp_table_copy (CPStampTable *dest, const CPStampTable *src);
+
+int cpstamp_table_find (const CPStampTable *table, int id);
+int cpstamp_table_append (CPStampTable *table, int id);
+int cpstamp_table_attach (CPStampTable *table, const CPStampCatalog *catalog);
+
+int cpstamp_table_add_text (CPStampTable *table, const char *str, size_t len, Uint32 *pos);
+int cpstamp_table_set_text (CPStampTable *table, Uint32 *pos, const char *str);
+const char *cpstamp_table_keep (CPStampTable *table, Uint32 pos);
+const char *cpstamp_table_keep_title (CPStampTable *table, int g);
+const char *cpstamp_table_keep_description (CPStampTable *table, int g);
+const char **cpstamp_table_l10n (CPStampTable *table, int serial);
+Uint32 cpstamp_table_memory (const CPStampTable *table);
+
+/* La cadena en la posición "pos", válida hasta que la tabla cambie */
+static inline const char *cpstamp_table_string (const CPStampTable *table, Uint32 pos) {
+	if (pos == 0) return NULL;
+	
+	return (const char *) (table->textos + 1) + pos;
+}
+
+/* ¿La estampa "g" es del catálogo? */
+static inline int cpstamp_table_fixed (const CPStampTable *table, int g) {
+	return table->catalogo != NULL && g < table->catalogo->count;
+}
+
+/* Los textos de la estampa "g", válidos hasta que la tabla cambie */
+static inline const char *cpstamp_table_title (const CPStampTable *table, int g) {
+	if (cpstamp_table_fixed (table, g)) return table->catalogo->entries[g].titulo;
+	
+	return cpstamp_table_string (table, table->titulos[g]);
+}
+
+static inline const char *cpstamp_table_description (const CPStampTable *table, int g) {
+	if (cpstamp_table_fixed (table, g)) return table->catalogo->entries[g].descripcion;
+	
+	return cpstamp_table_string (table, table->descripciones[g]);
+}
+
+static inline const char *cpstamp_table_image (const CPStampTable *table, int g) {
+	if (cpstamp_table_fixed (table, g)) return table->catalogo->entries[g].imagen;
+	
+	return cpstamp_table_string (table, table->imagenes[g]);
+}
+
+#endif /* __CPSTAMP_TABLE_H__ */
+
@@ -0,0 +1,388 @@
+/*
+ * text.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "text.h"
+#include "stats.h"
+#include "compat.h"
+
+/* Sin SDL_ttf la notificación no lleva textos y no hace falta el atlas */
+#ifdef HAVE_SDL_TTF
+
+/* Tamaño del atlas de caracteres */
+#define ATLAS_W 256
+#define ATLAS_H 256
+
+/* Entradas de la tabla hash, debe ser potencia de 2 */
+#define GLYPH_SLOTS 512
+
+#ifndef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+/* Entradas de la tabla de kerning por parejas, potencia de 2 */
+#define KERN_SLOTS 256
+#endif
+
+typedef struct {
+	int used;
+	Uint32 ch;
+	Uint32 color;
+	
+	/* Posición dentro del atlas */
+	SDL_Rect rect;
+	int offset_x;
+	int advance;
+} CPStampGlyph;
+
+#ifndef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+typedef struct {
+	int used;
+	Uint32 prev, ch;
+	int kerning;
+} CPStampKernPair;
+#endif
+
+struct _CPStampGlyphCache {
+	TTF_Font *font;
+	SDL_Surface *atlas;
+	CPStampStats *stats;
+	
+	/* Empacado por renglones del atlas */
+	int shelf_x, shelf_y, shelf_h;
+	
+	int n_glyphs;
+	CPStampGlyph glyphs[GLYPH_SLOTS];
+
+#ifndef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+	int n_pairs;
+	CPStampKernPair pairs[KERN_SLOTS];
+#endif
+};
+
+/* Decodificar un caracter UTF-8, avanza el apuntador */
+static Uint32 cpstamp_utf8_next (const unsigned char **text) {
+	const unsigned char *p = *text;
+	Uint32 ch;
+	int extra, g;
+	
+	if (p[0] < 0x80) {
+		ch = p[0];
+		extra = 0;
+	} else if ((p[0] & 0xE0) == 0xC0) {
+		ch = p[0] & 0x1F;
+		extra = 1;
+	} else if ((p[0] & 0xF0) == 0xE0) {
+		ch = p[0] & 0x0F;
+		extra = 2;
+	} else if ((p[0] & 0xF8) == 0xF0) {
+		ch = p[0] & 0x07;
+		extra = 3;
+	} else {
+		*text = p + 1;
+		return 0xFFFD;
+	}
+	
+	for (g = 1; g <= extra; g++) {
+		if ((p[g] & 0xC0) != 0x80) {
+			/* Secuencia cortada */
+			*text = p + g;
+			return 0xFFFD;
+		}
+		ch = (ch << 6) | (p[g] & 0x3F);
+	}
+	
+	*text = p + extra + 1;
+	
+	/* SDL_ttf sólo maneja el plano básico */
+	if (ch > 0xFFFF) return 0xFFFD;
+	
+	return ch;
+}
+
+static void cpstamp_utf8_encode (Uint32 ch, char *buf) {
+	if (ch < 0x80) {
+		buf[0] = ch;
+		buf[1] = 0;
+	} else if (ch < 0x800) {
+		buf[0] = 0xC0 | (ch >> 6);
+		buf[1] = 0x80 | (ch & 0x3F);
+		buf[2] = 0;
+	} else {
+		buf[0] = 0xE0 | (ch >> 12);
+		buf[1] = 0x80 | ((ch >> 6) & 0x3F);
+		buf[2] = 0x80 | (ch & 0x3F);
+		buf[3] = 0;
+	}
+}
+
+static void cpstamp_glyph_cache_flush (CPStampGlyphCache *cache) {
+	memset (cache->glyphs, 0, sizeof (cache->glyphs));
+	cache->n_glyphs = 0;
+	cache->shelf_x = cache->shelf_y = cache->shelf_h = 0;
+}
+
+#ifndef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+/* Sin TTF_GetFontKerningSizeGlyphs, el kerning de la pareja es lo que mide
+ * SDL_ttf para los dos caracteres juntos menos sus avances. Se quitan también
+ * lo que el primero sobresale a la izquierda y el segundo a la derecha */
+static int cpstamp_kerning_measure (TTF_Font *font, Uint32 prev, Uint32 ch) {
+	char buf[8];
+	int minx_a, adv_a, maxx_b, adv_b, w;
+	
+	if (TTF_GlyphMetrics (font, prev, &minx_a, NULL, NULL, NULL, &adv_a) < 0) return 0;
+	if (TTF_GlyphMetrics (font, ch, NULL, &maxx_b, NULL, NULL, &adv_b) < 0) return 0;
+	
+	cpstamp_utf8_encode (prev, buf);
+	cpstamp_utf8_encode (ch, buf + strlen (buf));
+	
+	if (TTF_SizeUTF8 (font, buf, &w, NULL) < 0) return 0;
+	
+	if (minx_a < 0) w += minx_a;
+	if (maxx_b > adv_b) w -= maxx_b - adv_b;
+	
+	return w - adv_a - adv_b;
+}
+
+static int cpstamp_kerning_lookup (CPStampGlyphCache *cache, Uint32 prev, Uint32 ch) {
+	CPStampKernPair *pair;
+	int slot;
+	
+	slot = ((prev * 2654435761u) ^ (ch * 40503u)) & (KERN_SLOTS - 1);
+	while (cache->pairs[slot].used) {
+		if (cache->pairs[slot].prev == prev && cache->pairs[slot].ch == ch) {
+			return cache->pairs[slot].kerning;
+		}
+		slot = (slot + 1) & (KERN_SLOTS - 1);
+	}
+	
+	if (cache->n_pairs >= (KERN_SLOTS * 3) / 4) {
+		/* Tabla demasiado llena, empezar de nuevo */
+		memset (cache->pairs, 0, sizeof (cache->pairs));
+		cache->n_pairs = 0;
+		return cpstamp_kerning_lookup (cache, prev, ch);
+	}
+	
+	pair = &cache->pairs[slot];
+	pair->used = 1;
+	pair->prev = prev;
+	pair->ch = ch;
+	pair->kerning = cpstamp_kerning_measure (cache->font, prev, ch);
+	cache->n_pairs++;
+	
+	return pair->kerning;
+}
+#endif
+
+/* Rasterizar el caracter y copiarlo al atlas */
+static int cpstamp_glyph_render (CPStampGlyphCache *cache, CPStampGlyph *glyph, SDL_Color color) {
+	char buf[8];
+	SDL_Surface *surface;
+	int minx, w, h;
+	
+	if (TTF_GlyphMetrics (cache->font, glyph->ch, &minx, NULL, NULL, NULL, &glyph->advance) < 0) {
+		return -1;
+	}
+	
+	cpstamp_utf8_encode (glyph->ch, buf);
+	surface = TTF_RenderUTF8_Blended (cache->font, buf, color);
+	
+	if (surface == NULL) return -1;
+	
+	if (surface->w > ATLAS_W || surface->h > ATLAS_H) {
+		SDL_FreeSurface (surface);
+		return -1;
+	}
+	
+	/* Buscar espacio en el renglón actual, o abrir uno nuevo */
+	if (cache->shelf_x + surface->w > ATLAS_W) {
+		cache->shelf_x = 0;
+		cache->shelf_y += cache->shelf_h;
+		cache->shelf_h = 0;
+	}
+	
+	if (cache->shelf_y + surface->h > ATLAS_H) {
+		/* Atlas lleno */
+		SDL_FreeSurface (surface);
+		return -2;
+	}
+	
+	w = surface->w;
+	h = surface->h;
+	
+	glyph->rect.x = cache->shelf_x;
+	glyph->rect.y = cache->shelf_y;
+	glyph->rect.w = w;
+	glyph->rect.h = h;
+	
+	/* SDL_ttf recorre el primer caracter si tiene minx negativo */
+	glyph->offset_x = (minx < 0) ? minx : 0;
+	
+	/* Copiar sin mezclar, incluyendo el canal alpha */
+	cpstamp_surface_disable_blend (surface);
+	SDL_BlitSurface (surface, NULL, cache->atlas, &glyph->rect);
+	SDL_FreeSurface (surface);
+	
+	/* La copia pudo modificar el rectángulo */
+	glyph->rect.x = cache->shelf_x;
+	glyph->rect.y = cache->shelf_y;
+	glyph->rect.w = w;
+	glyph->rect.h = h;
+	
+	cache->shelf_x += w;
+	if (h > cache->shelf_h) cache->shelf_h = h;
+	
+	return 0;
+}
+
+static CPStampGlyph *cpstamp_glyph_lookup (CPStampGlyphCache *cache, Uint32 ch, SDL_Color color) {
+	CPStampGlyph *glyph;
+	Uint32 key_color;
+	int slot, res;
+	
+	key_color = (color.r << 16) | (color.g << 8) | color.b;
+	
+	slot = ((ch * 2654435761u) ^ key_color) & (GLYPH_SLOTS - 1);
+	while (cache->glyphs[slot].used) {
+		if (cache->glyphs[slot].ch == ch && cache->glyphs[slot].color == key_color) {
+			return &cache->glyphs[slot];
+		}
+		slot = (slot + 1) & (GLYPH_SLOTS - 1);
+	}
+	
+	if (cache->n_glyphs >= (GLYPH_SLOTS * 3) / 4) {
+		/* Tabla demasiado llena, empezar de nuevo */
+		cpstamp_glyph_cache_flush (cache);
+		return cpstamp_glyph_lookup (cache, ch, color);
+	}
+	
+	glyph = &cache->glyphs[slot];
+	glyph->ch = ch;
+	glyph->color = key_color;
+	
+	res = cpstamp_glyph_render (cache, glyph, color);
+	
+	if (res == -2 && cache->n_glyphs > 0) {
+		/* Atlas lleno, vaciarlo y reintentar */
+		cpstamp_glyph_cache_flush (cache);
+		return cpstamp_glyph_lookup (cache, ch, color);
+	} else if (res < 0) {
+		return NULL;
+	}
+	
+	glyph->used = 1;
+	cache->n_glyphs++;
+	
+	return glyph;
+}
+
+CPStampGlyphCache *cpstamp_glyph_cache_new (TTF_Font *font, CPStampStats *stats) {
+	CPStampGlyphCache *cache;
+	
+	if (font == NULL) return NULL;
+	
+	cache = (CPStampGlyphCache *) malloc (sizeof (CPStampGlyphCache));
+	
+	if (cache == NULL) return NULL;
+	
+	cache->atlas = SDL_CreateRGBSurface (SDL_SWSURFACE, ATLAS_W, ATLAS_H, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	
+	if (cache->atlas == NULL) {
+		free (cache);
+		return NULL;
+	}
+	
+	cache->font = font;
+	cache->stats = stats;
+	cpstamp_glyph_cache_flush (cache);
+
+#ifndef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+	/* El kerning no depende del color, no se vacía junto con el atlas */
+	memset (cache->pairs, 0, sizeof (cache->pairs));
+	cache->n_pairs = 0;
+#endif
+
+	return cache;
+}
+
+/* Dibuja el texto usando los caracteres del atlas. Regresa el ancho dibujado */
+int cpstamp_glyph_cache_draw (CPStampGlyphCache *cache, const char *text, SDL_Color color, SDL_Surface *dest, int x, int y) {
+	const unsigned char *p;
+	CPStampGlyph *glyph;
+	SDL_Rect rect;
+	Uint32 ch;
+	int pen;
+	Uint32 prev = 0;
+	
+	if (cache == NULL || text == NULL) return 0;
+	
+	p = (const unsigned char *) text;
+	pen = x;
+	
+	while (*p != 0) {
+		ch = cpstamp_utf8_next (&p);
+		
+		if (prev != 0 && TTF_GetFontKerning (cache->font)) {
+#ifdef HAVE_TTF_GETFONTKERNINGSIZEGLYPHS
+			pen += TTF_GetFontKerningSizeGlyphs (cache->font, prev, ch);
+#else
+			pen += cpstamp_kerning_lookup (cache, prev, ch);
+#endif
+		}
+		prev = ch;
+		
+		glyph = cpstamp_glyph_lookup (cache, ch, color);
+		
+		if (glyph == NULL) continue;
+		
+		rect.x = pen + glyph->offset_x;
+		rect.y = y;
+		rect.w = glyph->rect.w;
+		rect.h = glyph->rect.h;
+		
+		cpstamp_blit (cache->stats, cache->atlas, &glyph->rect, dest, &rect);
+		
+		pen += glyph->advance;
+	}
+	
+	return pen - x;
+}
+
+/* Memoria que ocupa el atlas */
+int cpstamp_glyph_cache_bytes (CPStampGlyphCache *cache) {
+	if (cache == NULL) return 0;
+	
+	return cache->atlas->h * cache->atlas->pitch;
+}
+
+void cpstamp_glyph_cache_free (CPStampGlyphCache *cache) {
+	if (cache == NULL) return;
+	
+	SDL_FreeSurface (cache->atlas);
+	free (cache);
+}
+
+#endif /* HAVE_SDL_TTF */
+
@@ -0,0 +1,41 @@
+/*
+ * text.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_TEXT_H__
+#define __CPSTAMP_TEXT_H__
+
+#include <SDL.h>
+
+#include "cpstamp.h"
+
+/* Sólo existe si la librería se construyó con SDL_ttf */
+#ifdef HAVE_SDL_TTF
+#include <SDL_ttf.h>
+
+typedef struct _CPStampGlyphCache CPStampGlyphCache;
+
+CPStampGlyphCache *cpstamp_glyph_cache_new (TTF_Font *font, CPStampStats *stats);
+int cpstamp_glyph_cache_draw (CPStampGlyphCache *cache, const char *text, SDL_Color color, SDL_Surface *dest, int x, int y);
+int cpstamp_glyph_cache_bytes (CPStampGlyphCache *cache);
+void cpstamp_glyph_cache_free (CPStampGlyphCache *cache);
+#endif
+
+#endif /* __CPSTAMP_TEXT_H__ */
+
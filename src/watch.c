@@ -0,0 +1,96 @@
+/*
+ * watch.c
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Vigilancia de la carpeta .cpstamps con inotify, para enterarse cuando
+ * otro proceso guarda una categoría sin revisar los archivos cada tanto */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined (HAVE_SYS_INOTIFY_H) && defined (HAVE_INOTIFY_INIT1)
+#define CPSTAMP_WATCH 1
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+/* Abre la vigilancia de la carpeta "path". Los guardados de archivos
+ * terminan en un rename, los de la base de datos escriben en su lugar.
+ * Regresa el descriptor, que nunca espera al leer, o -1 */
+int cpstamp_watch_open (const char *path) {
+#ifdef CPSTAMP_WATCH
+	int fd, err;
+	
+	fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) return -1;
+	
+	if (inotify_add_watch (fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) < 0) {
+		err = errno;
+		close (fd);
+		errno = err;
+		return -1;
+	}
+	
+	return fd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Lee los avisos pendientes sin esperar y llama a "fn" con cada uno.
+ * Regresa cuántos avisos hubo */
+int cpstamp_watch_read (int fd, CPStampWatchFunc fn, void *arg) {
+#ifdef CPSTAMP_WATCH
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct inotify_event *ev;
+	ssize_t res, g;
+	int avisos;
+	
+	avisos = 0;
+	while ((res = read (fd, u.buf, sizeof (u.buf))) > 0) {
+		for (g = 0; g < res; g += sizeof (struct inotify_event) + ev->len) {
+			ev = (struct inotify_event *) &u.buf[g];
+			avisos++;
+			
+			if (ev->mask & IN_Q_OVERFLOW) {
+				fn (NULL, arg);
+			} else if (ev->len > 0) {
+				fn (ev->name, arg);
+			}
+		}
+	}
+	
+	return avisos;
+#else
+	return 0;
+#endif
+}
+
@@ -0,0 +1,32 @@
+/*
+ * watch.h
+ * This file is part of LibCPStamp
+ *
+ * Copyright (C) 2014 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CPSTAMP_WATCH_H__
+#define __CPSTAMP_WATCH_H__
+
+/* Aviso de la vigilancia: el nombre del archivo que cambió dentro de la
+ * carpeta, o NULL si se perdieron avisos y hay que revisar todo */
+typedef void (*CPStampWatchFunc) (const char *name, void *arg);
+
+int cpstamp_watch_open (const char *path);
+int cpstamp_watch_read (int fd, CPStampWatchFunc fn, void *arg);
+
+#endif /* __CPSTAMP_WATCH_H__ */
+